@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""lorun benchmarks.
+
+    python3 bench/bench.py run [-o out.json] [--repeat N] [--sizes 1,16,64]
+    python3 bench/bench.py compare old.json new.json [--threshold 5]
+
+run compiles the synthetic submissions in bench/programs and measures
+spawn-to-exit latency, traced syscall overhead, output/memory programs,
+checker throughput and compile overhead. Results are written as JSON so two
+builds can be compared with `compare`.
+
+check() answers OLE without comparing once the user output reaches
+MAX_OUTPUT (100000000 bytes), so larger --sizes report that latency instead
+of a throughput.
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import lorun
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PROGRAMS = ('noop', 'reader', 'writer', 'toucher')
+READER_BYTES = 100000
+CHECK_RESULTS = {0: 'AC', 1: 'PE', 4: 'WA', 6: 'OLE'}
+
+
+class Bench(object):
+    def __init__(self, workdir, repeat):
+        self.workdir = workdir
+        self.repeat = repeat
+        self.results = {}
+        self.devnull = open(os.devnull, 'w')
+
+    def record(self, name, samples, unit, better='lower', scale=1.0):
+        values = sorted(v * scale for v in samples)
+        self.results[name] = {
+            'unit': unit,
+            'better': better,
+            'median': statistics.median(values),
+            'min': values[0],
+            'p90': values[int(len(values) * 0.9) if len(values) > 1 else 0],
+            'n': len(values),
+        }
+        print('%-36s %12.2f %s' % (name, self.results[name]['median'], unit))
+
+    def path(self, name):
+        return os.path.join(self.workdir, name)
+
+    def cfg(self, prog, *args, **kw):
+        cfg = {
+            'args': [self.path(prog)] + [str(a) for a in args],
+            'fd_out': self.devnull.fileno(),
+            'timelimit': 10000,
+            'memorylimit': 1024 * 1024,
+        }
+        cfg.update(kw)
+        return cfg
+
+    def timed_runs(self, cfg, fd_in_path=None, fd_out_path=None):
+        samples = []
+        for _ in range(self.repeat):
+            fin = open(fd_in_path) if fd_in_path else None
+            fout = open(fd_out_path, 'w') if fd_out_path else None
+            if fin:
+                cfg['fd_in'] = fin.fileno()
+            if fout:
+                cfg['fd_out'] = fout.fileno()
+            t0 = time.perf_counter()
+            rst = lorun.run(cfg)
+            samples.append(time.perf_counter() - t0)
+            for f in (fin, fout):
+                if f:
+                    f.close()
+            if rst['result'] != 0:
+                raise RuntimeError('%s: %r' % (cfg['args'][0], rst))
+        return samples
+
+    def compile_cmd(self, prog):
+        return ['gcc', '-O2', '-o', self.path(prog),
+                os.path.join(HERE, 'programs', prog + '.c')]
+
+    def compile_programs(self):
+        """编译合成提交，再交替直接运行编译器和compile()测量其开销"""
+        cfg = {'timelimit': 30000, 'memorylimit': 1024 * 1024}
+        for prog in PROGRAMS:
+            cfg['args'] = self.compile_cmd(prog)
+            err = lorun.compile(cfg)
+            if err:
+                raise RuntimeError('compile %s: %s' % (prog, err))
+
+        direct, wrapped = [], []
+        cfg['args'] = self.compile_cmd('noop')
+        for _ in range(self.repeat):
+            t0 = time.perf_counter()
+            subprocess.check_call(cfg['args'])
+            direct.append(time.perf_counter() - t0)
+            t0 = time.perf_counter()
+            lorun.compile(cfg)
+            wrapped.append(time.perf_counter() - t0)
+        self.record('compile.direct', direct, 'ms', scale=1e3)
+        self.record('compile.lorun', wrapped, 'ms', scale=1e3)
+
+    def spawn(self):
+        self.record('spawn.noop', self.timed_runs(self.cfg('noop')),
+                    'us', scale=1e6)
+        self.record('spawn.noop.trace',
+                    self.timed_runs(self.cfg('noop', trace=True, policy='c')),
+                    'us', scale=1e6)
+        rc = lorun.RunConfig(self.cfg('noop'))
+        self.record('spawn.noop.runconfig', self.timed_runs(rc), 'us',
+                    scale=1e6)
+
+    def syscalls(self):
+        """同一输入在跟踪和不跟踪时的耗时差除以read次数"""
+        data = self.path('reader.in')
+        with open(data, 'w') as f:
+            f.write('x' * READER_BYTES)
+        plain = self.timed_runs(self.cfg('reader'), data)
+        traced = self.timed_runs(self.cfg('reader', trace=True, policy='c'),
+                                 data)
+        self.record('trace.per_syscall',
+                    [(t - p) / READER_BYTES for t, p in
+                     zip(sorted(traced), sorted(plain))], 'ns', scale=1e9)
+
+    def programs(self):
+        out = self.path('writer.out')
+        self.record('writer.64mb',
+                    self.timed_runs(self.cfg('writer', 64), None, out),
+                    'ms', scale=1e3)
+        self.record('writer.64mb.trace',
+                    self.timed_runs(self.cfg('writer', 64, trace=True,
+                                             policy='c'), None, out),
+                    'ms', scale=1e3)
+        self.record('toucher.256mb', self.timed_runs(self.cfg('toucher', 256)),
+                    'ms', scale=1e3)
+
+    def write_pair(self, size, kind):
+        """生成size字节的标准答案和AC/PE/WA三种用户输出"""
+        right, user = self.path('check.right'), self.path('check.user')
+        line = b'1234567 89\n'
+        body = line * (size // len(line))
+        with open(right, 'wb') as f:
+            f.write(body)
+        with open(user, 'wb') as f:
+            if kind == 'AC':
+                f.write(body)
+            elif kind == 'PE':
+                f.write(body.replace(b' ', b'  ', 1))
+            else:
+                f.write(body[:-2] + b'0\n')
+        return right, user
+
+    def check(self, sizes):
+        for size_mb in sizes:
+            for kind in ('AC', 'PE', 'WA'):
+                right, user = self.write_pair(size_mb << 20, kind)
+                samples = []
+                with open(right) as fr, open(user) as fu:
+                    for _ in range(self.repeat):
+                        t0 = time.perf_counter()
+                        got = lorun.check(fr.fileno(), fu.fileno())
+                        samples.append(time.perf_counter() - t0)
+                name = 'check.%s.%dmb' % (kind, size_mb)
+                if CHECK_RESULTS.get(got) == kind:
+                    self.record(name, [(size_mb / s) for s in samples],
+                                'MB/s', better='higher')
+                else:
+                    # 超过MAX_OUTPUT时没有比较内容，吞吐量没有意义
+                    name += '.' + CHECK_RESULTS.get(got, str(got))
+                    self.record(name, samples, 'us', scale=1e6)
+
+
+def run(args):
+    workdir = tempfile.mkdtemp(prefix='lorun-bench-')
+    bench = Bench(workdir, args.repeat)
+    try:
+        bench.compile_programs()
+        bench.spawn()
+        bench.syscalls()
+        bench.programs()
+        bench.check([int(s) for s in args.sizes.split(',')])
+    finally:
+        shutil.rmtree(workdir)
+
+    out = {
+        'meta': {
+            'python': platform.python_version(),
+            'kernel': platform.release(),
+            'machine': platform.machine(),
+            'cpus': os.cpu_count(),
+            'repeat': args.repeat,
+            'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        },
+        'results': bench.results,
+    }
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(out, f, indent=2, sort_keys=True)
+    return 0
+
+
+def compare(args):
+    with open(args.old) as f:
+        old = json.load(f)['results']
+    with open(args.new) as f:
+        new = json.load(f)['results']
+
+    regressed = 0
+    print('%-36s %12s %12s %9s' % ('benchmark', 'old', 'new', 'change'))
+    for name in sorted(set(old) | set(new)):
+        if name not in old or name not in new:
+            print('%-36s %s' % (name, 'only in ' + ('new' if name in new
+                                                    else 'old')))
+            continue
+        o, n = old[name]['median'], new[name]['median']
+        change = (n - o) / o * 100 if o else 0.0
+        worse = change > 0 if old[name]['better'] == 'lower' else change < 0
+        flag = ''
+        if worse and abs(change) > args.threshold:
+            flag = '  REGRESSION'
+            regressed += 1
+        print('%-36s %12.2f %12.2f %+8.1f%%%s' % (name, o, n, change, flag))
+
+    return 1 if regressed and args.fail else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='lorun benchmarks')
+    sub = parser.add_subparsers(dest='cmd')
+
+    p = sub.add_parser('run', help='run the benchmarks')
+    p.add_argument('-o', '--output', help='write JSON results to this file')
+    p.add_argument('--repeat', type=int, default=20)
+    p.add_argument('--sizes', default='1,16,64',
+                   help='checker sizes in MB, comma separated')
+
+    p = sub.add_parser('compare', help='compare two JSON result files')
+    p.add_argument('old')
+    p.add_argument('new')
+    p.add_argument('--threshold', type=float, default=5.0,
+                   help='percent change reported as a regression')
+    p.add_argument('--fail', action='store_true',
+                   help='exit 1 when a regression is found')
+
+    args = parser.parse_args()
+    if args.cmd == 'run':
+        return run(args)
+    if args.cmd == 'compare':
+        return compare(args)
+    parser.print_help()
+    return 2
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,4 @@
+/* 什么都不做，用于测量启动到退出的延迟 */
+int main(void) {
+    return 0;
+}
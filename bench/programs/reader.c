@@ -0,0 +1,11 @@
+/* 每次read一个字节读完标准输入，用于测量每个系统调用的跟踪开销 */
+#include <unistd.h>
+
+int main(void) {
+    char c;
+    long n = 0;
+
+    while (read(0, &c, 1) == 1)
+        n++;
+    return n == 0;
+}
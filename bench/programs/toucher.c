@@ -0,0 +1,13 @@
+/* 申请并逐页写入argv[1] MB内存 */
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+    long size = (argc > 1 ? atol(argv[1]) : 64) << 20, i;
+    volatile char *p = malloc(size);
+
+    if (p == NULL)
+        return 1;
+    for (i = 0; i < size; i += 4096)
+        p[i] = 1;
+    return 0;
+}
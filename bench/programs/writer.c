@@ -0,0 +1,17 @@
+/* 向标准输出写argv[1] MB的数据 */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+    static char buf[1 << 16];
+    long total = (argc > 1 ? atol(argv[1]) : 1) << 20, n;
+
+    memset(buf, 'x', sizeof(buf));
+    for (; total > 0; total -= n) {
+        n = total < (long) sizeof(buf) ? total : (long) sizeof(buf);
+        if (write(1, buf, n) != n)
+            return 1;
+    }
+    return 0;
+}
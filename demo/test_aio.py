@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# run_async只在内核没有pidfd_open(ENOSYS)时改用run_in_executor
+
+import asyncio
+import errno
+import unittest
+
+import lorun
+from lorun import aio
+
+CFG = {'args': ['true'], 'timelimit': 1000, 'memorylimit': 65536}
+
+
+def failing(err):
+    def starter(cfg, *args):
+        raise OSError(err, 'starter failure')
+    return starter
+
+
+class AioFallbackTest(unittest.TestCase):
+
+    def setUp(self):
+        self.loop = asyncio.new_event_loop()
+        aio._pidfd_supported = True
+
+    def tearDown(self):
+        self.loop.close()
+        aio._pidfd_supported = True
+
+    def start(self, starter):
+        return self.loop.run_until_complete(
+            aio._start(starter, lambda cfg: 'fallback', CFG))
+
+    def test_pidfd(self):
+        rst = self.loop.run_until_complete(lorun.run_async(CFG))
+        self.assertEqual(rst['result'], 0)
+
+    def test_other_error_raises(self):
+        with self.assertRaises(OSError) as cm:
+            self.start(failing(errno.EMFILE))
+        self.assertEqual(cm.exception.errno, errno.EMFILE)
+        self.assertTrue(aio._pidfd_supported)
+
+    def test_enosys_falls_back(self):
+        self.assertEqual(self.start(failing(errno.ENOSYS)), 'fallback')
+        self.assertFalse(aio._pidfd_supported)
+        self.assertEqual(self.start(failing(errno.EMFILE)), 'fallback')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# 内存中的输入输出：bytes作为标准输入，CAPTURE捕获标准输出，check比较缓冲区
+
+import unittest
+
+import lorun
+
+CFG = {'args': ['cat'], 'timelimit': 1000, 'memorylimit': 65536}
+
+
+class InMemoryIOTest(unittest.TestCase):
+
+    def test_readme_workflow(self):
+        rst = lorun.run(CFG, b'1 2\n', lorun.CAPTURE)
+        self.assertEqual(rst['result'], 0)
+        rst['result'] = lorun.check(b'1 2\n', rst['output'])
+        self.assertEqual(rst['result'], 0)
+
+        rst = lorun.run(CFG, b'1 2\n', lorun.CAPTURE)
+        rst['result'] = lorun.check(b'3\n', rst['output'])
+        self.assertEqual(rst['result'], 4)
+
+    def test_capture(self):
+        data = bytes(range(256)) * 1000
+        rst = lorun.run(CFG, data, lorun.CAPTURE)
+        out = rst['output']
+        self.assertIsInstance(out, memoryview)
+        self.assertTrue(out.readonly)
+        self.assertEqual(bytes(out), data)
+        self.assertIs(rst.output, out)
+
+    def test_empty(self):
+        rst = lorun.run(CFG, b'', lorun.CAPTURE)
+        self.assertEqual(rst['result'], 0)
+        self.assertEqual(bytes(rst['output']), b'')
+
+    def test_sealed_input(self):
+        # 输入在封印的memfd中，程序不能改写它
+        script = 'echo x 2>/dev/null >/proc/self/fd/0 || echo denied; cat'
+        rst = lorun.run(dict(CFG, args=['sh', '-c', script]), b'in\n',
+                        lorun.CAPTURE)
+        self.assertEqual(rst['result'], 0)
+        self.assertEqual(bytes(rst['output']), b'denied\nin\n')
+
+    def test_check_buffers(self):
+        self.assertEqual(lorun.check(b'1 2\n', b'1 2\n'), 0)
+        self.assertEqual(lorun.check(b'1 2\n', b'1  2\n'), 1)
+        self.assertEqual(lorun.check(b'1 2\n', b'1 3\n'), 4)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# lorun命令行程序的JSON任务解析。先make，或用LORUN指定程序
+
+import json
+import os
+import subprocess
+import unittest
+
+LORUN = os.environ.get('LORUN', os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), '..', 'build', 'c', 'lorun'))
+
+ARGS = '"args": ["true"], "timelimit": 1000, "memorylimit": 65536'
+
+
+def jobs(*lines):
+    out = subprocess.run([LORUN], input='\n'.join(lines) + '\n',
+                         stdout=subprocess.PIPE, universal_newlines=True,
+                         check=True).stdout
+    return out.splitlines()
+
+
+@unittest.skipUnless(os.access(LORUN, os.X_OK), 'lorun is not built')
+class JsonJobTest(unittest.TestCase):
+
+    def test_id_echoed(self):
+        ids = ['1', '-0.5e-3', '0', '12E+2', '"a\\"b\\u00e9\\n"',
+               '[1, {"a": null}]', 'true']
+        out = jobs(*['{"id": %s, %s}' % (i, ARGS) for i in ids])
+        for i, line in zip(ids, out):
+            with self.subTest(i):
+                self.assertEqual(json.loads(line)['id'], json.loads(i))
+                # 数字按原文写回
+                if i[0] in '-0123456789':
+                    self.assertTrue(line.startswith('{"id": %s,' % i))
+
+    def test_bad_numbers(self):
+        bad = ['nan', 'inf', '-inf', 'Infinity', '+1', '0x10', '01', '1.',
+               '.5', '1e', '1e+', '-', '1e999', '- 1']
+        out = jobs(*['{"id": %s, %s}' % (i, ARGS) for i in bad])
+        self.assertEqual(len(out), len(bad))
+        for i, line in zip(bad, out):
+            with self.subTest(i):
+                self.assertEqual(line, '{"error": "bad json job"}')
+
+    def test_bad_syntax(self):
+        bad = ['[1, 2', '{"id": 1, %s,}' % ARGS, '{"id": 1, %s} x' % ARGS,
+               '{"id" 1}', '{id: 1}', '"abc', '[' * 40 + ']' * 40,
+               '{"id": tru}']
+        out = jobs(*bad)
+        self.assertEqual(len(out), len(bad))
+        for b, line in zip(bad, out):
+            with self.subTest(b):
+                self.assertEqual(line, '{"error": "bad json job"}')
+
+    def test_number_values(self):
+        out = jobs('{"id": 1, "args": ["true"], "timelimit": 1.5e3, '
+                   '"memorylimit": 65536}')
+        self.assertEqual(json.loads(out[0])['result'], 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,34 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# setResLimit设置的资源限制和ITIMER_PROF
+
+import unittest
+
+import lorun
+
+CFG = {'timelimit': 1000, 'memorylimit': 65536}
+
+
+def shell(script, **cfg):
+    cfg = dict(CFG, args=['sh', '-c', script], **cfg)
+    return lorun.run(cfg, b'', lorun.CAPTURE)
+
+
+class LimitTest(unittest.TestCase):
+
+    def test_large_memory_limit(self):
+        # 2GB以上的限制乘以1024后超出int
+        rst = shell('ulimit -d; ulimit -v', memorylimit=3 << 20)
+        self.assertEqual(rst['result'], 0)
+        self.assertEqual(bytes(rst['output']).split(),
+                         [str(3 << 20).encode(), str(6 << 20).encode()])
+
+    def test_prof_timer(self):
+        rst = shell('while :; do :; done', timelimit=200)
+        self.assertEqual(rst['result'], 2)
+        self.assertEqual(rst['re_signum'], 27)
+        self.assertLess(rst['timeused'], 1000)
+
+
+if __name__ == '__main__':
+    unittest.main()
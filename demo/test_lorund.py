@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# lorund的套接字、连接用户检查和按类别的调度。先make，或用LORUND指定程序
+
+import json
+import os
+import shutil
+import socket
+import subprocess
+import tempfile
+import time
+import unittest
+
+LORUND = os.environ.get('LORUND', os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), '..', 'build', 'c', 'lorund'))
+
+RUN = {'args': ['sleep', '0.2'], 'timelimit': 1000, 'memorylimit': 65536}
+
+
+def submit(path, *subs):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    for sub in subs:
+        s.sendall((json.dumps(sub) + '\n').encode())
+        time.sleep(0.05)
+    s.shutdown(socket.SHUT_WR)
+    buf = b''
+    while True:
+        d = s.recv(4096)
+        if not d:
+            break
+        buf += d
+    s.close()
+    return [json.loads(line) for line in buf.decode().splitlines()]
+
+
+@unittest.skipUnless(os.access(LORUND, os.X_OK), 'lorund is not built')
+class LorundTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, 'lorund.sock')
+        self.procs = []
+
+    def tearDown(self):
+        for p in self.procs:
+            p.kill()
+            p.wait()
+            p.stderr.close()
+        shutil.rmtree(self.dir)
+
+    def start(self, *args):
+        p = subprocess.Popen([LORUND, '-s', self.path] + list(args),
+                             stderr=subprocess.PIPE)
+        self.procs.append(p)
+        for _ in range(100):
+            if p.poll() is not None:
+                break
+            s = socket.socket(socket.AF_UNIX)
+            try:
+                s.connect(self.path)
+                break
+            except OSError:
+                time.sleep(0.01)
+            finally:
+                s.close()
+        return p
+
+    def test_refuse_other_file(self):
+        with open(self.path, 'w') as f:
+            f.write('keep')
+        p = self.start()
+        self.assertEqual(p.wait(5), 1)
+        self.assertIn(b'not a socket', p.stderr.read())
+        with open(self.path) as f:
+            self.assertEqual(f.read(), 'keep')
+
+    def test_stale_socket(self):
+        s = socket.socket(socket.AF_UNIX)
+        s.bind(self.path)
+        s.close()
+        self.start()
+        out = submit(self.path, {'id': 1, 'run': RUN, 'cases': [{}]})
+        self.assertEqual(out[-1], {'id': 1, 'done': True, 'passed': 1,
+                                   'result': 0})
+
+    def test_contest_first(self):
+        self.start('-j', '1')
+        out = submit(self.path,
+                     {'id': 1, 'class': 'practice', 'run': RUN,
+                      'cases': [{}, {}, {}]},
+                     {'id': 2, 'class': 'contest',
+                      'run': dict(RUN, args=['true']), 'cases': [{}]})
+        done = [r['id'] for r in out if r.get('done')]
+        self.assertEqual(done, [2, 1])
+        self.assertEqual([r['case'] for r in out if r['id'] == 1
+                          and 'case' in r], [0, 1, 2])
+
+    def test_stop(self):
+        self.start('-j', '1')
+        out = submit(self.path, {'id': 3, 'stop': True, 'run': RUN, 'cases': [
+            {}, {'args': ['sh', '-c', 'kill -SEGV $$']}, {}]})
+        self.assertEqual(out[-1]['done'], True)
+        self.assertEqual(out[-1]['passed'], 1)
+        self.assertNotEqual(out[-1]['result'], 0)
+        self.assertNotIn(2, [r.get('case') for r in out])
+
+    @unittest.skipUnless(os.geteuid() == 0, 'needs root to switch users')
+    def test_peer_uid(self):
+        self.start()
+        os.chmod(self.dir, 0o755)
+        os.chmod(self.path, 0o777)
+
+        def as_nobody():
+            os.setgid(65534)
+            os.setuid(65534)
+
+        code = ('import socket, sys; s = socket.socket(socket.AF_UNIX); '
+                's.settimeout(5); s.connect(sys.argv[1]); '
+                'print(repr(s.recv(100)))')
+        out = subprocess.check_output(['python3', '-c', code, self.path],
+                                      preexec_fn=as_nobody)
+        self.assertEqual(out.strip(), b"b''")
+
+
+if __name__ == '__main__':
+    unittest.main()
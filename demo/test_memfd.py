@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# compile_memfd编译到封印的memfd，exec_fd用fexecve运行它
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import lorun
+
+APLUSB = '''#include <stdio.h>
+int main() { int a, b; scanf("%d %d", &a, &b); printf("%d\\n", a + b); return 0; }
+'''
+COMPILE = {'timelimit': 10000, 'memorylimit': 1048576}
+RUN = {'args': ['main'], 'timelimit': 1000, 'memorylimit': 65536}
+
+
+@unittest.skipUnless(shutil.which('gcc'), 'gcc is required')
+class CompileMemfdTest(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def compile(self, source, **extra):
+        path = os.path.join(self.dir, 'main.c')
+        with open(path, 'w') as f:
+            f.write(source)
+        cfg = dict(COMPILE, args=['gcc', path, '-o', lorun.MEMFD], **extra)
+        return lorun.compile_memfd(cfg)
+
+    def test_compile_and_run(self):
+        fd, err = self.compile(APLUSB)
+        self.assertEqual(err, '')
+        try:
+            # 返回的描述符只读，内容被封印
+            self.assertRaises(OSError, os.write, fd, b'x')
+            rst = lorun.run(dict(RUN, exec_fd=fd), b'1 2\n', lorun.CAPTURE)
+            self.assertEqual(rst['result'], 0)
+            self.assertEqual(bytes(rst['output']).split(), [b'3'])
+        finally:
+            os.close(fd)
+
+    def test_compile_error(self):
+        fd, err = self.compile('int main( {')
+        self.assertIsNone(fd)
+        self.assertIn('error', err)
+
+    def test_exec_fd_rejected_in_compile(self):
+        self.assertRaises(Exception, self.compile, APLUSB, exec_fd=0)
+
+
+if __name__ == '__main__':
+    unittest.main()
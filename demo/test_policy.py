@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# 策略文件的解析、参数规则、文件规则和enosys
+
+import os
+import tempfile
+import unittest
+
+import lorun
+
+PYTHON = '/usr/bin/python3'
+
+PROFILES = '''
+[t-umask]
+include python3
+allow umask
+arg umask 0 mask 077
+
+[t-threads]
+include python3
+allow clone wait4 tgkill
+arg clone 0 mask 0x7e020000
+enosys clone3
+'''
+
+
+def load(text):
+    fd, path = tempfile.mkstemp(suffix='.policy')
+    try:
+        with os.fdopen(fd, 'w') as f:
+            f.write(text)
+        return lorun.load_policy(path)
+    finally:
+        os.unlink(path)
+
+
+def run_py(code, policy, **extra):
+    fout = os.open(os.devnull, os.O_WRONLY)
+    cfg = {'args': [PYTHON, '-I', '-S', '-c', code], 'fd_in': 0, 'fd_out': fout,
+           'timelimit': 5000, 'memorylimit': 1 << 21, 'trace': True,
+           'policy': policy}
+    cfg.update(extra)
+    try:
+        return lorun.run(cfg)
+    finally:
+        os.close(fout)
+
+
+class PolicyParseTest(unittest.TestCase):
+
+    def test_count(self):
+        self.assertEqual(load('[t-a]\nallow read\n\n[t-b]\ninclude t-a\n'), 2)
+
+    def test_errors(self):
+        bad = {
+            'unknown system call': '[t-e]\nallow nosuchcall\n',
+            'include must come first': '[t-e]\nfile /x ro\ninclude c\n',
+            'include of unknown profile': '[t-e]\ninclude nosuchprofile\n',
+            'bad argument rule': '[t-e]\narg clone 0 lt 1\n',
+            'argument index must be 0-5': '[t-e]\narg clone 6 eq 1\n',
+            'bad argument value': '[t-e]\narg clone 0 eq x\n',
+            'bad file flags': '[t-e]\nfile /x rw\n',
+            'unknown directive': '[t-e]\npermit read\n',
+            'directive outside of a profile': 'allow read\n',
+            'bad profile header': '[]\n',
+        }
+        for msg, text in bad.items():
+            with self.subTest(msg):
+                with self.assertRaises(Exception) as cm:
+                    load(text)
+                self.assertIn(msg, str(cm.exception))
+
+    def test_missing_file(self):
+        self.assertRaises(Exception, lorun.load_policy, '/nonexistent.policy')
+
+
+@unittest.skipUnless(os.path.exists(PYTHON), PYTHON + ' is required')
+class PolicyRunTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        load(PROFILES)
+
+    def test_allowed(self):
+        self.assertEqual(run_py('print(1)', 'python3')['result'], 0)
+
+    def test_arg_mask(self):
+        self.assertEqual(run_py('import os; os.umask(0o100)',
+                                't-umask')['result'], 0)
+        rst = run_py('import os; os.umask(0o22)', 't-umask')
+        self.assertEqual(rst['result'], 5)
+        self.assertEqual(rst['re_call'], 95)
+
+    def test_file_rule(self):
+        rst = run_py('open("/etc/passwd").read()', 'python3')
+        self.assertEqual(rst['result'], 5)
+        self.assertEqual(rst['re_file'], '/etc/passwd')
+
+    def test_clone3_enosys(self):
+        code = ('import threading; t = threading.Thread(target=len, '
+                'args=("",)); t.start(); t.join()')
+        rst = run_py(code, 't-threads', tree=True, syscall_stats=True)
+        self.assertEqual(rst['result'], 0)
+        # glibc先试clone3，得到ENOSYS后改用clone
+        self.assertIn(56, rst['syscalls'])
+
+
+if __name__ == '__main__':
+    unittest.main()
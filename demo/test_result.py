@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# run()和run_batch()返回的Result与以前的dict兼容：按键读写、in、to_dict()；
+# ResultArray的缓冲区布局
+
+import os
+import struct
+import unittest
+
+import lorun
+
+CFG = {'args': ['true'], 'timelimit': 1000, 'memorylimit': 65536}
+
+
+def batch_result():
+    fin = os.open(os.devnull, os.O_RDONLY)
+    fout = os.open(os.devnull, os.O_WRONLY)
+    try:
+        return lorun.run_batch(CFG, [(fin, fout)])[0]
+    finally:
+        os.close(fin)
+        os.close(fout)
+
+
+class ResultCompatTest(unittest.TestCase):
+
+    def results(self):
+        return [('run', lorun.run(CFG)), ('run_batch', batch_result())]
+
+    def test_read(self):
+        for name, rst in self.results():
+            with self.subTest(name):
+                self.assertEqual(rst['result'], 0)
+                self.assertEqual(rst['result'], rst.result)
+                self.assertIn('timeused', rst)
+                self.assertIn('memoryused', rst)
+                self.assertNotIn('re_file', rst)
+                self.assertRaises(KeyError, lambda: rst['re_file'])
+                self.assertIsNone(rst.get('re_file'))
+                self.assertEqual(sorted(rst), sorted(rst.keys()))
+
+    def test_to_dict(self):
+        for name, rst in self.results():
+            with self.subTest(name):
+                d = rst.to_dict()
+                self.assertIs(type(d), dict)
+                self.assertEqual(d, rst)
+                self.assertEqual(sorted(d), sorted(rst.keys()))
+                self.assertEqual(d['result'], rst['result'])
+                self.assertEqual(len(d), len(rst))
+
+    def test_assign(self):
+        for name, rst in self.results():
+            with self.subTest(name):
+                rst['result'] = 'Accepted'
+                rst['case'] = 3
+                self.assertEqual(rst['result'], 'Accepted')
+                self.assertIn('case', rst)
+                self.assertEqual(rst.result, 0)
+                d = rst.to_dict()
+                self.assertEqual(d['result'], 'Accepted')
+                self.assertEqual(d['case'], 3)
+                self.assertEqual(rst, d)
+                d['case'] = 4
+                self.assertEqual(rst['case'], 3)
+
+    def test_delete_and_update(self):
+        for name, rst in self.results():
+            with self.subTest(name):
+                del rst['timeused']
+                self.assertNotIn('timeused', rst)
+                self.assertRaises(KeyError, rst.__delitem__, 'timeused')
+                rst.update({'a': 1}, b=2)
+                self.assertEqual(rst.pop('a'), 1)
+                self.assertEqual(rst.setdefault('b', 5), 2)
+                self.assertEqual(rst.get('missing', 7), 7)
+                self.assertEqual(rst.timeused >= 0, True)
+
+
+class ResultArrayBufferTest(unittest.TestCase):
+
+    FIELDS = ('result', 'timeused', 'memoryused', 're_signum', 're_call',
+              're_file_flag', 'walltime', 'instructions')
+
+    def test_layout(self):
+        cfg = dict(CFG, args=['sh', '-c', 'kill -SEGV $$'],
+                   walltimelimit=1000)
+        fin = os.open(os.devnull, os.O_RDONLY)
+        fout = os.open(os.devnull, os.O_WRONLY)
+        try:
+            arr = lorun.run_batch(cfg, [(fin, fout)] * 3)
+        finally:
+            os.close(fin)
+            os.close(fout)
+
+        view = memoryview(arr)
+        self.assertTrue(view.readonly)
+        self.assertEqual(view.shape, (3,))
+        self.assertEqual(view.itemsize, struct.calcsize('7iq'))
+        self.assertEqual(view.nbytes, 3 * view.itemsize)
+        self.assertEqual(view.format, 'T{' + ''.join(
+            '%s:%s:' % ('q' if f == 'instructions' else 'i', f)
+            for f in self.FIELDS) + '}')
+        data = view.tobytes()
+        for i in range(3):
+            with self.subTest(i):
+                record = struct.unpack_from('7iq', data, i * view.itemsize)
+                self.assertEqual(record, tuple(getattr(arr[i], f)
+                                               for f in self.FIELDS))
+                self.assertEqual(record[3], 11)
+                self.assertGreaterEqual(record[6], 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
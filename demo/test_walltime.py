@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# -*- coding: utf8 -*-
+# walltime到第一次观察到程序结束为止，之后回收的延迟不计入
+
+import asyncio
+import time
+import unittest
+
+import lorun
+
+CFG = {'args': ['sleep', '0.1'], 'timelimit': 1000, 'memorylimit': 65536,
+       'walltimelimit': 400}
+
+
+class WalltimeTest(unittest.TestCase):
+
+    def test_run(self):
+        rst = lorun.run(CFG)
+        self.assertEqual(rst['result'], 0)
+        self.assertGreaterEqual(rst['walltime'], 100)
+        self.assertLess(rst['walltime'], 400)
+
+    def test_late_finish(self):
+        proc = lorun.spawn(CFG)
+        self.assertFalse(proc.poll())
+        time.sleep(0.3)
+        self.assertTrue(proc.poll())
+        time.sleep(0.4)
+        rst = proc.finish()
+        self.assertEqual(rst['result'], 0)
+        self.assertLess(rst['walltime'], 400)
+        self.assertTrue(proc.poll())
+
+    def test_async(self):
+        loop = asyncio.new_event_loop()
+        try:
+            rst = loop.run_until_complete(lorun.run_async(CFG))
+        finally:
+            loop.close()
+        self.assertEqual(rst['result'], 0)
+        self.assertGreaterEqual(rst['walltime'], 100)
+        self.assertLess(rst['walltime'], 400)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1 +1,16 @@
-from ._lorun_ext import run, check, compile, special
\ No newline at end of file
+import os
+import sys
+
+from ._lorun_ext import run, check, compile, special, load_policy, run_batch, prefetch
+from ._lorun_ext import compile_memfd, MEMFD
+from ._lorun_ext import run_plan, stress, run_piped
+from ._lorun_ext import RunConfig, Result, ResultArray
+from ._lorun_ext import spawn, spawn_compile, spawn_special, Process
+from ._lorun_ext import CAPTURE, Output
+from ._lorun_ext import Problem, Testset
+from .calibrate import calibrate
+
+if sys.version_info >= (3, 7):
+    from .aio import run_async, compile_async, special_async
+
+load_policy(os.path.join(os.path.dirname(__file__), 'profiles', 'default.policy'))
@@ -0,0 +1,75 @@
+"""asyncio helpers built on pidfd.
+
+The child is started with ``spawn()`` and its pidfd is registered with the
+event loop, so no thread is held while the submission runs. Trace mode (the
+tracer must stay on one thread) and kernels without pidfd fall back to
+``run_in_executor``.
+"""
+
+import asyncio
+import errno
+import functools
+
+from ._lorun_ext import (run, compile, special, spawn, spawn_compile,
+                         spawn_special, RunConfig)
+
+_pidfd_supported = True
+
+
+def _is_trace(cfg):
+    if isinstance(cfg, RunConfig):
+        return bool(cfg.trace)
+    return cfg.get('trace') is True
+
+
+async def _await(loop, proc):
+    fd = proc.fileno()
+    done = loop.create_future()
+
+    def exited():
+        # poll() records the exit time, so the delay before this coroutine
+        # resumes is not counted as walltime
+        if proc.poll() and not done.done():
+            done.set_result(None)
+
+    loop.add_reader(fd, exited)
+    try:
+        await done
+    except BaseException:
+        proc.kill()
+        raise
+    finally:
+        loop.remove_reader(fd)
+    return proc.finish()
+
+
+async def _start(starter, fallback, cfg, *args):
+    global _pidfd_supported
+    loop = asyncio.get_running_loop()
+    if _pidfd_supported and not _is_trace(cfg):
+        try:
+            proc = starter(cfg, *args)
+        except OSError as e:
+            # only a kernel without pidfd_open falls back for good; other
+            # errors (EMFILE, ENOMEM...) belong to this call
+            if e.errno != errno.ENOSYS:
+                raise
+            _pidfd_supported = False
+        else:
+            return await _await(loop, proc)
+    return await loop.run_in_executor(None, functools.partial(fallback, cfg, *args))
+
+
+async def run_async(cfg, *fds):
+    """Same as run(cfg[, fd_in[, fd_out]]), awaited on the event loop."""
+    return await _start(spawn, run, cfg, *fds)
+
+
+async def compile_async(cfg):
+    """Same as compile(cfg), awaited on the event loop."""
+    return await _start(spawn_compile, compile, cfg)
+
+
+async def special_async(cfg):
+    """Same as special(cfg), awaited on the event loop."""
+    return await _start(spawn_special, special, cfg)
@@ -0,0 +1,118 @@
+# -*- coding: utf-8 -*-
+"""时间限制校准
+
+calibrate(cfg, repeats, concurrency) 在给定并发下多次运行参考程序，
+统计time_used的分布并给出建议的时间限制。
+"""
+
+import math
+import os
+import tempfile
+import threading
+
+from ._lorun_ext import run
+
+AC = 0
+
+
+def _percentile(values, p):
+    """values已排序，最近秩法"""
+    k = max(int(math.ceil(p / 100.0 * len(values))) - 1, 0)
+    return values[k]
+
+
+def _reopen(fd):
+    """通过/proc重新打开fd，使并发的运行有各自的读取偏移"""
+    return os.open('/proc/self/fd/%d' % fd, os.O_RDONLY | os.O_CLOEXEC)
+
+
+def _fd_in(cfg, fd_in):
+    if fd_in is not None:
+        return fd_in
+    if isinstance(cfg, dict):
+        return cfg.get('fd_in', -1)
+    return -1
+
+
+def calibrate(cfg, repeats=30, concurrency=1, fd_in=None, factor=2.0,
+              round_to=100):
+    """运行cfg共repeats次，同时保持concurrency个运行。
+
+    cfg为dict或RunConfig，fd_in默认取cfg中的值，每次运行都重新打开；
+    输出写入每个worker各自的临时文件。cfg的timelimit应足够宽松，
+    超时的运行只计入verdicts，不计入分布。
+
+    返回的dict包含time_used(毫秒)的min/median/p99/max/mean/stddev，
+    非AC结果的计数verdicts，以及建议的timelimit：
+    p99乘以factor后向上取整到round_to毫秒。
+    """
+    if repeats < 1 or concurrency < 1:
+        raise ValueError('repeats and concurrency must be positive')
+
+    fd_in = _fd_in(cfg, fd_in)
+    samples, verdicts, errors = [], {}, []
+    lock = threading.Lock()
+    todo = [repeats]
+
+    def worker():
+        out = tempfile.TemporaryFile()
+        try:
+            while True:
+                with lock:
+                    if todo[0] == 0 or errors:
+                        return
+                    todo[0] -= 1
+                fin = _reopen(fd_in) if fd_in >= 0 else -1
+                try:
+                    out.seek(0)
+                    out.truncate()
+                    rst = run(cfg, fin, out.fileno())
+                finally:
+                    if fin >= 0:
+                        os.close(fin)
+                with lock:
+                    if rst['result'] == AC:
+                        samples.append(rst['timeused'])
+                    else:
+                        verdicts[rst['result']] = \
+                            verdicts.get(rst['result'], 0) + 1
+        except Exception as e:
+            with lock:
+                errors.append(e)
+        finally:
+            out.close()
+
+    threads = [threading.Thread(target=worker)
+               for _ in range(min(concurrency, repeats))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    if errors:
+        raise errors[0]
+
+    report = {
+        'repeats': repeats,
+        'concurrency': concurrency,
+        'samples': sorted(samples),
+        'verdicts': verdicts,
+    }
+    if not samples:
+        report['timelimit'] = None
+        return report
+
+    values = report['samples']
+    n = len(values)
+    mean = float(sum(values)) / n
+    report.update({
+        'min': values[0],
+        'median': (values[(n - 1) // 2] + values[n // 2]) / 2.0,
+        'p99': _percentile(values, 99),
+        'max': values[-1],
+        'mean': mean,
+        'stddev': math.sqrt(sum((v - mean) ** 2 for v in values) / n),
+    })
+    limit = report['p99'] * factor
+    report['timelimit'] = int(max(math.ceil(limit / float(round_to)), 1)
+                              * round_to)
+    return report
@@ -17,69 +17,168 @@
  */
 
 #include "access.h"
+#include "policy.h"
 #include <sys/syscall.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 
-/* 检查调用的库文件是否被允许 */
-int fileAccess(PyObject *files, const char *file, long flags) {
-    PyObject *perm_obj;
-    long perm;
+#define PATH_IOV_MAX (PATH_MAX_LIMIT / 4096 + 2)
 
-    if ((perm_obj = PyDict_GetItemString(files, file)) == NULL) {
-        return 0;
-    }
-    //printf("%s:%d\n",file,flags);
-    #ifdef IS_PY3
-    perm = PyLong_AsLong(perm_obj);
-    #else
-    perm = PyInt_AsLong(perm_obj);
-    #endif
-    if (perm == flags)
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#endif
+#ifndef __X32_SYSCALL_BIT
+#define __X32_SYSCALL_BIT 0x40000000
+#endif
+
+/* struct ptrace_syscall_info的开头，旧的头文件中没有这个结构 */
+struct SyscallInfoHead {
+    unsigned char op;
+    unsigned char pad[3];
+    unsigned int arch;
+    unsigned long long pc, sp;
+};
+
+/* 调用是否不是按本机ABI进入的。64位进程执行int 0x80时cs仍是64位的，
+ * 只能由PTRACE_GET_SYSCALL_INFO的arch判断；5.3之前的内核没有它，
+ * 退回到检查进入内核的指令，无法判断时按非本机处理 */
+static int foreignCall(int pid, struct user_regs_struct *regs) {
+    struct SyscallInfoHead info;
+    long word;
+
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0)
+        return info.arch != AUDIT_ARCH_NATIVE;
+#if __WORDSIZE == 64
+    /* 停止时pc指向进入内核的指令之后，syscall是0f 05，int 0x80是cd 80 */
+    errno = 0;
+    word = ptrace(PTRACE_PEEKTEXT, pid, REG_PC(regs) - 2, NULL);
+    if (errno)
         return 1;
+    return (word & 0xffff) != 0x050f;
+#else
+    (void) word;
+    return 0;
+#endif
+}
+
+/* 按页拆分远程iovec，这样遇到未映射的页时仍能得到前面的部分 */
+static ssize_t readByVm(int pid, unsigned long addr, char *buf, size_t len) {
+    struct iovec local, remote[PATH_IOV_MAX];
+    unsigned long page = sysconf(_SC_PAGESIZE);
+    size_t done = 0, chunk;
+    int n = 0;
+
+    while (done < len && n < PATH_IOV_MAX) {
+        chunk = page - ((addr + done) & (page - 1));
+        if (chunk > len - done)
+            chunk = len - done;
+        remote[n].iov_base = (void *) (addr + done);
+        remote[n].iov_len = chunk;
+        done += chunk;
+        n++;
+    }
+    local.iov_base = buf;
+    local.iov_len = done;
+
+    return process_vm_readv(pid, &local, 1, remote, n, 0);
+}
+
+/* 内核不支持process_vm_readv时，退回到逐字PTRACE_PEEKDATA */
+static ssize_t readByPeek(int pid, unsigned long addr, char *buf, size_t len) {
+    size_t done = 0;
+    long word;
+
+    while (done < len) {
+        errno = 0;
+        word = ptrace(PTRACE_PEEKDATA, pid, addr + done, NULL);
+        if (errno)
+            return done ? (ssize_t) done : -1;
+        if (len - done < sizeof(long)) {
+            memcpy(buf + done, &word, len - done);
+            return len;
+        }
+        memcpy(buf + done, &word, sizeof(long));
+        if (memchr(&word, 0, sizeof(long)))
+            return done + sizeof(long);
+        done += sizeof(long);
+    }
+
+    return done;
+}
+
+/* 读取被跟踪进程中以0结尾的路径，超过path_max或无法读取时返回-1 */
+static int readPath(const struct Runobj *runobj, struct Runctx *ctx, int pid,
+        unsigned long addr) {
+    ssize_t r;
+
+    ctx->path[0] = 0;
+    r = readByVm(pid, addr, ctx->path, runobj->path_max);
+    if (r == -1 && (errno == ENOSYS || errno == EPERM))
+        r = readByPeek(pid, addr, ctx->path, runobj->path_max);
+    if (r <= 0)
+        return -1;
+
+    if (memchr(ctx->path, 0, r) == NULL) {
+        ctx->path[r] = 0;
+        return -1;
+    }
 
     return 0;
 }
 
-static long file_temp[100];
 /* 检查系统调用是否被允许 */
-int checkAccess(struct Runobj *runobj, int pid, struct user_regs_struct *regs) {
+int checkAccess(const struct Runobj *runobj, struct Runctx *ctx, int pid,
+        struct user_regs_struct *regs) {
+    const struct Policy *policy = runobj->policy;
+    long call = REG_SYS_CALL(regs);
+    long args[6];
+
+    /* 越界的调用号、x32调用和非本机ABI(如int 0x80)的调用一律拒绝 */
+    if (call < 0 || call >= CALLS_MAX || (call & __X32_SYSCALL_BIT)
+            || foreignCall(pid, regs))
+        return ACCESS_CALL_ERR;
+    /* 跳过调用：调用号改为-1，内核不执行它，返回值保持-ENOSYS */
+    if (policy->table[call] & CALL_ENOSYS) {
+        REG_SYS_CALL(regs) = -1;
+        REG_RET(regs) = -ENOSYS;
+        if (ptrace(PTRACE_SETREGS, pid, NULL, regs) == -1) {
+            REG_SYS_CALL(regs) = call;
+            return ACCESS_CALL_ERR;
+        }
+        return ACCESS_ENOSYS;
+    }
     /* 检查系统调用号 */
-    if (!runobj->inttable[REG_SYS_CALL(regs)])
+    if (!(policy->table[call] & CALL_ALLOW))
         return ACCESS_CALL_ERR;
 
-    switch (REG_SYS_CALL(regs)) {
-        case SYS_open: {
-            int i, j;
-            /* 复制ptrace的数据到file_temp */
-            for (i = 0; i < 100; i++) {
-                const char* test;
-                long t = ptrace(PTRACE_PEEKDATA, pid,
-                    REG_ARG_1(regs) + i * sizeof(long), NULL);
-                file_temp[i] = t;
-                test = (const char*) &file_temp[i];
-                for (j = 0; j < sizeof(long); j++) {
-                    if (!test[j]) {
-                        goto l_cont;
-                    }
-                }
-            }
-            l_cont: file_temp[99] = 0;
-            /* 检查调用文件 */
-            if (fileAccess(runobj->files, (const char*)file_temp,
-                    REG_ARG_2(regs))) {
-                return ACCESS_OK;
-            }
+    args[0] = REG_ARG_1(regs);
+    args[1] = REG_ARG_2(regs);
+    args[2] = REG_ARG_3(regs);
+    args[3] = REG_ARG_4(regs);
+    args[4] = REG_ARG_5(regs);
+    args[5] = REG_ARG_6(regs);
+
+    if ((policy->table[call] & CALL_ARGS)
+            && !policyCheckArgs(policy, call, args))
+        return ACCESS_CALL_ERR;
 
+    if (policy->table[call] & CALL_PATH) {
+        /* openat的路径和flags在第2、3个参数 */
+        int at = (call == SYS_openat);
+        ctx->path_flag = args[1 + at];
+        /* 复制被跟踪进程的路径参数 */
+        if (readPath(runobj, ctx, pid, args[at]))
             return ACCESS_FILE_ERR;
-        }
+        /* 检查调用文件 */
+        if (policyCheckFile(policy, ctx->path, ctx->path_flag))
+            return ACCESS_OK;
+
+        return ACCESS_FILE_ERR;
     }
 
     return ACCESS_OK;
 }
-
-const char* lastFileAccess(void) {
-    file_temp[99] = 0;
-    return (const char*) file_temp;
-}
@@ -19,24 +19,40 @@
 #ifndef __LO_ACCESS_HEADER
 #define __LO_ACCESS_HEADER
 
-#include "lorun.h"
+#include "core.h"
 #include <sys/user.h>
+#include <linux/audit.h>
 
 #define ACCESS_CALL_ERR 1
 #define ACCESS_FILE_ERR 2
+#define ACCESS_ENOSYS 3    //调用已被改为-1跳过，返回ENOSYS
 #define ACCESS_OK 0
 
 #if __WORDSIZE == 64
     #define REG_SYS_CALL(x) ((x)->orig_rax)
     #define REG_ARG_1(x) ((x)->rdi)
     #define REG_ARG_2(x) ((x)->rsi)
+    #define REG_ARG_3(x) ((x)->rdx)
+    #define REG_ARG_4(x) ((x)->r10)
+    #define REG_ARG_5(x) ((x)->r8)
+    #define REG_ARG_6(x) ((x)->r9)
+    #define REG_PC(x) ((x)->rip)
+    #define REG_RET(x) ((x)->rax)
+    #define AUDIT_ARCH_NATIVE AUDIT_ARCH_X86_64
 #else
     #define REG_SYS_CALL(x) ((x)->orig_eax)
     #define REG_ARG_1(x) ((x)->ebx)
     #define REG_ARG_2(x) ((x)->ecx)
+    #define REG_ARG_3(x) ((x)->edx)
+    #define REG_ARG_4(x) ((x)->esi)
+    #define REG_ARG_5(x) ((x)->edi)
+    #define REG_ARG_6(x) ((x)->ebp)
+    #define REG_PC(x) ((x)->eip)
+    #define REG_RET(x) ((x)->eax)
+    #define AUDIT_ARCH_NATIVE AUDIT_ARCH_I386
 #endif
 
-int checkAccess(struct Runobj *runobj, int pid, struct user_regs_struct *regs);
-const char* lastFileAccess(void);
+int checkAccess(const struct Runobj *runobj, struct Runctx *ctx, int pid,
+        struct user_regs_struct *regs);
 
 #endif
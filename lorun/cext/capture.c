@@ -0,0 +1,181 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include "pack.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* 把输入写入密封的memfd，子进程不能修改，也不需要临时文件 */
+static int inputMemfd(PyObject *obj)
+{
+    Py_buffer view;
+    int fd;
+
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE))
+        return -1;
+    if ((fd = sealedMemfd((const char *) view.buf, view.len)) == -1)
+        PyErr_SetFromErrno(PyExc_OSError);
+    PyBuffer_Release(&view);
+    return fd;
+}
+
+/* in_obj/out_obj为run(cfg, fd_in, fd_out)中的可选参数，NULL表示使用cfg中的值。
+ * in_obj可以是fd或者bytes等缓冲区；fd_out为CAPTURE_FD时捕获标准输出 */
+int setupIO(struct Runobj *runobj, struct RunIO *io, PyObject *in_obj,
+        PyObject *out_obj)
+{
+    io->in_fd = io->out_fd = -1;
+
+    if (in_obj && PyObject_CheckBuffer(in_obj)) {
+        if ((io->in_fd = inputMemfd(in_obj)) == -1)
+            return -1;
+        runobj->fd_in = io->in_fd;
+    }
+    else if (in_obj) {
+        runobj->fd_in = PyLong_AsLong(in_obj);
+        if (runobj->fd_in == -1 && PyErr_Occurred())
+            return -1;
+    }
+
+    if (out_obj) {
+        runobj->fd_out = PyLong_AsLong(out_obj);
+        if (runobj->fd_out == -1 && PyErr_Occurred())
+            return -1;
+    }
+    if (runobj->fd_out == CAPTURE_FD) {
+        if ((io->out_fd = memfd_create("lorun-stdout", MFD_CLOEXEC)) == -1) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            closeIO(io);
+            return -1;
+        }
+        runobj->fd_out = io->out_fd;
+        /* 输出保存在内存中，超过MAX_OUTPUT时子进程收到SIGXFSZ */
+        runobj->output_limit = MAX_OUTPUT;
+    }
+
+    return 0;
+}
+
+/* 映射捕获的输出并返回其memoryview，memfd的所有权转移给Output对象 */
+PyObject *takeOutput(struct RunIO *io)
+{
+    OutputObject *out;
+    PyObject *view;
+    off_t size;
+    void *p = NULL;
+
+    if ((size = lseek(io->out_fd, 0, SEEK_END)) == -1)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    if (size && (p = mmap(NULL, size, PROT_READ, MAP_SHARED, io->out_fd, 0))
+            == MAP_FAILED)
+        return PyErr_SetFromErrno(PyExc_OSError);
+
+    if ((out = PyObject_New(OutputObject, &OutputType)) == NULL) {
+        if (p)
+            munmap(p, size);
+        return NULL;
+    }
+    out->data = (char *) p;
+    out->len = size;
+    out->fd = io->out_fd;
+    io->out_fd = -1;
+
+    view = PyMemoryView_FromObject((PyObject *) out);
+    Py_DECREF(out);
+    return view;
+}
+
+void closeIO(struct RunIO *io)
+{
+    if (io->in_fd != -1)
+        close(io->in_fd);
+    if (io->out_fd != -1)
+        close(io->out_fd);
+    io->in_fd = io->out_fd = -1;
+}
+
+static int Output_getbuffer(OutputObject *self, Py_buffer *view, int flags)
+{
+    static char empty[1];
+
+    return PyBuffer_FillInfo(view, (PyObject *) self,
+            self->data ? self->data : empty, self->len, 1, flags);
+}
+
+static PyObject *Output_fileno(OutputObject *self, PyObject *unused)
+{
+    return PyLong_FromLong(self->fd);
+}
+
+static void Output_dealloc(OutputObject *self)
+{
+    if (self->data)
+        munmap(self->data, self->len);
+    close(self->fd);
+    PyObject_Del(self);
+}
+
+static PyMethodDef Output_methods[] = {
+    {"fileno", (PyCFunction) Output_fileno, METH_NOARGS,
+        "memfd holding the output"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyBufferProcs Output_as_buffer = {
+#ifndef IS_PY3
+    0, 0, 0, 0,
+#endif
+    (getbufferproc) Output_getbuffer,
+    0,
+};
+
+PyTypeObject OutputType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.Output",                /* tp_name */
+    sizeof(OutputObject),               /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) Output_dealloc,        /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    &Output_as_buffer,                  /* tp_as_buffer */
+#ifdef IS_PY3
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+    "stdout captured by run(cfg, fd_in, CAPTURE), mapped read-only",
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    Output_methods,                     /* tp_methods */
+};
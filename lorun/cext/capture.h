@@ -0,0 +1,48 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_CAPTURE_HEADER
+#define __LO_CAPTURE_HEADER
+
+#include "lorun.h"
+
+/* fd_out为CAPTURE_FD时标准输出写入memfd，结果中返回output */
+#define CAPTURE_FD -2
+
+/* 被捕获的输出，只读映射memfd并通过缓冲区协议导出 */
+typedef struct {
+    PyObject_HEAD
+    char *data;         //空输出时为NULL
+    Py_ssize_t len;
+    int fd;
+} OutputObject;
+
+/* run/spawn为一次运行创建的memfd，没有时为-1 */
+struct RunIO {
+    int in_fd;
+    int out_fd;
+};
+
+extern PyTypeObject OutputType;
+
+int setupIO(struct Runobj *runobj, struct RunIO *io, PyObject *in_obj,
+        PyObject *out_obj);
+PyObject *takeOutput(struct RunIO *io);
+void closeIO(struct RunIO *io);
+
+#endif
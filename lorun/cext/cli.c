@@ -0,0 +1,131 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lorun命令行驱动，不依赖Python。从标准输入读取JSON lines格式的任务，
+ * 每个任务向标准输出写一行JSON结果:
+ *
+ *   lorun [-j workers] [-p policy_file]... < jobs.jsonl > results.jsonl
+ *
+ *   {"id": 1, "args": ["./m"], "stdin": "1.in", "stdout": "1.out",
+ *    "timelimit": 1000, "memorylimit": 65536, "trace": true, "policy": "c"}
+ *   {"id": 7, "args": ["./m"], "stdin": "1.in", "answer": "1.ans"}
+ *   {"id": 2, "type": "check", "answer": "1.ans", "output": "1.out"}
+ *   {"id": 5, "testset": "p.lopack", "case": 0, "args": ["./m"], ...}
+ *   {"id": 6, "type": "check", "testset": "p.lopack", "case": 0,
+ *    "output": "1.out"}
+ *   {"id": 3, "type": "compile", "args": ["gcc", "m.c", "-o", "m"], ...}
+ *   {"id": 4, "type": "special", "args": ["./spj"], ...}
+ *
+ * 多个worker时结果按完成顺序输出，用id对应任务。
+ */
+
+#include "job.h"
+#include "policy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define WORKERS_MAX 256
+
+static pthread_mutex_t in_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct JobOut out = {STDOUT_FILENO, 0, 0, PTHREAD_MUTEX_INITIALIZER, -1};
+
+/* 每个worker依次读取一行任务并执行 */
+static void *worker(void *unused) {
+    struct JValue job;
+    struct Reply reply;
+    char *line = NULL;
+    const char *p;
+    size_t cap = 0;
+    ssize_t len;
+
+    while (1) {
+        pthread_mutex_lock(&in_lock);
+        len = getline(&line, &cap, stdin);
+        pthread_mutex_unlock(&in_lock);
+        if (len == -1)
+            break;
+
+        p = line;
+        skipSpace(&p);
+        if (*p == 0)
+            continue;
+        memset(&job, 0, sizeof(job));
+        if (jparse(&p, &job) || job.type != J_OBJ) {
+            memset(&reply, 0, sizeof(reply));
+            reply.error = "bad json job";
+            writeReply(&out, &reply);
+        }
+        else
+            runJob(&job, &out, NULL, NULL);
+        jfree(&job);
+    }
+
+    free(line);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-j workers] [-p policy_file]... "
+            "< jobs.jsonl\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[WORKERS_MAX];
+    char err[256];
+    int opt, i, workers = 1;
+
+    while ((opt = getopt(argc, argv, "j:p:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                workers = atoi(optarg);
+                if (workers < 1 || workers > WORKERS_MAX)
+                    usage(argv[0]);
+                break;
+            case 'p':
+                if (loadPolicies(optarg, err, sizeof(err)) == -1) {
+                    fprintf(stderr, "%s\n", err);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    if (workers == 1) {
+        worker(NULL);
+        return 0;
+    }
+    for (i = 0; i < workers; i++)
+        if (pthread_create(&threads[i], NULL, worker, NULL)) {
+            fprintf(stderr, "pthread_create failure\n");
+            workers = i;
+            break;
+        }
+    for (i = 0; i < workers; i++)
+        pthread_join(threads[i], NULL);
+
+    return 0;
+}
@@ -3,83 +3,203 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/user.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include "limit.h"
+#include "phase.h"
 
-char * compileit(struct Runobj *comobj)
+/* 启动编译，stderr写入memfd，不等待编译结束。失败时设置ctx->err */
+int spawnCompile(struct Runobj *comobj, struct Runctx *ctx, pid_t *pid_out,
+        int *out_fd)
 {
     pid_t pid;
-    int fd_err[2];
-    char * errbuffer;
-    errbuffer = (char * ) malloc (sizeof(char) * 1010);
+    int fd, null_fd;
 
-#define RAISE_EXITC(err) {\
-            strcpy(errbuffer, err);\
-            return errbuffer;\
-        }
+    /* exec_fd只用于运行，编译时不会把调用者的fd留给编译器 */
+    if (comobj->exec_fd > 0) {
+        ctx->err = "compile: exec_fd is not allowed";
+        return -1;
+    }
 
-    if (pipe(fd_err) < 0)
-        RAISE_EXITC("compile: pip(fd_err) failure");
+    /* 用memfd而不是管道保存错误信息，输出再多也不会阻塞编译器 */
+    if ((fd = memfd_create("lorun-compile", MFD_CLOEXEC)) == -1) {
+        ctx->err = "compile: memfd_create failure";
+        return -1;
+    }
+    /* 编译器不能读到调用者的标准输入 */
+    if ((null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1) {
+        close(fd);
+        ctx->err = "compile: open /dev/null failure";
+        return -1;
+    }
 
+    ctx->errbuf[0] = 0;
     pid = vfork();
     if (pid < 0) {
-        close(fd_err[0]);
-        close(fd_err[1]);
-        RAISE_EXITC("compile : vfork failure");
+        close(fd);
+        close(null_fd);
+        ctx->err = "compile : vfork failure";
+        return -1;
     }
 
     if (pid == 0) {
-        close(fd_err[0]);
-        /* 仅重定向error流 */
-        if (dup2(fd_err[1], STDERR_FILENO) == -1)
-            RAISE_EXITC("dup2 stderr failure!")
+        MARK_PHASE(ctx->phases, PHASE_FORKED, forked);
+/* vfork的子进程与父进程共享内存，直接把错误写入ctx */
+#define RAISE_CHILD(err) {\
+            strncpy(ctx->errbuf, err, RUN_ERR_MAX - 1);\
+            _exit(127);\
+        }
+        /* stdout和stderr都写入memfd，stdin为/dev/null */
+        if (dup2(fd, STDERR_FILENO) == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            RAISE_CHILD("dup2 stderr failure!")
+        if (dup2(null_fd, STDIN_FILENO) == -1)
+            RAISE_CHILD("dup2 stdin failure!")
+        /* 输出的memfd要留给编译器通过/proc/self/fd打开 */
+        if (comobj->compile_fd > 0
+                && fcntl(comobj->compile_fd, F_SETFD, 0) == -1)
+            RAISE_CHILD("fcntl compile_fd failure")
         /* 为编译过程设置限制 */
-        if (setResLimit(comobj) == -1)
-            RAISE_EXITC(last_limit_err)
+        if (setResLimit(comobj, ctx) == -1)
+            RAISE_CHILD(ctx->err)
         /* 修改运行用户(为确保安全，请务必提供此参数) */
         if (comobj->runner != -1)
-            if (setuid(comobj->runner))
-                RAISE_EXITC("setuid failure")
+            if (syscall(SYS_setuid, comobj->runner))
+                RAISE_CHILD("setuid failure")
 
         /* 开始编译 */
+        MARK_PHASE(ctx->phases, PHASE_EXEC, exec);
         execvp(comobj->args[0], (char * const *) comobj->args);
 
-        RAISE_EXITC("execvp failure")
+        RAISE_CHILD("execvp failure")
     }
-    else {
-        close(fd_err[1]);
-
-        int r;
-        int status;
-        struct rusage ru;
-
-        /* 等待编译结束 */
-        if (wait4(pid, &status, 0, &ru) == -1)
-            RAISE_EXITC("wait4 failure")
-
-        /* 判断是否发生异常 */
-        if (status || WIFSIGNALED(status)) {
-            switch (WTERMSIG(status)) {
-                /* 若编译期间占用资源超出限制 */
-                case SIGSEGV:
-                case SIGALRM:
-                case SIGXCPU:
-                    strcpy(errbuffer, "Compile-time error\n");
-                    break;
-                default:
-                    /* 读取编译错误的前一千个字符 */
-                    r = read(fd_err[0], errbuffer, 1000);
-                    errbuffer[r] = '\0';
-                    break;
-            }
-            close(fd_err[0]);
-            return errbuffer;
+
+    MARK_PHASE(ctx->phases, PHASE_SPAWNED, spawned);
+    close(null_fd);
+    if (ctx->errbuf[0]) {
+        waitpid(pid, NULL, 0);
+        close(fd);
+        ctx->err = ctx->errbuf;
+        return -1;
+    }
+
+    *pid_out = pid;
+    *out_fd = fd;
+    return 0;
+}
+
+/* 等待编译结束并关闭out_fd，编译成功返回NULL，否则返回错误信息 */
+char * finishCompile(struct Runctx *ctx, pid_t pid, int out_fd)
+{
+    int status;
+    ssize_t r;
+    struct rusage ru;
+    char * errbuffer;
+    errbuffer = (char * ) malloc (sizeof(char) * 1010);
+
+    /* 等待编译结束 */
+    if (wait4(pid, &status, 0, &ru) == -1) {
+        close(out_fd);
+        strcpy(errbuffer, "wait4 failure");
+        return errbuffer;
+    }
+    MARK_PHASE(ctx->phases, PHASE_EXITED, exited);
+
+    /* 判断是否发生异常 */
+    if (status || WIFSIGNALED(status)) {
+        switch (WTERMSIG(status)) {
+            /* 若编译期间占用资源超出限制 */
+            case SIGSEGV:
+            case SIGALRM:
+            case SIGXCPU:
+            case SIGPROF:
+                strcpy(errbuffer, "Compile-time error\n");
+                break;
+            default:
+                /* 读取编译错误的前一千个字符 */
+                r = pread(out_fd, errbuffer, 1000, 0);
+                errbuffer[r > 0 ? r : 0] = '\0';
+                break;
         }
-        else {
-            close(fd_err[0]);
-            return NULL;
+    }
+    else {
+        free(errbuffer);
+        errbuffer = NULL;
+    }
+
+    close(out_fd);
+    MARK_PHASE(ctx->phases, PHASE_COLLECTED, collected);
+    return errbuffer;
+}
+
+static char * compileError(const char *msg)
+{
+    char * errbuffer;
+
+    errbuffer = (char * ) malloc (sizeof(char) * 1010);
+    strcpy(errbuffer, msg);
+    return errbuffer;
+}
+
+/* ctx由调用者用initRunctx初始化 */
+char * compileit(struct Runobj *comobj, struct Runctx *ctx)
+{
+    pid_t pid;
+    int out_fd;
+
+    if (spawnCompile(comobj, ctx, &pid, &out_fd))
+        return compileError(ctx->err);
+
+    return finishCompile(ctx, pid, out_fd);
+}
+
+/* 编译到memfd：args中等于COMPILE_MEMFD的参数换成/proc/self/fd/N。
+ * 成功时封印memfd，*exe_fd为它的只读fd(由调用者关闭)，返回NULL；
+ * 失败时*exe_fd为-1，与compileit一样返回错误信息 */
+char * compileMemfd(struct Runobj *comobj, struct Runctx *ctx, int *exe_fd)
+{
+    struct Runobj memobj = *comobj;
+    char path[32], **argv, * errbuffer;
+    int i, n, fd, found = 0;
+
+    *exe_fd = -1;
+    for (n = 0; comobj->args[n]; n++)
+        ;
+    if ((argv = (char **) malloc((n + 1) * sizeof(char *))) == NULL)
+        return compileError("compile: malloc failure");
+    if ((fd = memfd_create("lorun-exe", MFD_CLOEXEC | MFD_ALLOW_SEALING))
+            == -1) {
+        free(argv);
+        return compileError("compile: memfd_create failure");
+    }
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    for (i = 0; i <= n; i++) {
+        argv[i] = comobj->args[i];
+        if (i < n && !strcmp(argv[i], COMPILE_MEMFD)) {
+            argv[i] = path;
+            found = 1;
         }
     }
+    if (!found) {
+        free(argv);
+        close(fd);
+        return compileError("compile: args has no " COMPILE_MEMFD);
+    }
+
+    memobj.args = argv;
+    memobj.compile_fd = fd;
+    errbuffer = compileit(&memobj, ctx);
+    free(argv);
+
+    /* 封印后再只读打开，不留下可写的fd，旧内核exec可写的文件会ETXTBSY */
+    if (errbuffer == NULL && (fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL
+            | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) == -1
+            || (*exe_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1))
+        errbuffer = compileError("compile: seal memfd failure");
+    close(fd);
+    return errbuffer;
 }
@@ -1,8 +1,16 @@
 #ifndef __COMPILE_HEADER
 #define __COMPILE_HEADER
 
-#include "lorun.h"
+#include "core.h"
 
-char * compileit(struct Runobj *runobj);
+int spawnCompile(struct Runobj *comobj, struct Runctx *ctx, pid_t *pid_out,
+        int *out_fd);
+char * finishCompile(struct Runctx *ctx, pid_t pid, int out_fd);
+char * compileit(struct Runobj *runobj, struct Runctx *ctx);
+
+/* compileMemfd的args中用它表示输出文件 */
+#define COMPILE_MEMFD "@memfd"
+
+char * compileMemfd(struct Runobj *comobj, struct Runctx *ctx, int *exe_fd);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,256 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "convert.h"
+#include "policy.h"
+#include <structmember.h>
+
+/* 将Python传递的参数解析 */
+int initRun(struct Runobj *runobj, PyObject *config)
+{
+    PyObject *args_obj, *trace_obj, *time_obj, *memory_obj;
+    PyObject *calls_obj, *runner_obj, *fd_obj, *path_obj, *policy_obj;
+    PyObject *files_obj, *insn_obj, *wall_obj, *sample_obj;
+
+    if (!PyDict_Check(config))
+        RAISE1("argument must be a dict");
+
+    if ((args_obj = PyDict_GetItemString(config, "args")) == NULL)
+        RAISE1("must supply args");
+
+    if ((runobj->args = genRunArgs(args_obj)) == NULL)
+        return -1;
+
+    if ((fd_obj = PyDict_GetItemString(config, "fd_in")) == NULL)
+        runobj->fd_in = -1;
+    else
+        runobj->fd_in = PyLong_AsLong(fd_obj);
+    if ((fd_obj = PyDict_GetItemString(config, "fd_out")) == NULL)
+        runobj->fd_out = -1;
+    else
+        runobj->fd_out = PyLong_AsLong(fd_obj);
+    if ((fd_obj = PyDict_GetItemString(config, "fd_err")) == NULL)
+        runobj->fd_err = -1;
+    else
+        runobj->fd_err = PyLong_AsLong(fd_obj);
+
+    if ((time_obj = PyDict_GetItemString(config, "timelimit")) == NULL)
+        RAISE1("must supply timelimit");
+    runobj->time_limit = PyLong_AsLong(time_obj);
+
+    if ((memory_obj = PyDict_GetItemString(config, "memorylimit")) == NULL)
+        RAISE1("must supply memorylimit");
+    runobj->memory_limit = PyLong_AsLong(memory_obj);
+
+    if ((runner_obj = PyDict_GetItemString(config, "runner")) == NULL)
+        runobj->runner = -1;
+    else
+        runobj->runner = PyLong_AsLong(runner_obj);
+
+    /* compile_memfd得到的程序，args[0]只作为argv[0] */
+    if ((fd_obj = PyDict_GetItemString(config, "exec_fd")) != NULL) {
+        runobj->exec_fd = PyLong_AsLong(fd_obj);
+        if (runobj->exec_fd <= 0)
+            RAISE1("exec_fd must be a positive fd.");
+    }
+
+    runobj->phases = PyDict_GetItemString(config, "phases") == Py_True;
+    runobj->tree = PyDict_GetItemString(config, "tree") == Py_True;
+    if ((sample_obj = PyDict_GetItemString(config, "sample")) != NULL) {
+        runobj->sample = PyLong_AsLong(sample_obj);
+        if (runobj->sample <= 0)
+            RAISE1("sample must be a positive interval in ms.");
+    }
+    if ((wall_obj = PyDict_GetItemString(config, "walltimelimit")) != NULL) {
+        runobj->wall_limit = PyLong_AsLong(wall_obj);
+        if (runobj->wall_limit <= 0)
+            RAISE1("walltimelimit must be positive.");
+    }
+
+    /* instructionlimit隐含instructions */
+    if ((insn_obj = PyDict_GetItemString(config, "instructionlimit")) != NULL) {
+        runobj->insn_limit = PyLong_AsLongLong(insn_obj);
+        if (runobj->insn_limit == -1 && PyErr_Occurred())
+            return -1;
+        if (runobj->insn_limit <= 0)
+            RAISE1("instructionlimit must be positive.");
+        runobj->instructions = 1;
+    }
+    else
+        runobj->instructions =
+            PyDict_GetItemString(config, "instructions") == Py_True;
+
+    if ((trace_obj = PyDict_GetItemString(config, "trace")) != NULL) {
+        if (trace_obj == Py_True) {
+            runobj->trace = 1;
+            if ((policy_obj = PyDict_GetItemString(config, "policy")) != NULL) {
+                //trace mode: use a policy loaded by load_policy.
+                const char *name;
+                #ifdef IS_PY3
+                name = PyUnicode_AsUTF8(policy_obj);
+                #else
+                name = PyString_AsString(policy_obj);
+                #endif
+                if (name == NULL)
+                    return -1;
+                if ((runobj->policy = findPolicy(name)) == NULL)
+                    RAISE1("unknown policy.");
+            }
+            else {
+                //trace mode: supply calls and files to access.
+                if ((calls_obj = PyDict_GetItemString(config, "calls")) == NULL)
+                    RAISE1("trace == True, so you must specify calls or policy.");
+                if (!PyList_Check(calls_obj))
+                    RAISE1("calls must be a list.");
+                if ((files_obj = PyDict_GetItemString(config, "files")) == NULL)
+                    RAISE1("trace == True, so you must specify files.");
+                if (!PyDict_Check(files_obj))
+                    RAISE1("files must be a dcit.");
+
+                if ((runobj->policy = newPolicy(NULL)) == NULL)
+                    RAISE1("new policy failure");
+                if (initCalls(calls_obj, runobj->policy->table))
+                    return -1;
+                if (initFiles(files_obj, runobj->policy))
+                    return -1;
+            }
+
+            if ((path_obj = PyDict_GetItemString(config, "path_max")) == NULL)
+                runobj->path_max = PATH_MAX_DEFAULT;
+            else
+                runobj->path_max = PyLong_AsLong(path_obj);
+            if (runobj->path_max <= 0 || runobj->path_max > PATH_MAX_LIMIT)
+                RAISE1("path_max out of range.");
+
+            runobj->syscall_stats =
+                PyDict_GetItemString(config, "syscall_stats") == Py_True;
+        }
+        else
+            runobj->trace = 0;
+    }
+    else
+        runobj->trace = 0;
+
+    return 0;
+}
+
+/* 释放initRun分配的资源 */
+void freeRun(struct Runobj *runobj)
+{
+    freeRunArgs(runobj->args);
+    runobj->args = NULL;
+    releasePolicy(runobj->policy);
+    runobj->policy = NULL;
+}
+
+/* 取得一次运行的配置：RunConfig直接按值复制，不需要释放；
+ * dict则临时解析，*owned为1，用完后需要freeRun */
+int loadRunobj(PyObject *config, struct Runobj *runobj, int *owned)
+{
+    if (PyObject_TypeCheck(config, &RunConfigType)) {
+        *runobj = ((RunConfigObject *) config)->runobj;
+        *owned = 0;
+        return 0;
+    }
+
+    memset(runobj, 0, sizeof(struct Runobj));
+    *owned = 1;
+    return initRun(runobj, config);
+}
+
+/* 只能初始化一次：run等在释放GIL后按值复制runobj，再次初始化会释放
+ * 其他线程正在使用的args和policy */
+static int RunConfig_init(RunConfigObject *self, PyObject *args,
+        PyObject *kwds)
+{
+    PyObject *config;
+
+    if (!PyArg_ParseTuple(args, "O", &config))
+        return -1;
+    if (self->runobj.args)
+        RAISE1("RunConfig is already initialized");
+
+    memset(&self->runobj, 0, sizeof(struct Runobj));
+    if (initRun(&self->runobj, config)) {
+        freeRun(&self->runobj);
+        return -1;
+    }
+    return 0;
+}
+
+static void RunConfig_dealloc(RunConfigObject *self)
+{
+    freeRun(&self->runobj);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMemberDef RunConfig_members[] = {
+    {"timelimit", T_INT, offsetof(RunConfigObject, runobj.time_limit),
+        READONLY, "time limit (ms)"},
+    {"memorylimit", T_INT, offsetof(RunConfigObject, runobj.memory_limit),
+        READONLY, "memory limit (KB)"},
+    {"trace", T_INT, offsetof(RunConfigObject, runobj.trace),
+        READONLY, "trace mode"},
+    {NULL}
+};
+
+#define RunConfig_doc "RunConfig(argv_dict)\n"\
+    "\tvalidate a run() config dict once and keep it in native form;\n"\
+    "\tpass it to run(cfg, fd_in, fd_out) instead of the dict"
+
+PyTypeObject RunConfigType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.RunConfig",             /* tp_name */
+    sizeof(RunConfigObject),            /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) RunConfig_dealloc,     /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    RunConfig_doc,                      /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    0,                                  /* tp_methods */
+    RunConfig_members,                  /* tp_members */
+    0,                                  /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    (initproc) RunConfig_init,          /* tp_init */
+    0,                                  /* tp_alloc */
+    PyType_GenericNew,                  /* tp_new */
+};
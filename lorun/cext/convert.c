@@ -17,11 +17,16 @@
  */
 
 #include "convert.h"
+#include "policy.h"
+#include "result.h"
+#include "phase.h"
+#include <sys/syscall.h>
 
 /* 解析允许的calls列表 */
 int initCalls(PyObject *li, u_char calls[]) {
     PyObject *t;
     Py_ssize_t len, i;
+    long call;
 
     memset(calls, 0, sizeof(u_char) * CALLS_MAX);
 
@@ -35,91 +40,176 @@ int initCalls(PyObject *li, u_char calls[]) {
         #ifdef IS_PY3
         if (!PyLong_Check(t))
             RAISE1("calls must be a list of numbers.");
-        calls[PyLong_AsLong(t)] = 1;
+        call = PyLong_AsLong(t);
         #else
         if (!PyInt_Check(t) && !PyLong_Check(t))
             RAISE1("calls must be a list of numbers.");
-        calls[PyInt_AsLong(t)] = 1;
+        call = PyInt_AsLong(t);
         #endif
+        if (call < 0 || call >= CALLS_MAX)
+            RAISE1("call number out of range.");
+        calls[call] = CALL_ALLOW;
     }
 
     return 0;
 }
 
-PyObject *genResult(struct Result *rst) {
-    PyObject *rst_obj, *j, *t, *m;
-    if ((rst_obj = PyDict_New()) == NULL)
-        RAISE0("new dict failure");
+/* 解析允许的files字典，与以前一样只检查open的路径 */
+int initFiles(PyObject *files, struct Policy *policy) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    const char *path;
+    long flags;
 
-    j = PyLong_FromLong(rst->judge_result);
-    t = PyLong_FromLong(rst->time_used);
-    m = PyLong_FromLong(rst->memory_used);
+    while (PyDict_Next(files, &pos, &key, &value)) {
+        #ifdef IS_PY3
+        if ((path = PyUnicode_AsUTF8(key)) == NULL)
+            return -1;
+        flags = PyLong_AsLong(value);
+        #else
+        if ((path = PyString_AsString(key)) == NULL)
+            return -1;
+        flags = PyInt_AsLong(value);
+        #endif
+        if (flags == -1 && PyErr_Occurred())
+            return -1;
+        /* 字典中的路径都是精确匹配 */
+        if (policyAddFile(policy, path, 0, FILE_FLAG_EQ, flags))
+            RAISE1("add files entry failure");
+    }
+    policyFinish(policy);
+#ifdef SYS_open
+    if (policy->table[SYS_open] & CALL_ALLOW)
+        policy->table[SYS_open] |= CALL_PATH;
+#endif
 
-    if (!j || !t || !m)
-        RAISE0("set item falure(1)");
+    return 0;
+}
 
-    if (PyDict_SetItemString(rst_obj, "result", j)) {
-        RAISE0("set item falure");
+/* {调用号: (次数, 纳秒)}，只包含出现过的调用 */
+static PyObject *genStats(const struct SyscallStat *stats) {
+    PyObject *stats_obj, *k, *v;
+    int i;
+
+    if ((stats_obj = PyDict_New()) == NULL)
+        return NULL;
+    for (i = 0; i < CALLS_MAX; i++) {
+        if (!stats[i].count)
+            continue;
+        k = PyLong_FromLong(i);
+        v = Py_BuildValue("(kK)", stats[i].count, stats[i].ns);
+        if (!k || !v || PyDict_SetItem(stats_obj, k, v)) {
+            Py_XDECREF(k);
+            Py_XDECREF(v);
+            Py_DECREF(stats_obj);
+            return NULL;
+        }
+        Py_DECREF(k);
+        Py_DECREF(v);
     }
 
-    if (PyDict_SetItemString(rst_obj, "timeused", t)
-            || PyDict_SetItemString(rst_obj, "memoryused", m)) {
-        RAISE0("set item failure");
-    }
+    return stats_obj;
+}
 
-    if (rst->re_signum) {
-        PyDict_SetItemString(rst_obj, "re_signum",
-                PyLong_FromLong(rst->re_signum));
+static const char *phase_names[PHASE_MAX] = {
+    "start", "parsed", "forked", "exec", "spawned",
+    "exited", "collected", "mapped", "compared", "done",
+};
+
+/* {阶段名: 距start的纳秒}，只包含经过的阶段 */
+PyObject *genPhases(const unsigned long long *phases) {
+    PyObject *phases_obj, *v;
+    int i;
+
+    if ((phases_obj = PyDict_New()) == NULL)
+        return NULL;
+    for (i = 0; i < PHASE_MAX; i++) {
+        if (!phases[i])
+            continue;
+        v = PyLong_FromUnsignedLongLong(phases[i] - phases[PHASE_START]);
+        if (v == NULL || PyDict_SetItemString(phases_obj, phase_names[i], v)) {
+            Py_XDECREF(v);
+            Py_DECREF(phases_obj);
+            return NULL;
+        }
+        Py_DECREF(v);
     }
-    if (rst->re_call != -1) {
-        PyDict_SetItemString(rst_obj, "re_call", PyLong_FromLong(rst->re_call));
+
+    return phases_obj;
+}
+
+/* phases模式下把compile/special/check的返回值obj变为(obj, phases) */
+PyObject *withPhases(PyObject *obj, unsigned long long *phases) {
+    PyObject *phases_obj;
+
+    if (obj == NULL)
+        return NULL;
+    MARK_PHASE(phases, PHASE_DONE, done);
+    if (phases == NULL)
+        return obj;
+    if ((phases_obj = genPhases(phases)) == NULL) {
+        Py_DECREF(obj);
+        return NULL;
     }
-    if (rst->re_file) {
-        #ifdef IS_PY3
-        PyObject *re_file = PyUnicode_FromString(rst->re_file);
-        #else
-        PyObject *re_file = PyString_FromString(rst->re_file);
-        #endif
-        PyDict_SetItemString(rst_obj, "re_file", re_file);
-        PyDict_SetItemString(rst_obj, "re_file_flag",
-            PyLong_FromLong(rst->re_file_flag));
+    return Py_BuildValue("(NN)", obj, phases_obj);
+}
+
+PyObject *genResult(struct Result *rst, unsigned long long *phases) {
+    PyObject *stats_obj = NULL, *phases_obj = NULL;
+
+    MARK_PHASE(phases, PHASE_DONE, done);
+
+    if (rst->stats && (stats_obj = genStats(rst->stats)) == NULL)
+        return NULL;
+    if (phases && (phases_obj = genPhases(phases)) == NULL) {
+        Py_XDECREF(stats_obj);
+        return NULL;
     }
 
-    return rst_obj;
+    return newResultObject(rst, stats_obj, phases_obj);
 }
 
-char * const * genRunArgs(PyObject *args_obj) { //generate the argsments for exec*
+/* 生成exec*需要的参数，字符串都复制一份，用freeRunArgs释放 */
+char * const * genRunArgs(PyObject *args_obj) {
     PyObject *arg;
-    const char **args;
-    int len, i;
+    char **args;
+    const char *s;
+    Py_ssize_t len, i;
 
     if (!PyList_Check(args_obj))
         RAISE0("args must be a list")
 
     len = PyList_GET_SIZE(args_obj);
-    args = (const char**) malloc(sizeof(char*) * (len + 1));
+    if ((args = (char**) calloc(len + 1, sizeof(char*))) == NULL)
+        RAISE0("malloc args failure");
 
     for (i = 0; i < len; i++) {
-        #ifdef IS_PY3
-        PyObject *arg_bytes;
-        #endif
-
-        if ((arg = PyList_GetItem(args_obj, i)) == NULL) {
-            free(args);
-            return NULL;
-        }
+        arg = PyList_GET_ITEM(args_obj, i);
 
         #ifdef IS_PY3
-        arg_bytes = PyUnicode_AsUTF8String(arg);
-        if (arg_bytes == NULL) {return NULL;}
-        args[i] = PyBytes_AsString(arg_bytes);
+        s = PyUnicode_AsUTF8(arg);
         #else
-        args[i] = PyString_AsString(arg);
+        s = PyString_AsString(arg);
         #endif
 
-        if (args[i] == NULL) {return NULL;}
+        if (s == NULL || (args[i] = strdup(s)) == NULL) {
+            freeRunArgs(args);
+            if (!PyErr_Occurred())
+                RAISE0("malloc args failure");
+            return NULL;
+        }
     }
-    args[i] = NULL;
+    args[len] = NULL;
 
     return (char * const *) args;
 }
+
+void freeRunArgs(char * const *args) {
+    char * const *p;
+
+    if (args == NULL)
+        return;
+    for (p = args; *p; p++)
+        free(*p);
+    free((void *) args);
+}
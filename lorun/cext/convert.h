@@ -21,8 +21,14 @@
 
 #include "lorun.h"
 
+struct Policy;
+
 int initCalls(PyObject *li, u_char calls[]);
-PyObject *genResult(struct Result *rst);
+int initFiles(PyObject *files, struct Policy *policy);
+PyObject *genPhases(const unsigned long long *phases);
+PyObject *withPhases(PyObject *obj, unsigned long long *phases);
+PyObject *genResult(struct Result *rst, unsigned long long *phases);
 char * const * genRunArgs(PyObject *args_obj);
+void freeRunArgs(char * const *args);
 
 #endif
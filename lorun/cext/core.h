@@ -0,0 +1,134 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_CORE_HEADER
+#define __LO_CORE_HEADER
+
+/* 运行核心的公共定义，不依赖Python，可以单独编译为liblorun */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/types.h>
+
+#define CALLS_MAX 512
+#define MAX_OUTPUT 100000000
+#define PATH_MAX_DEFAULT 4096
+#define PATH_MAX_LIMIT 65536
+
+enum JUDGE_RESULT {
+    AC = 0, //0 Accepted
+    PE,	    //1 Presentation Error
+    TLE,	//2 Time Limit Exceeded
+    MLE,	//3 Memory Limit Exceeded
+    WA,	    //4 Wrong Answer
+    RE,	    //5 Runtime Error
+    OLE,	//6 Output Limit Exceeded
+    CE,	    //7 Compile Error
+    SE,     //8 System Error
+};
+
+struct SyscallStat {
+    unsigned long count;        //调用次数
+    unsigned long long ns;      //在跟踪器中停止的累计时间(纳秒)
+};
+
+/* sample模式下的一个采样点 */
+struct Sample {
+    unsigned int ms;        //距子进程exec的毫秒数
+    unsigned int cpu_ms;    //累计CPU时间(用户态加内核态)
+    unsigned int rss_kb;    //常驻内存
+};
+
+struct Result {
+    int judge_result; //JUDGE_RESULT
+    int time_used, memory_used;
+    int wall_used;              //墙钟时间(毫秒)，tree或walltimelimit模式之外为-1
+    int re_signum;
+    int re_call;
+    const char* re_file;
+    int re_file_flag;
+    struct SyscallStat *stats;  //syscall_stats模式下的统计，长度CALLS_MAX
+    long long instructions;     //用户态指令数，未开启计数时为INSN_OFF
+    const struct Sample *samples;   //sample模式下的采样，指向Runctx中的缓冲区
+    int nsamples;
+};
+
+/* Result.instructions的特殊值 */
+#define INSN_OFF -1             //没有开启指令计数
+#define INSN_UNAVAILABLE -2     //开启了但硬件计数器不可用
+
+struct Policy;
+struct Sampler;
+
+/* 一次运行、编译、spj或比较经过的阶段，phases模式下记录各阶段的单调时间戳 */
+enum PHASE {
+    PHASE_START = 0,    //进入run/compile/special/check
+    PHASE_PARSED,       //配置解析完成
+    PHASE_FORKED,       //子进程中vfork返回
+    PHASE_EXEC,         //子进程中即将execvp
+    PHASE_SPAWNED,      //父进程中vfork返回，子进程已exec
+    PHASE_EXITED,       //子进程已回收
+    PHASE_COLLECTED,    //编译器/spj的输出已读取
+    PHASE_MAPPED,       //两个输出已mmap
+    PHASE_COMPARED,     //比较完成
+    PHASE_DONE,         //开始生成返回的结果
+    PHASE_MAX
+};
+
+struct Runobj {
+    struct Policy *policy;  //trace模式下的系统调用策略
+    char * const* args;
+
+    int fd_in, fd_out, fd_err;
+    int time_limit, memory_limit;
+    int runner;
+    int trace;
+    int syscall_stats;  //trace模式下统计每个系统调用的次数和耗时
+    int tree;           //跟踪(trace模式)或包含(进程组)整个进程树
+    int wall_limit;     //大于0时按墙钟时间(毫秒)而不是CPU时间判断超时
+
+    int path_max;   //trace模式下读取路径参数的最大长度
+    int phases;     //记录各阶段的时间戳
+    long output_limit;  //大于0时用RLIMIT_FSIZE限制输出的字节数
+    int instructions;       //用perf计数器统计用户态指令数
+    long long insn_limit;   //大于0时按指令数而不是CPU时间判断超时
+    int sample;         //大于0时每隔这么多毫秒记录一次CPU时间和内存
+    int exec_fd;        //大于0时为程序文件的fd：用fexecve执行它，args[0]只作为argv[0]；
+                        //编译配置中不允许
+    int compile_fd;     //大于0时是编译输出的memfd，在编译器中保持打开，只由compileMemfd设置
+    int real_slack;     //ITIMER_REAL额外放宽的毫秒数，piped模式下是等待生成器的时间
+};
+
+#define RUN_ERR_MAX 100
+
+/* 一次运行中会被修改的状态，每次运行独立，使runit可以并发调用 */
+struct Runctx {
+    const char *err;            //失败时的错误信息
+    char errbuf[RUN_ERR_MAX];   //子进程通过管道返回的错误信息
+    char *path;                 //路径缓冲区，长度为path_max + 1
+    long path_flag;             //被拒绝的open/openat的flags
+    unsigned long long *phases; //各阶段的时间戳，长度PHASE_MAX，没有开启时为NULL
+    int insn_fd;                //spawnRun打开的指令计数器，没有时为-1
+    unsigned long long spawned; //spawnRun返回的单调时间，用于计算墙钟时间
+    unsigned long long exited;  //第一次观察到主进程结束的单调时间，0表示还没有
+    struct Sampler *sampler;    //sample模式下spawnRun启动的采样线程
+    pid_t tree_pid;             //不跟踪的tree模式下shim启动的主进程
+    int tree_fd;                //shim报告结果的管道，没有时为-1
+};
+
+#endif
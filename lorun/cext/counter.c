@@ -0,0 +1,121 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "counter.h"
+#include <linux/perf_event.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+
+/* 在子进程中打开统计自身用户态指令数的计数器。
+ * exec时才开始计数，之后创建的线程和子进程继承计数器；
+ * limit大于0时每limit条指令溢出一次，内核向子进程发送SIGXCPU。
+ * 计数器不可用(虚拟机没有PMU，perf_event_paranoid过高等)时返回-1 */
+int openInsnCounter(long long limit) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if (limit > 0) {
+        attr.sample_period = limit;
+        attr.wakeup_events = 1;
+    }
+
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    /* 溢出信号发给打开者，即即将exec的子进程 */
+    if (limit > 0 && (fcntl(fd, F_SETOWN, getpid()) == -1
+            || fcntl(fd, F_SETSIG, SIGXCPU) == -1
+            || fcntl(fd, F_SETFL, O_ASYNC) == -1)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 计数器fd是CLOEXEC的，被测程序拿不到；exec前通过SCM_RIGHTS交给父进程。
+ * fd为-1时只发送一个空消息，表示计数器不可用 */
+void sendCounter(int sock, int fd) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char buf[CMSG_SPACE(sizeof(int))], c = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1) {
+        memset(buf, 0, sizeof(buf));
+        msg.msg_control = buf;
+        msg.msg_controllen = sizeof(buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    sendmsg(sock, &msg, MSG_DONTWAIT);
+}
+
+/* 子进程exec之后调用，没有收到计数器时返回-1 */
+int recvCounter(int sock) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char buf[CMSG_SPACE(sizeof(int))], c;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof(buf);
+    if (recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+            && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+/* 子进程结束后读取总数，已退出线程的计数已合并到其中 */
+long long readCounter(int fd) {
+    unsigned long long count;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return INSN_UNAVAILABLE;
+    return (long long) count;
+}
@@ -17,36 +17,30 @@
  */
 
 #include "diff.h"
+#include "phase.h"
 #include <sys/mman.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
 
-int equalStr(const char *s, const char *s2) {
-    while (*s && *s2) {
-        if (*s++ != *s2++) {
-            return 1;
+#define RETURN(rst) {\
+            *result = rst;\
+            MARK_PHASE(ctx->phases, PHASE_COMPARED, compared);\
+            return 0;\
         }
-    }
+#define RAISE_DIFF(msg) {ctx->err = msg;return -1;}
 
-    return 0;
-}
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
 
-#define RETURN(rst) {*result = rst;return 0;}
-int checkDiff(int rightout_fd, int userout_fd, int *result) {
-    char *userout, *rightout;
+/* 比较内存中的两份输出，不要求以\0结尾 */
+int checkBuffers(const char *rightout, size_t rightout_len,
+        const char *userout, size_t userout_len, int *result,
+        struct Runctx *ctx) {
     const char *cuser, *cright, *end_user, *end_right;
 
-    off_t userout_len, rightout_len;
-    userout_len = lseek(userout_fd, 0, SEEK_END);
-    rightout_len = lseek(rightout_fd, 0, SEEK_END);
-
-    if (userout_len == -1 || rightout_len == -1)
-        RAISE1("lseek failure");
-
     if (userout_len >= MAX_OUTPUT)
         RETURN(OLE);
 
-    lseek(userout_fd, 0, SEEK_SET);
-    lseek(rightout_fd, 0, SEEK_SET);
-
     if ((userout_len && rightout_len) == 0) {
         if (userout_len || rightout_len)
             RETURN(WA)
@@ -54,35 +48,18 @@ int checkDiff(int rightout_fd, int userout_fd, int *result) {
             RETURN(AC)
     }
 
-    if ((userout = (char*) mmap(NULL, userout_len, PROT_READ | PROT_WRITE,
-            MAP_PRIVATE, userout_fd, 0)) == MAP_FAILED) {
-        RAISE1("mmap userout filure");
-    }
-
-    if ((rightout = (char*) mmap(NULL, rightout_len, PROT_READ | PROT_WRITE,
-            MAP_PRIVATE, rightout_fd, 0)) == MAP_FAILED) {
-        munmap(userout, userout_len);
-        RAISE1("mmap right filure");
-    }
-
-    if ((userout_len == rightout_len) && equalStr(userout, rightout) == 0) {
-        munmap(userout, userout_len);
-        munmap(rightout, rightout_len);
+    if (userout_len == rightout_len
+            && memcmp(userout, rightout, userout_len) == 0)
         RETURN(AC);
-    }
 
     cuser = userout;
     cright = rightout;
     end_user = userout + userout_len;
     end_right = rightout + rightout_len;
     while ((cuser < end_user) && (cright < end_right)) {
-        while ((cuser < end_user)
-                && (*cuser == ' ' || *cuser == '\n' || *cuser == '\r'
-                        || *cuser == '\t'))
+        while ((cuser < end_user) && IS_BLANK(*cuser))
             cuser++;
-        while ((cright < end_right)
-                && (*cright == ' ' || *cright == '\n' || *cright == '\r'
-                        || *cright == '\t'))
+        while ((cright < end_right) && IS_BLANK(*cright))
             cright++;
         if (cuser == end_user || cright == end_right)
             break;
@@ -91,22 +68,131 @@ int checkDiff(int rightout_fd, int userout_fd, int *result) {
         cuser++;
         cright++;
     }
-    while ((cuser < end_user)
-            && (*cuser == ' ' || *cuser == '\n' || *cuser == '\r'
-                    || *cuser == '\t'))
+    while ((cuser < end_user) && IS_BLANK(*cuser))
         cuser++;
-    while ((cright < end_right)
-            && (*cright == ' ' || *cright == '\n' || *cright == '\r'
-                    || *cright == '\t'))
+    while ((cright < end_right) && IS_BLANK(*cright))
         cright++;
-    if (cuser == end_user && cright == end_right) {
-        munmap(userout, userout_len);
-        munmap(rightout, rightout_len);
+    if (cuser == end_user && cright == end_right)
         RETURN(PE);
+
+    RETURN(WA);
+}
+
+/* 去掉答案中的空白字符写入norm(至少len字节)，返回长度。
+ * 同一份答案被多次比较时只需做一次，见checkNormalized */
+size_t normalizeOutput(const char *data, size_t len, char *norm) {
+    const char *end = data + len;
+    char *p = norm;
+
+    for (; data < end; data++)
+        if (!IS_BLANK(*data))
+            *p++ = *data;
+    return p - norm;
+}
+
+/* 结果与checkBuffers相同，但答案的空白已经预先去掉，只需扫描用户输出 */
+int checkNormalized(const char *rightout, size_t rightout_len,
+        const char *norm, size_t norm_len,
+        const char *userout, size_t userout_len, int *result,
+        struct Runctx *ctx) {
+    const char *end_user, *end_norm;
+
+    if (userout_len >= MAX_OUTPUT)
+        RETURN(OLE);
+
+    if ((userout_len && rightout_len) == 0) {
+        if (userout_len || rightout_len)
+            RETURN(WA)
+        else
+            RETURN(AC)
     }
 
-    munmap(userout, userout_len);
-    munmap(rightout, rightout_len);
+    if (userout_len == rightout_len
+            && memcmp(userout, rightout, userout_len) == 0)
+        RETURN(AC);
+
+    end_user = userout + userout_len;
+    end_norm = norm + norm_len;
+    for (; userout < end_user; userout++) {
+        if (IS_BLANK(*userout))
+            continue;
+        if (norm == end_norm || *userout != *norm)
+            RETURN(WA);
+        norm++;
+    }
+    if (norm == end_norm)
+        RETURN(PE);
+
     RETURN(WA);
 }
 
+/* 只读映射fd的全部内容，空文件时data为NULL。
+ * 比较几乎总要读完整个文件，MAP_POPULATE一次预读并建立映射，避免逐页缺页 */
+int mapOutput(int fd, const char **data, size_t *len, struct Runctx *ctx) {
+    off_t size;
+    void *p;
+
+    if ((size = lseek(fd, 0, SEEK_END)) == -1)
+        RAISE_DIFF("lseek failure");
+    lseek(fd, 0, SEEK_SET);
+
+    *data = NULL;
+    *len = size;
+    if (size == 0)
+        return 0;
+    if ((p = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0))
+            == MAP_FAILED)
+        RAISE_DIFF("mmap output failure");
+    *data = (const char *) p;
+    return 0;
+}
+
+void unmapOutput(const char *data, size_t len) {
+    if (data)
+        munmap((void *) data, len);
+}
+
+/* 答案已经在内存中(例如测试数据包中的映射)，只映射用户输出 */
+int checkAnswer(const char *rightout, size_t rightout_len, int userout_fd,
+        int *result, struct Runctx *ctx) {
+    const char *userout;
+    size_t userout_len;
+    off_t size;
+    int ret;
+
+    /* 超过限制时不必映射 */
+    if ((size = lseek(userout_fd, 0, SEEK_END)) == -1)
+        RAISE_DIFF("lseek failure");
+    if (size >= MAX_OUTPUT)
+        RETURN(OLE);
+
+    if (mapOutput(userout_fd, &userout, &userout_len, ctx))
+        return -1;
+    MARK_PHASE(ctx->phases, PHASE_MAPPED, mapped);
+
+    ret = checkBuffers(rightout, rightout_len, userout, userout_len, result,
+            ctx);
+    unmapOutput(userout, userout_len);
+    return ret;
+}
+
+/* 不调用Python API，调用者可以释放GIL，失败时设置ctx->err */
+int checkDiff(int rightout_fd, int userout_fd, int *result,
+        struct Runctx *ctx) {
+    const char *rightout;
+    size_t rightout_len;
+    off_t size;
+    int ret;
+
+    /* 超过限制时不必映射答案 */
+    if ((size = lseek(userout_fd, 0, SEEK_END)) == -1)
+        RAISE_DIFF("lseek failure");
+    if (size >= MAX_OUTPUT)
+        RETURN(OLE);
+
+    if (mapOutput(rightout_fd, &rightout, &rightout_len, ctx))
+        return -1;
+    ret = checkAnswer(rightout, rightout_len, userout_fd, result, ctx);
+    unmapOutput(rightout, rightout_len);
+    return ret;
+}
@@ -19,8 +19,21 @@
 #ifndef __LO_DIFF_HEADER
 #define __LO_DIFF_HEADER
 
-#include "lorun.h"
+#include "core.h"
 
-int checkDiff(int rightout_fd, int userout_fd, int *result);
+int checkBuffers(const char *rightout, size_t rightout_len,
+        const char *userout, size_t userout_len, int *result,
+        struct Runctx *ctx);
+size_t normalizeOutput(const char *data, size_t len, char *norm);
+int checkNormalized(const char *rightout, size_t rightout_len,
+        const char *norm, size_t norm_len,
+        const char *userout, size_t userout_len, int *result,
+        struct Runctx *ctx);
+int mapOutput(int fd, const char **data, size_t *len, struct Runctx *ctx);
+void unmapOutput(const char *data, size_t len);
+int checkAnswer(const char *rightout, size_t rightout_len, int userout_fd,
+        int *result, struct Runctx *ctx);
+int checkDiff(int rightout_fd, int userout_fd, int *result,
+        struct Runctx *ctx);
 
 #endif
@@ -0,0 +1,668 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "job.h"
+#include "run.h"
+#include "diff.h"
+#include "compile.h"
+#include "special.h"
+#include "policy.h"
+#include "pack.h"
+#include "phase.h"
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define JSON_DEPTH_MAX 32   //数组和对象的最大嵌套层数，避免递归耗尽栈
+
+static int parseValue(const char **p, struct JValue *v, int depth);
+
+void jfree(struct JValue *v) {
+    int i;
+
+    for (i = 0; i < v->n; i++) {
+        if (v->keys)
+            free(v->keys[i]);
+        jfree(&v->items[i]);
+    }
+    free(v->keys);
+    free(v->items);
+    free(v->str);
+    memset(v, 0, sizeof(*v));
+}
+
+void skipSpace(const char **p) {
+    while (isspace((unsigned char) **p))
+        (*p)++;
+}
+
+/* 只处理\uXXXX中的BMP字符 */
+static int parseString(const char **p, char **out) {
+    const char *s = *p + 1;
+    char *buf, *d;
+
+    if ((buf = d = (char *) malloc(strlen(s) + 1)) == NULL)
+        return -1;
+    while (*s && *s != '"') {
+        if (*s != '\\') {
+            *d++ = *s++;
+            continue;
+        }
+        s++;
+        switch (*s) {
+            case 'n': *d++ = '\n'; break;
+            case 't': *d++ = '\t'; break;
+            case 'r': *d++ = '\r'; break;
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'u': {
+                unsigned int c = 0;
+                int i;
+                /* 必须正好4位十六进制数，遇到结尾的0时停止 */
+                for (i = 1; i <= 4; i++) {
+                    if (!isxdigit((unsigned char) s[i]))
+                        goto fail;
+                    c = c * 16 + (isdigit((unsigned char) s[i]) ? s[i] - '0'
+                            : tolower((unsigned char) s[i]) - 'a' + 10);
+                }
+                if (c < 0x80)
+                    *d++ = c;
+                else if (c < 0x800) {
+                    *d++ = 0xc0 | (c >> 6);
+                    *d++ = 0x80 | (c & 0x3f);
+                }
+                else {
+                    *d++ = 0xe0 | (c >> 12);
+                    *d++ = 0x80 | ((c >> 6) & 0x3f);
+                    *d++ = 0x80 | (c & 0x3f);
+                }
+                s += 4;
+                break;
+            }
+            case 0: goto fail;
+            default: *d++ = *s; break;
+        }
+        s++;
+    }
+    if (*s != '"')
+        goto fail;
+    *d = 0;
+    *out = buf;
+    *p = s + 1;
+    return 0;
+
+fail:
+    free(buf);
+    return -1;
+}
+
+/* 按JSON的数字语法扫描，返回长度，不是数字时返回0。
+ * strtod还接受nan、inf、十六进制和前导+，这些不能原样写回 */
+static size_t scanNumber(const char *s) {
+    const char *t = s;
+
+    if (*t == '-')
+        t++;
+    if (*t == '0')
+        t++;
+    else if (*t >= '1' && *t <= '9')
+        while (isdigit((unsigned char) *t))
+            t++;
+    else
+        return 0;
+    if (*t == '.') {
+        if (!isdigit((unsigned char) *++t))
+            return 0;
+        while (isdigit((unsigned char) *t))
+            t++;
+    }
+    if (*t == 'e' || *t == 'E') {
+        t++;
+        if (*t == '+' || *t == '-')
+            t++;
+        if (!isdigit((unsigned char) *t))
+            return 0;
+        while (isdigit((unsigned char) *t))
+            t++;
+    }
+    return t - s;
+}
+
+/* 解析数组或对象的元素，obj为1时元素前有"key": */
+static int parseItems(const char **p, struct JValue *v, int obj, int depth) {
+    char close = obj ? '}' : ']';
+    int cap = 0;
+
+    (*p)++;
+    skipSpace(p);
+    if (**p == close) {
+        (*p)++;
+        return 0;
+    }
+    while (1) {
+        if (v->n == cap) {
+            struct JValue *items;
+            char **keys;
+
+            /* 失败时原来的数组仍在v中，由jfree释放 */
+            cap = cap ? cap * 2 : 8;
+            if ((items = (struct JValue *) realloc(v->items,
+                    cap * sizeof(struct JValue))) == NULL)
+                return -1;
+            v->items = items;
+            if (obj) {
+                if ((keys = (char **) realloc(v->keys,
+                        cap * sizeof(char *))) == NULL)
+                    return -1;
+                v->keys = keys;
+            }
+        }
+        memset(&v->items[v->n], 0, sizeof(struct JValue));
+        skipSpace(p);
+        if (obj) {
+            if (**p != '"' || parseString(p, &v->keys[v->n]))
+                return -1;
+            skipSpace(p);
+            if (**p != ':') {
+                free(v->keys[v->n]);
+                return -1;
+            }
+            (*p)++;
+        }
+        v->n++;
+        if (parseValue(p, &v->items[v->n - 1], depth))
+            return -1;
+        skipSpace(p);
+        if (**p == ',') {
+            (*p)++;
+            continue;
+        }
+        if (**p != close)
+            return -1;
+        (*p)++;
+        return 0;
+    }
+}
+
+static int parseValue(const char **p, struct JValue *v, int depth) {
+    char *end;
+
+    skipSpace(p);
+    v->raw = *p;
+    switch (**p) {
+        case '{':
+            v->type = J_OBJ;
+            if (depth == JSON_DEPTH_MAX || parseItems(p, v, 1, depth + 1))
+                return -1;
+            break;
+        case '[':
+            v->type = J_ARR;
+            if (depth == JSON_DEPTH_MAX || parseItems(p, v, 0, depth + 1))
+                return -1;
+            break;
+        case '"':
+            v->type = J_STR;
+            if (parseString(p, &v->str))
+                return -1;
+            break;
+        default:
+            if (!strncmp(*p, "true", 4) || !strncmp(*p, "null", 4)) {
+                v->type = **p == 't' ? J_BOOL : J_NULL;
+                v->num = v->type == J_BOOL;
+                *p += 4;
+            }
+            else if (!strncmp(*p, "false", 5)) {
+                v->type = J_BOOL;
+                *p += 5;
+            }
+            else {
+                size_t len = scanNumber(*p);
+
+                v->type = J_NUM;
+                if (len == 0)
+                    return -1;
+                v->num = strtod(*p, &end);
+                /* 超出double范围的数(如1e999)也拒绝 */
+                if (end != *p + len || !isfinite(v->num))
+                    return -1;
+                *p = end;
+            }
+    }
+    v->rawlen = *p - v->raw;
+    return 0;
+}
+
+/* 解析一个完整的任务，其后只能有空白 */
+int jparse(const char **p, struct JValue *v) {
+    if (parseValue(p, v, 0))
+        return -1;
+    skipSpace(p);
+    return **p ? -1 : 0;
+}
+
+const struct JValue *jget(const struct JValue *obj, const char *key) {
+    int i;
+
+    for (i = 0; i < obj->n; i++)
+        if (!strcmp(obj->keys[i], key))
+            return &obj->items[i];
+    return NULL;
+}
+
+long jlong(const struct JValue *obj, const char *key, long def) {
+    const struct JValue *v = jget(obj, key);
+    return (v && (v->type == J_NUM || v->type == J_BOOL)) ? (long) v->num : def;
+}
+
+const char *jstr(const struct JValue *obj, const char *key) {
+    const struct JValue *v = jget(obj, key);
+    return (v && v->type == J_STR) ? v->str : NULL;
+}
+
+static void putString(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", fp);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+static const char *phase_names[PHASE_MAX] = {
+    "start", "parsed", "forked", "exec", "spawned",
+    "exited", "collected", "mapped", "compared", "done",
+};
+
+/* 写出所有内容后返回0，连接已断开时返回-1 */
+static int writeAll(struct JobOut *out, const char *buf, size_t len) {
+    ssize_t w;
+
+    while (len > 0) {
+        if (out->sock)
+            w = send(out->fd, buf, len, MSG_NOSIGNAL);
+        else
+            w = write(out->fd, buf, len);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* 通知lorund的主线程队列有变化，eventfd写入8字节的计数 */
+void wakeOut(int wake) {
+    unsigned long long one = 1;
+
+    while (write(wake, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+/* 追加到发送队列，超过QUEUE_MAX时返回-1 */
+static int queueLine(struct JobOut *out, const char *line, size_t len) {
+    char *buf;
+    size_t cap;
+
+    if (out->len + len > QUEUE_MAX)
+        return -1;
+    if (out->len + len > out->cap) {
+        for (cap = out->cap ? out->cap : 4096; cap < out->len + len; cap *= 2)
+            ;
+        if ((buf = (char *) realloc(out->buf, cap)) == NULL)
+            return -1;
+        out->buf = buf;
+        out->cap = cap;
+    }
+    memcpy(out->buf + out->len, line, len);
+    out->len += len;
+    return 0;
+}
+
+/* 先在内存中拼出一整行，再加锁写出或排队 */
+int writeReply(struct JobOut *out, const struct Reply *r) {
+    FILE *fp;
+    char *line = NULL;
+    size_t len = 0;
+    int i, first = 1, ret = -1;
+
+    if ((fp = open_memstream(&line, &len)) == NULL)
+        return -1;
+    fputc('{', fp);
+    if (r->id) {
+        fputs("\"id\": ", fp);
+        fwrite(r->id->raw, 1, r->id->rawlen, fp);
+        first = 0;
+    }
+    if (r->tag) {
+        fprintf(fp, "%s%s", first ? "" : ", ", r->tag);
+        first = 0;
+    }
+    if (!first)
+        fputs(", ", fp);
+    if (r->error) {
+        fputs("\"error\": ", fp);
+        putString(fp, r->error);
+    }
+    else if (r->rst) {
+        const struct Result *rst = r->rst;
+        fprintf(fp, "\"result\": %d, \"timeused\": %d, \"memoryused\": %d",
+                rst->judge_result, rst->time_used, rst->memory_used);
+        if (rst->re_signum)
+            fprintf(fp, ", \"re_signum\": %d", rst->re_signum);
+        if (rst->re_call != -1)
+            fprintf(fp, ", \"re_call\": %d", rst->re_call);
+        if (rst->re_file) {
+            fputs(", \"re_file\": ", fp);
+            putString(fp, rst->re_file);
+            fprintf(fp, ", \"re_file_flag\": %d", rst->re_file_flag);
+        }
+        if (rst->wall_used != -1)
+            fprintf(fp, ", \"walltime\": %d", rst->wall_used);
+        if (rst->instructions == INSN_UNAVAILABLE)
+            fputs(", \"instructions\": null", fp);
+        else if (rst->instructions != INSN_OFF)
+            fprintf(fp, ", \"instructions\": %lld", rst->instructions);
+        if (rst->samples) {
+            fputs(", \"samples\": [", fp);
+            for (i = 0; i < rst->nsamples; i++)
+                fprintf(fp, "%s[%u, %u, %u]", i ? ", " : "",
+                        rst->samples[i].ms, rst->samples[i].cpu_ms,
+                        rst->samples[i].rss_kb);
+            fputc(']', fp);
+        }
+        if (rst->stats) {
+            fputs(", \"syscalls\": {", fp);
+            for (i = 0, first = 1; i < CALLS_MAX; i++) {
+                if (!rst->stats[i].count)
+                    continue;
+                fprintf(fp, "%s\"%d\": [%lu, %llu]", first ? "" : ", ", i,
+                        rst->stats[i].count, rst->stats[i].ns);
+                first = 0;
+            }
+            fputc('}', fp);
+        }
+    }
+    else if (r->output) {
+        fputs("\"output\": ", fp);
+        putString(fp, r->output);
+    }
+    else
+        fprintf(fp, "\"result\": %d", r->check);
+    if (r->phases && !r->error) {
+        fputs(", \"phases\": {", fp);
+        for (i = 0, first = 1; i < PHASE_MAX; i++) {
+            if (!r->phases[i])
+                continue;
+            fprintf(fp, "%s\"%s\": %llu", first ? "" : ", ", phase_names[i],
+                    r->phases[i] - r->phases[PHASE_START]);
+            first = 0;
+        }
+        fputc('}', fp);
+    }
+    fputs("}\n", fp);
+    fclose(fp);
+
+    pthread_mutex_lock(&out->lock);
+    if (!out->dead) {
+        if (out->wake != -1 ? queueLine(out, line, len)
+                : writeAll(out, line, len))
+            __atomic_store_n(&out->dead, 1, __ATOMIC_RELAXED);
+        else
+            ret = 0;
+    }
+    pthread_mutex_unlock(&out->lock);
+    free(line);
+    if (out->wake != -1)
+        wakeOut(out->wake);
+    return ret;
+}
+
+static int openPath(const char *path, int flags) {
+    if (path == NULL)
+        return -1;
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+/* 没有给出的流接到/dev/null，失败时返回-1 */
+static int nullStream(int *fd, int flags) {
+    if (*fd == -1)
+        *fd = openPath("/dev/null", flags);
+    return *fd == -1 ? -1 : 0;
+}
+
+/* 与Python接口中的calls/files相同：calls为调用号列表，files为{路径: flags} */
+static struct Policy *legacyPolicy(const struct JValue *job) {
+    const struct JValue *calls = jget(job, "calls"), *files = jget(job, "files");
+    struct Policy *policy;
+    int i;
+    long nr;
+
+    if (!calls || calls->type != J_ARR || !files || files->type != J_OBJ)
+        return NULL;
+    if ((policy = newPolicy(NULL)) == NULL)
+        return NULL;
+    for (i = 0; i < calls->n; i++) {
+        nr = (long) calls->items[i].num;
+        if (calls->items[i].type != J_NUM || nr < 0 || nr >= CALLS_MAX)
+            goto fail;
+        policy->table[nr] = CALL_ALLOW;
+    }
+    for (i = 0; i < files->n; i++)
+        if (policyAddFile(policy, files->keys[i], 0, FILE_FLAG_EQ,
+                (long) files->items[i].num))
+            goto fail;
+    policyFinish(policy);
+#ifdef SYS_open
+    if (policy->table[SYS_open] & CALL_ALLOW)
+        policy->table[SYS_open] |= CALL_PATH;
+#endif
+    return policy;
+
+fail:
+    releasePolicy(policy);
+    return NULL;
+}
+
+#define JOB_ERR(msg) {reply.error = msg; goto out;}
+
+/* 执行一个任务并写出结果行，返回判题结果：编译失败为CE，出错为SE。
+ * run任务给出answer(或testset加"check": true)时，
+ * AC的输出再与答案比较，没有给出stdout就把输出放在memfd中。
+ * exe_fd不为NULL时，args中有COMPILE_MEMFD的compile任务编译到memfd并存入*exe_fd，
+ * *exe_fd大于0时run任务执行它 */
+int runJob(const struct JValue *job, struct JobOut *out, const char *tag,
+        int *exe_fd) {
+    struct Reply reply = {0};
+    struct Runobj runobj = {0};
+    struct Runctx ctx = {0};
+    struct Result rst = {0};
+    struct Pack pack = {0};
+    const struct JValue *args;
+    const char *type, *name;
+    char *argv[ARGS_MAX + 1], *buffer = NULL;
+    int i, tcase = -1, fd_answer = -1, check, verdict = SE;
+    unsigned long long start = phaseStart();
+
+    runobj.fd_in = runobj.fd_out = runobj.fd_err = -1;
+    reply.id = jget(job, "id");
+    reply.tag = tag;
+    if ((type = jstr(job, "type")) == NULL)
+        type = "run";
+    runobj.phases = jlong(job, "phases", 0);
+
+    /* testset和case代替stdin或answer，从数据包中读取 */
+    if (jstr(job, "testset")) {
+        if (openPack(&pack, jstr(job, "testset"), &ctx))
+            JOB_ERR(ctx.err);
+        tcase = jlong(job, "case", -1);
+        if (tcase < 0 || tcase >= (int) pack.n)
+            JOB_ERR("case out of range");
+    }
+
+    if (!strcmp(type, "check")) {
+        if (pack.base == NULL)
+            fd_answer = openPath(jstr(job, "answer"), O_RDONLY);
+        runobj.fd_out = openPath(jstr(job, "output"), O_RDONLY);
+        if ((pack.base == NULL && fd_answer == -1) || runobj.fd_out == -1)
+            JOB_ERR("open answer/output failure");
+        if (initRunctx(&ctx, &runobj))
+            JOB_ERR(ctx.err);
+        PARSED_PHASE(ctx.phases, start);
+        if (pack.base ? checkAnswer(pack.cases[tcase].ans,
+                pack.cases[tcase].ans_len, runobj.fd_out, &reply.check, &ctx)
+                : checkDiff(fd_answer, runobj.fd_out, &reply.check, &ctx))
+            JOB_ERR(ctx.err);
+        verdict = reply.check;
+        goto out;
+    }
+
+    if ((args = jget(job, "args")) == NULL || args->type != J_ARR
+            || args->n == 0 || args->n > ARGS_MAX)
+        JOB_ERR("args must be a non-empty list");
+    for (i = 0; i < args->n; i++) {
+        if (args->items[i].type != J_STR)
+            JOB_ERR("args must be a list of strings");
+        argv[i] = args->items[i].str;
+    }
+    argv[args->n] = NULL;
+    runobj.args = argv;
+    runobj.time_limit = jlong(job, "timelimit", 1000);
+    runobj.memory_limit = jlong(job, "memorylimit", 65536);
+    runobj.runner = jlong(job, "runner", -1);
+
+    if (!strcmp(type, "compile") || !strcmp(type, "special")) {
+        if (initRunctx(&ctx, &runobj))
+            JOB_ERR(ctx.err);
+        PARSED_PHASE(ctx.phases, start);
+        if (type[0] == 'c') {
+            for (i = 0; exe_fd && argv[i]; i++)
+                if (!strcmp(argv[i], COMPILE_MEMFD))
+                    break;
+            buffer = exe_fd && argv[i] ? compileMemfd(&runobj, &ctx, exe_fd)
+                    : compileit(&runobj, &ctx);
+        }
+        else
+            buffer = special_judge(&runobj, &ctx);
+        reply.output = buffer ? buffer : "";
+        verdict = (type[0] == 'c' && buffer) ? CE : AC;
+        goto out;
+    }
+    if (strcmp(type, "run"))
+        JOB_ERR("unknown job type");
+
+    if (pack.base && (runobj.fd_in = packInput(&pack, tcase, &ctx)) == -1)
+        JOB_ERR(ctx.err);
+    if (pack.base == NULL && jstr(job, "stdin")
+            && (runobj.fd_in = openPath(jstr(job, "stdin"), O_RDONLY)) == -1)
+        JOB_ERR("open stdin failure");
+    check = jstr(job, "answer") || (pack.base && jlong(job, "check", 0));
+    if (pack.base == NULL && check && (fd_answer = openPath(jstr(job, "answer"),
+            O_RDONLY)) == -1)
+        JOB_ERR("open answer failure");
+    if (jstr(job, "stdout") && (runobj.fd_out = openPath(jstr(job, "stdout"),
+            (check ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC)) == -1)
+        JOB_ERR("open stdout failure");
+    if (check && runobj.fd_out == -1) {
+        if ((runobj.fd_out = memfd_create("lorun-output", MFD_CLOEXEC)) == -1)
+            JOB_ERR("memfd_create failure");
+        runobj.output_limit = MAX_OUTPUT;
+    }
+    if (jstr(job, "stderr") && (runobj.fd_err = openPath(jstr(job, "stderr"),
+            O_WRONLY | O_CREAT | O_TRUNC)) == -1)
+        JOB_ERR("open stderr failure");
+    /* 不能把自己的标准输入输出(任务和结果)交给子进程 */
+    if (nullStream(&runobj.fd_in, O_RDONLY)
+            || nullStream(&runobj.fd_out, O_WRONLY)
+            || nullStream(&runobj.fd_err, O_WRONLY))
+        JOB_ERR("open /dev/null failure");
+
+    runobj.trace = jlong(job, "trace", 0);
+    if (runobj.trace) {
+        if ((name = jstr(job, "policy")) != NULL) {
+            if ((runobj.policy = findPolicy(name)) == NULL)
+                JOB_ERR("unknown policy");
+        }
+        else if ((runobj.policy = legacyPolicy(job)) == NULL)
+            JOB_ERR("trace needs a policy or valid calls and files");
+        runobj.path_max = jlong(job, "path_max", PATH_MAX_DEFAULT);
+        if (runobj.path_max <= 0 || runobj.path_max > PATH_MAX_LIMIT)
+            JOB_ERR("path_max out of range");
+        runobj.syscall_stats = jlong(job, "syscall_stats", 0);
+    }
+    if (exe_fd && *exe_fd > 0)
+        runobj.exec_fd = *exe_fd;
+    runobj.tree = jlong(job, "tree", 0);
+    runobj.sample = jlong(job, "sample", 0);
+    runobj.wall_limit = jlong(job, "walltimelimit", 0);
+    runobj.insn_limit = jlong(job, "instructionlimit", 0);
+    runobj.instructions = runobj.insn_limit > 0
+            || jlong(job, "instructions", 0);
+
+    if (initRunctx(&ctx, &runobj))
+        JOB_ERR(ctx.err);
+    PARSED_PHASE(ctx.phases, start);
+    if (runobj.syscall_stats && (rst.stats = (struct SyscallStat *)
+            calloc(CALLS_MAX, sizeof(struct SyscallStat))) == NULL)
+        JOB_ERR("malloc syscall stats failure");
+    rst.re_call = -1;
+    if (runit(&runobj, &ctx, &rst) == -1)
+        JOB_ERR(ctx.err);
+    if (check && rst.judge_result == AC && (pack.base
+            ? checkAnswer(pack.cases[tcase].ans, pack.cases[tcase].ans_len,
+                runobj.fd_out, &rst.judge_result, &ctx)
+            : checkDiff(fd_answer, runobj.fd_out, &rst.judge_result, &ctx)))
+        JOB_ERR(ctx.err);
+    reply.rst = &rst;
+    verdict = rst.judge_result;
+
+out:
+    MARK_PHASE(ctx.phases, PHASE_DONE, done);
+    reply.phases = ctx.phases;
+    writeReply(out, &reply);
+    free(buffer);
+    free(rst.stats);
+    freeRunctx(&ctx);
+    releasePolicy(runobj.policy);
+    closePack(&pack);
+    if (fd_answer != -1)
+        close(fd_answer);
+    if (runobj.fd_in != -1)
+        close(runobj.fd_in);
+    if (runobj.fd_out != -1)
+        close(runobj.fd_out);
+    if (runobj.fd_err != -1)
+        close(runobj.fd_err);
+    return verdict;
+}
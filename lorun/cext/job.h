@@ -0,0 +1,80 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_JOB_HEADER
+#define __LO_JOB_HEADER
+
+/* lorun与lorund共用的JSON任务解析与执行，不属于liblorun */
+
+#include "core.h"
+#include <pthread.h>
+
+#define ARGS_MAX 256
+#define QUEUE_MAX (64 << 20)    //排队未发送的结果超过这么多字节就视为断开
+
+enum JSON_TYPE {
+    J_NULL = 0, J_BOOL, J_NUM, J_STR, J_ARR, J_OBJ,
+};
+
+struct JValue {
+    int type;
+    double num;             //J_NUM, J_BOOL
+    char *str;              //J_STR
+    int n;                  //J_ARR/J_OBJ的元素个数
+    char **keys;            //J_OBJ
+    struct JValue *items;   //J_ARR/J_OBJ
+    const char *raw;        //原始文本，用于原样输出id
+    int rawlen;
+};
+
+/* 结果行写到哪里：lorun是标准输出，lorund是各个连接 */
+struct JobOut {
+    int fd;
+    int sock;               //套接字用send(MSG_NOSIGNAL)，对方关闭时不会收到SIGPIPE
+    int dead;               //写失败后不再写，可以不加锁原子地读取
+    pthread_mutex_t lock;   //保证每行完整，同时保护下面的队列
+    int wake;               //不为-1时结果行只追加到队列并写这个eventfd，
+                            //由lorund的主线程非阻塞地发送，worker不会阻塞
+    char *buf;
+    size_t len, cap;
+};
+
+/* 一个任务的结果 */
+struct Reply {
+    const struct JValue *id;
+    const char *tag;        //紧跟id写出的JSON片段，如"case": 3
+    const char *error;
+    struct Result *rst;
+    int check;
+    const char *output;
+    const unsigned long long *phases;
+};
+
+void skipSpace(const char **p);
+int jparse(const char **p, struct JValue *v);
+void jfree(struct JValue *v);
+const struct JValue *jget(const struct JValue *obj, const char *key);
+long jlong(const struct JValue *obj, const char *key, long def);
+const char *jstr(const struct JValue *obj, const char *key);
+
+void wakeOut(int wake);
+int writeReply(struct JobOut *out, const struct Reply *r);
+int runJob(const struct JValue *job, struct JobOut *out, const char *tag,
+        int *exe_fd);
+
+#endif
@@ -20,11 +20,21 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 
-const char *last_limit_err;
+/* ITIMER_PROF在超过时间限制这么多毫秒后触发，使TLE的运行时间可以被测量 */
+#define TIME_SLACK 20
+
+/* ITIMER_REAL的毫秒数：有墙钟时间限制时就是它，否则比CPU时间限制宽2秒以上 */
+int realTimerMs(const struct Runobj *runobj) {
+    int ms = runobj->time_limit / 1000 * 1000 + 2000;
+
+    if (runobj->wall_limit > 0)
+        ms = runobj->wall_limit;
+    return ms + runobj->real_slack;
+}
 
 /* 为进程设置资源限制，只用作防范，限制放宽 */
-int setResLimit(struct Runobj *runobj) {
-#define RAISE_EXIT(err) {last_limit_err = err;return -1;}
+int setResLimit(const struct Runobj *runobj, struct Runctx *ctx) {
+#define RAISE_EXIT(msg) {ctx->err = msg;return -1;}
     /*
     参照：https://linux.die.net/man/2/setrlimit， https://linux.die.net/man/2/getrlimit
     结构体定义如下
@@ -39,7 +49,7 @@ int setResLimit(struct Runobj *runobj) {
     */
     struct rlimit rl;
 
-    /* 设置CPU运行时间限制 */
+    /* 设置CPU运行时间限制，精确的限制由下面的ITIMER_PROF完成，这里只作为兜底 */
     rl.rlim_cur = runobj->time_limit / 1000 + 1;
     if (runobj->time_limit % 1000 > 800) {
         rl.rlim_cur += 1;
@@ -49,16 +59,23 @@ int setResLimit(struct Runobj *runobj) {
         RAISE_EXIT("set RLIMIT_CPU failure");
 
     /* 设置数据段与虚拟内存大小限制 */
-    rl.rlim_cur = runobj->memory_limit * 1024;
+    rl.rlim_cur = (rlim_t) runobj->memory_limit * 1024;
     rl.rlim_max = rl.rlim_cur + 1024;
     if (setrlimit(RLIMIT_DATA, &rl))
         RAISE_EXIT("set RLIMIT_DATA failure");
 
-    rl.rlim_cur = runobj->memory_limit * 1024 * 2;
+    rl.rlim_cur = (rlim_t) runobj->memory_limit * 1024 * 2;
     rl.rlim_max = rl.rlim_cur + 1024;
     if (setrlimit(RLIMIT_AS, &rl))
         RAISE_EXIT("set RLIMIT_AS failure");
 
+    /* 限制输出文件大小，超过时子进程收到SIGXFSZ */
+    if (runobj->output_limit > 0) {
+        rl.rlim_cur = rl.rlim_max = runobj->output_limit;
+        if (setrlimit(RLIMIT_FSIZE, &rl))
+            RAISE_EXIT("set RLIMIT_FSIZE failure");
+    }
+
     /* 设置进程堆栈的最大空间 */
     rl.rlim_cur = 256 * 1024 * 1024;
     rl.rlim_max = rl.rlim_cur + 1024;
@@ -83,11 +100,26 @@ int setResLimit(struct Runobj *runobj) {
     */
     struct itimerval p_realt;
     /* 设置实际运行时间限制，可以防止sleep等方式卡评测 */
-    p_realt.it_interval.tv_sec = runobj->time_limit / 1000 + 2;
-    p_realt.it_interval.tv_usec = 0;
+    p_realt.it_interval.tv_sec = realTimerMs(runobj) / 1000;
+    p_realt.it_interval.tv_usec = realTimerMs(runobj) % 1000 * 1000;
     p_realt.it_value = p_realt.it_interval;
     if (setitimer(ITIMER_REAL, &p_realt, (struct itimerval *) 0) == -1)
         RAISE_EXIT("set ITIMER_REAL failure");
 
+    /* ITIMER_PROF按进程的CPU时间(用户态加内核态)计时，精确到毫秒，
+     * 与ITIMER_REAL一样在exec后保留(timer_create的定时器不会)，到期时发送SIGPROF。
+     * 按墙钟时间或指令数判断时不按CPU时间杀死进程。
+     * 程序可以捕获或忽略SIGPROF，fork出的子进程也不继承这个定时器，
+     * 这些情况下仍由上面的RLIMIT_CPU(整秒)兜底 */
+    if (runobj->wall_limit <= 0 && runobj->insn_limit <= 0) {
+        struct itimerval prof;
+
+        prof.it_value.tv_sec = (runobj->time_limit + TIME_SLACK) / 1000;
+        prof.it_value.tv_usec = (runobj->time_limit + TIME_SLACK) % 1000 * 1000;
+        prof.it_interval = prof.it_value;
+        if (setitimer(ITIMER_PROF, &prof, (struct itimerval *) 0) == -1)
+            RAISE_EXIT("set ITIMER_PROF failure");
+    }
+
     return 0;
 }
@@ -19,8 +19,8 @@
 #ifndef __LO_LIMIT_HEADER
 #define __LO_LIMIT_HEADER
 
-#include "lorun.h"
+#include "core.h"
 
-int setResLimit(struct Runobj *runobj);
-extern const char *last_limit_err;
+int realTimerMs(const struct Runobj *runobj);
+int setResLimit(const struct Runobj *runobj, struct Runctx *ctx);
 #endif
@@ -17,81 +17,27 @@
  */
 
 #include "lorun.h"
+#include <limits.h>
 #include "convert.h"
 #include "compile.h"
 #include "run.h"
 #include "diff.h"
 #include "special.h"
-
-/* 将Python传递的参数解析 */
-int initRun(struct Runobj *runobj, PyObject *args)
-{
-    PyObject *config, *args_obj, *trace_obj, *time_obj, *memory_obj;
-    PyObject *calls_obj, *runner_obj, *fd_obj;
-
-    if (!PyArg_ParseTuple(args, "O", &config))
-        RAISE1("initRun parseTuple failure");
-    if (!PyDict_Check(config))
-        RAISE1("argument must be a dict");
-
-    if ((args_obj = PyDict_GetItemString(config, "args")) == NULL)
-        RAISE1("must supply args");
-
-    if ((runobj->args = genRunArgs(args_obj)) == NULL)
-        return -1;
-
-    if ((fd_obj = PyDict_GetItemString(config, "fd_in")) == NULL)
-        runobj->fd_in = -1;
-    else
-        runobj->fd_in = PyLong_AsLong(fd_obj);
-    if ((fd_obj = PyDict_GetItemString(config, "fd_out")) == NULL)
-        runobj->fd_out = -1;
-    else
-        runobj->fd_out = PyLong_AsLong(fd_obj);
-    if ((fd_obj = PyDict_GetItemString(config, "fd_err")) == NULL)
-        runobj->fd_err = -1;
-    else
-        runobj->fd_err = PyLong_AsLong(fd_obj);
-
-    if ((time_obj = PyDict_GetItemString(config, "timelimit")) == NULL)
-        RAISE1("must supply timelimit");
-    runobj->time_limit = PyLong_AsLong(time_obj);
-
-    if ((memory_obj = PyDict_GetItemString(config, "memorylimit")) == NULL)
-        RAISE1("must supply memorylimit");
-    runobj->memory_limit = PyLong_AsLong(memory_obj);
-
-    if ((runner_obj = PyDict_GetItemString(config, "runner")) == NULL)
-        runobj->runner = -1;
-    else
-        runobj->runner = PyLong_AsLong(runner_obj);
-
-    if ((trace_obj = PyDict_GetItemString(config, "trace")) != NULL) {
-        if (trace_obj == Py_True) {
-            runobj->trace = 1;
-            //trace mode: supply calls and files to access.
-            if ((calls_obj = PyDict_GetItemString(config, "calls")) == NULL)
-                RAISE1("trace == True, so you must specify calls.");
-            if (!PyList_Check(calls_obj))
-                RAISE1("calls must be a list.");
-            if (initCalls(calls_obj, runobj->inttable))
-                return -1;
-
-            if ((runobj->files = PyDict_GetItemString(config, "files")) == NULL)
-                RAISE1("trace == True, so you must specify files.");
-            if (!PyDict_Check(runobj->files))
-                RAISE1("files must be a dcit.");
-        }
-        else
-            runobj->trace = 0;
-    }
-    else
-        runobj->trace = 0;
-
-    return 0;
-}
-
-/* 执行一次程序，返回资源占用字典或者RuntimeError */
+#include "policy.h"
+#include "config.h"
+#include "result.h"
+#include "process.h"
+#include "phase.h"
+#include "capture.h"
+#include "plan.h"
+#include "problem.h"
+#include "testset.h"
+#include "stress.h"
+#include "pipeline.h"
+
+/* 执行一次程序，返回资源占用字典或者RuntimeError
+ * run(cfg[, fd_in[, fd_out]])，cfg为dict或RunConfig，fd_in/fd_out覆盖cfg中的值。
+ * fd_in可以是bytes等缓冲区，fd_out为CAPTURE时结果中的output为标准输出 */
 PyObject *run(PyObject *self, PyObject *args)
 {
     /*
@@ -105,37 +51,637 @@ PyObject *run(PyObject *self, PyObject *args)
         "trace": True/False,              #是否开启跟踪模式
         "calls": range(0, 400),           #列表形式， 可以调用的名单
         "files": {"/etc/ld.so.cache": 1}, #允许调用的文件字典
+        "path_max": 4096,                 #trace模式下路径参数的最大长度
+        "policy": "c",                    #使用已加载的策略代替calls和files
+        "syscall_stats": True/False,      #返回系统调用的次数和耗时
+        "phases": True/False,             #返回各阶段距开始的纳秒数
     }
     */
     struct Runobj runobj = {0};
+    struct Runctx ctx = {0};
     struct Result rst = {0};
+    struct RunIO io = {-1, -1};
+    PyObject *config, *in_obj = NULL, *out_obj = NULL, *rst_obj = NULL;
+    PyObject *output;
+    int owned = 0, ret;
+    unsigned long long start = phaseStart();
     rst.re_call = -1;
 
-    if (initRun(&runobj, args)) {
-        if (runobj.args)
-            free((void*)runobj.args);
+    if (!PyArg_ParseTuple(args, "O|OO", &config, &in_obj, &out_obj))
         return NULL;
+    if (loadRunobj(config, &runobj, &owned)
+            || setupIO(&runobj, &io, in_obj, out_obj))
+        goto out;
+    if (initRunctx(&ctx, &runobj)) {
+        RAISE(ctx.err);
+        goto out;
+    }
+    PARSED_PHASE(ctx.phases, start);
+
+    if (runobj.syscall_stats && (rst.stats = (struct SyscallStat*)
+            calloc(CALLS_MAX, sizeof(struct SyscallStat))) == NULL) {
+        RAISE("malloc syscall stats failure");
+        goto out;
+    }
+
+    /* runit不调用Python API，运行期间释放GIL */
+    Py_BEGIN_ALLOW_THREADS
+    ret = runit(&runobj, &ctx, &rst);
+    Py_END_ALLOW_THREADS
+    if (ret == -1) {
+        RAISE(ctx.err);
+        goto out;
     }
 
-    if (runit(&runobj, &rst) == -1)
+    /* re_file指向ctx.path，生成结果后才能释放 */
+    rst_obj = genResult(&rst, ctx.phases);
+    if (rst_obj && io.out_fd != -1) {
+        if ((output = takeOutput(&io)) == NULL)
+            Py_CLEAR(rst_obj);
+        else
+            ((ResultObject *) rst_obj)->output = output;
+    }
+
+out:
+    closeIO(&io);
+    freeRunctx(&ctx);
+    if (owned)
+        freeRun(&runobj);
+    free(rst.stats);
+    return rst_obj;
+}
+
+/* 用同一个配置依次执行多组输入输出，cases为[(fd_in, fd_out[, fd_answer]), ...]，
+ * 返回ResultArray，不为每个结果创建Python对象。
+ * 给出fd_answer时正常结束的运行接着用check比较(fd_out需可读)。
+ * 运行第i组时预读第i+1组的输入和答案 */
+PyObject *run_batch(PyObject *self, PyObject *args)
+{
+    struct Runobj runobj = {0};
+    struct Runctx ctx = {0};
+    struct Result rst;
+    PyObject *config, *cases, *item;
+    ResultArrayObject *arr = NULL;
+    Py_ssize_t n, i;
+    int owned = 0, ret, (*fds)[3] = NULL;
+
+    if (!PyArg_ParseTuple(args, "OO", &config, &cases))
         return NULL;
-    if (runobj.args)
-        free((void*)runobj.args);
+    if ((cases = PySequence_Fast(cases, "cases must be a sequence")) == NULL)
+        return NULL;
+    if (loadRunobj(config, &runobj, &owned))
+        goto fail;
+    if (initRunctx(&ctx, &runobj)) {
+        RAISE(ctx.err);
+        goto fail;
+    }
+
+    /* 先解析全部测试点，才能提前预读下一组 */
+    n = PySequence_Fast_GET_SIZE(cases);
+    if ((fds = (int (*)[3]) malloc((n ? n : 1) * sizeof(*fds))) == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    for (i = 0; i < n; i++) {
+        item = PySequence_Fast_GET_ITEM(cases, i);
+        fds[i][2] = -1;
+        if (!PyArg_ParseTuple(item, "ii|i", &fds[i][0], &fds[i][1],
+                &fds[i][2]))
+            goto fail;
+    }
+
+    if ((arr = newResultArray(n)) == NULL)
+        goto fail;
+    if (n) {
+        prefetchFd(fds[0][0]);
+        prefetchFd(fds[0][2]);
+    }
+    for (i = 0; i < n; i++) {
+        runobj.fd_in = fds[i][0];
+        runobj.fd_out = fds[i][1];
+
+        memset(&rst, 0, sizeof(rst));
+        rst.re_call = -1;
+        Py_BEGIN_ALLOW_THREADS
+        if (i + 1 < n) {
+            prefetchFd(fds[i + 1][0]);
+            prefetchFd(fds[i + 1][2]);
+        }
+        ret = runit(&runobj, &ctx, &rst);
+        if (ret == 0 && rst.judge_result == AC && fds[i][2] != -1)
+            ret = checkDiff(fds[i][2], fds[i][1], &rst.judge_result, &ctx);
+        Py_END_ALLOW_THREADS
+        if (ret == -1) {
+            RAISE(ctx.err);
+            goto fail;
+        }
+        if (setResultRecord(arr, i, &rst))
+            goto fail;
+    }
 
-    return genResult(&rst);
+    free(fds);
+    freeRunctx(&ctx);
+    if (owned)
+        freeRun(&runobj);
+    Py_DECREF(cases);
+    return (PyObject *) arr;
+
+fail:
+    free(fds);
+    Py_XDECREF(arr);
+    freeRunctx(&ctx);
+    if (owned)
+        freeRun(&runobj);
+    Py_DECREF(cases);
+    return NULL;
 }
 
-PyObject* check(PyObject *self, PyObject *args)
+/* prefetch(fd, ...)：让内核在后台把这些文件读入页缓存 */
+PyObject *prefetch(PyObject *self, PyObject *args)
 {
-    int user_fd, right_fd, rst;
+    Py_ssize_t i;
+    long fd;
+
+    for (i = 0; i < PyTuple_GET_SIZE(args); i++) {
+        fd = PyLong_AsLong(PyTuple_GET_ITEM(args, i));
+        if (fd == -1 && PyErr_Occurred())
+            return NULL;
+        prefetchFd(fd);
+    }
+    Py_RETURN_NONE;
+}
 
-    if (!PyArg_ParseTuple(args, "ii", &right_fd, &user_fd))
-        RAISE0("run parseTuple failure");
+static const char *plan_policies[] = {"all", "group", "first", NULL};
+static const char *case_states[] = {
+    "pending", "running", "done", "cancelled", "skipped"
+};
 
-    if (checkDiff(right_fd, user_fd, &rst) == -1)
+/* 把[{'cases': [...], 'policy': ...}, ...]展开到plan中 */
+static int parsePlan(PyObject *groups, struct Plan *plan)
+{
+    PyObject *group, *cases = NULL, *item, *policy;
+    const char *name;
+    Py_ssize_t i, j, n;
+    struct PlanCase *c;
+    int k, r = -1;
+
+    plan->ngroups = PySequence_Fast_GET_SIZE(groups);
+    plan->groups = (struct PlanGroup *) calloc(plan->ngroups + 1,
+            sizeof(struct PlanGroup));
+    if (plan->groups == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < plan->ngroups; i++) {
+        group = PySequence_Fast_GET_ITEM(groups, i);
+        if (!PyDict_Check(group))
+            RAISE1("each group must be a dict");
+        if ((item = PyDict_GetItemString(group, "cases")) == NULL)
+            RAISE1("group must have cases");
+        if ((n = PySequence_Size(item)) < 0)
+            return -1;
+        plan->groups[i].first = plan->ncases;
+        plan->groups[i].n = n;
+        plan->ncases += n;
+
+        plan->groups[i].policy = PLAN_ALL;
+        if ((policy = PyDict_GetItemString(group, "policy")) != NULL) {
+            #ifdef IS_PY3
+            name = PyUnicode_AsUTF8(policy);
+            #else
+            name = PyString_AsString(policy);
+            #endif
+            if (name == NULL)
+                return -1;
+            for (k = 0; plan_policies[k]; k++)
+                if (!strcmp(name, plan_policies[k]))
+                    break;
+            if (plan_policies[k] == NULL)
+                RAISE1("policy must be 'all', 'group' or 'first'");
+            plan->groups[i].policy = k;
+        }
+    }
+
+    plan->cases = (struct PlanCase *) calloc(plan->ncases + 1,
+            sizeof(struct PlanCase));
+    if (plan->cases == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < plan->ngroups; i++) {
+        item = PyDict_GetItemString(PySequence_Fast_GET_ITEM(groups, i),
+                "cases");
+        if ((cases = PySequence_Fast(item, "cases must be a sequence")) == NULL)
+            return -1;
+        if (PySequence_Fast_GET_SIZE(cases) != plan->groups[i].n)
+            RAISE1("cases changed size");
+        for (j = 0; j < plan->groups[i].n; j++) {
+            c = &plan->cases[plan->groups[i].first + j];
+            c->group = i;
+            c->fd_answer = -1;
+            if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(cases, j), "ii|i",
+                    &c->fd_in, &c->fd_out, &c->fd_answer))
+                goto out;
+        }
+        Py_CLEAR(cases);
+    }
+    r = 0;
+
+out:
+    Py_XDECREF(cases);
+    return r;
+}
+
+/* 一个子任务的结果 */
+static PyObject *genGroup(const struct Plan *plan, const struct PlanGroup *g)
+{
+    PyObject *dict = NULL, *results, *states, *errors, *failed, *k, *v;
+    const struct PlanCase *c;
+    int i;
+
+    results = PyList_New(g->n);
+    states = PyList_New(g->n);
+    errors = PyDict_New();
+    if (!results || !states || !errors)
+        goto out;
+    for (i = 0; i < g->n; i++) {
+        c = &plan->cases[g->first + i];
+        if (c->state != CASE_DONE) {
+            Py_INCREF(Py_None);
+            v = Py_None;
+        }
+        else if ((v = newResultObject(&c->rst, NULL, NULL)) == NULL)
+            goto out;
+        PyList_SET_ITEM(results, i, v);
+        if ((v = PyString_FromString(case_states[c->state])) == NULL)
+            goto out;
+        PyList_SET_ITEM(states, i, v);
+
+        if (c->err[0]) {
+            k = PyLong_FromLong(i);
+            v = PyString_FromString(c->err);
+            if (!k || !v || PyDict_SetItem(errors, k, v)) {
+                Py_XDECREF(k);
+                Py_XDECREF(v);
+                goto out;
+            }
+            Py_DECREF(k);
+            Py_DECREF(v);
+        }
+    }
+
+    if (g->failed == -1) {
+        Py_INCREF(Py_None);
+        failed = Py_None;
+    }
+    else if ((failed = PyLong_FromLong(g->failed - g->first)) == NULL)
+        goto out;
+    dict = Py_BuildValue("{s:i,s:i,s:N,s:O,s:O,s:O}", "result", g->verdict,
+            "passed", g->passed, "failed", failed, "cases", results,
+            "status", states, "errors", errors);
+
+out:
+    Py_XDECREF(results);
+    Py_XDECREF(states);
+    Py_XDECREF(errors);
+    return dict;
+}
+
+/* run_plan(config, groups, workers=0)：按子任务并行运行测试点，
+ * 失败后取消不再影响结果的测试点，返回每个子任务的结果 */
+PyObject *run_plan(PyObject *self, PyObject *args)
+{
+    struct Runobj runobj = {0};
+    struct Plan plan;
+    PyObject *config, *groups, *list = NULL, *v;
+    int owned = 0, ret, i;
+
+    memset(&plan, 0, sizeof(plan));
+    if (!PyArg_ParseTuple(args, "OO|i", &config, &groups, &plan.workers))
+        return NULL;
+    if ((groups = PySequence_Fast(groups, "groups must be a sequence")) == NULL)
         return NULL;
+    if (loadRunobj(config, &runobj, &owned) || parsePlan(groups, &plan))
+        goto out;
+    plan.runobj = &runobj;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = runPlan(&plan);
+    Py_END_ALLOW_THREADS
+    if (ret) {
+        RAISE("init plan failure");
+        goto out;
+    }
 
-    return Py_BuildValue("i", rst);
+    if ((list = PyList_New(plan.ngroups)) == NULL)
+        goto out;
+    for (i = 0; i < plan.ngroups; i++) {
+        if ((v = genGroup(&plan, &plan.groups[i])) == NULL) {
+            Py_CLEAR(list);
+            goto out;
+        }
+        PyList_SET_ITEM(list, i, v);
+    }
+
+out:
+    freePlan(&plan);
+    free(plan.cases);
+    free(plan.groups);
+    if (owned)
+        freeRun(&runobj);
+    Py_DECREF(groups);
+    return list;
+}
+
+static const char *stress_stages[] = {"generator", "reference", "candidate"};
+
+/* 读出memfd的全部内容，fd为-1时返回None */
+static PyObject *readMemfd(int fd)
+{
+    PyObject *r;
+    off_t size;
+    ssize_t n;
+
+    if (fd == -1)
+        Py_RETURN_NONE;
+    if ((size = lseek(fd, 0, SEEK_END)) == -1)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    if ((r = PyBytes_FromStringAndSize(NULL, size)) == NULL)
+        return NULL;
+    if (size && (n = pread(fd, PyBytes_AS_STRING(r), size, 0)) != size) {
+        Py_DECREF(r);
+        if (n == -1)
+            return PyErr_SetFromErrno(PyExc_OSError);
+        RAISE0("short read from memfd");
+    }
+    return r;
+}
+
+/* stress(gen, ref, cand, iterations, workers=0)：对拍，第k轮运行gen ... k，
+ * 它的输出作为ref和cand的输入，按check的规则比较两者的输出。
+ * 全部一致时返回None，否则返回失败轮次中最小的一轮 */
+PyObject *stress(PyObject *self, PyObject *args)
+{
+    struct Runobj gen = {0}, ref = {0}, cand = {0};
+    struct Stress st;
+    PyObject *gen_cfg, *ref_cfg, *cand_cfg, *r = NULL, *rst_obj;
+    int owned[3] = {0, 0, 0}, ret;
+
+    memset(&st, 0, sizeof(st));
+    st.in_fd = st.ans_fd = st.out_fd = -1;
+    if (!PyArg_ParseTuple(args, "OOOl|i", &gen_cfg, &ref_cfg, &cand_cfg,
+            &st.iterations, &st.workers))
+        return NULL;
+    if (loadRunobj(gen_cfg, &gen, &owned[0])
+            || loadRunobj(ref_cfg, &ref, &owned[1])
+            || loadRunobj(cand_cfg, &cand, &owned[2]))
+        goto out;
+    if (gen.args == NULL || gen.args[0] == NULL) {
+        RAISE("generator must supply args");
+        goto out;
+    }
+    st.gen = &gen;
+    st.ref = &ref;
+    st.cand = &cand;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = runStress(&st);
+    Py_END_ALLOW_THREADS
+    if (ret) {
+        RAISE(st.err);
+        goto out;
+    }
+    if (st.failed == -1) {
+        Py_INCREF(Py_None);
+        r = Py_None;
+        goto out;
+    }
+
+    if ((rst_obj = newResultObject(&st.rst, NULL, NULL)) == NULL)
+        goto out;
+    r = Py_BuildValue("{s:l,s:s,s:N,s:N,s:N,s:N}", "iteration", st.failed,
+            "stage", stress_stages[st.stage], "result", rst_obj,
+            "input", readMemfd(st.in_fd),
+            /* 失败之后的步骤没有运行，对应的输出为None */
+            "answer", readMemfd(st.stage >= STRESS_REFERENCE ? st.ans_fd : -1),
+            "output", readMemfd(st.stage >= STRESS_CANDIDATE ? st.out_fd : -1));
+
+out:
+    freeStress(&st);
+    if (owned[0])
+        freeRun(&gen);
+    if (owned[1])
+        freeRun(&ref);
+    if (owned[2])
+        freeRun(&cand);
+    return r;
+}
+
+/* run_piped(gen, cfg[, answer])：gen的标准输出通过管道作为cfg的标准输入，
+ * 只统计cfg的资源占用，输出捕获在结果的output中。
+ * answer为fd或缓冲区时与输出比较；为配置时用同一个生成器运行它得到答案 */
+PyObject *run_piped(PyObject *self, PyObject *args)
+{
+    struct Runobj gen = {0}, runobj = {0}, ref = {0};
+    struct Runctx gen_ctx = {0}, ctx = {0}, ref_ctx = {0};
+    struct Result gen_rst, rst = {0};
+    struct RunIO io = {-1, -1}, ref_io = {-1, -1};
+    PyObject *gen_cfg, *config, *answer = NULL, *capture, *rst_obj = NULL;
+    PyObject *output;
+    int owned[3] = {0, 0, 0}, ret, answer_fd = -1, is_ref = 0;
+    Py_buffer view = {0};
+    const char *out;
+    size_t out_len;
+
+    rst.re_call = -1;
+    if (!PyArg_ParseTuple(args, "OO|O", &gen_cfg, &config, &answer))
+        return NULL;
+    if (answer == Py_None)
+        answer = NULL;
+    if ((capture = PyLong_FromLong(CAPTURE_FD)) == NULL)
+        return NULL;
+    if (loadRunobj(gen_cfg, &gen, &owned[0])
+            || loadRunobj(config, &runobj, &owned[1])
+            || setupIO(&runobj, &io, NULL, capture))
+        goto out;
+
+    if (answer && (PyDict_Check(answer)
+            || PyObject_TypeCheck(answer, &RunConfigType))) {
+        is_ref = 1;
+        if (loadRunobj(answer, &ref, &owned[2])
+                || setupIO(&ref, &ref_io, NULL, capture))
+            goto out;
+    }
+    else if (answer && PyObject_CheckBuffer(answer)) {
+        if (PyObject_GetBuffer(answer, &view, PyBUF_SIMPLE))
+            goto out;
+    }
+    else if (answer) {
+        if ((answer_fd = PyLong_AsLong(answer)) == -1 && PyErr_Occurred())
+            goto out;
+    }
+
+    if (initRunctx(&gen_ctx, &gen)) {
+        RAISE(gen_ctx.err);
+        goto out;
+    }
+    if (initRunctx(&ctx, &runobj) || (is_ref && initRunctx(&ref_ctx, &ref))) {
+        RAISE(ctx.err ? ctx.err : ref_ctx.err);
+        goto out;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = 0;
+    /* 答案由标准程序用同样的方式生成，它必须正常结束 */
+    if (is_ref) {
+        memset(&gen_rst, 0, sizeof(gen_rst));
+        memset(&rst, 0, sizeof(rst));
+        rst.re_call = gen_rst.re_call = -1;
+        if ((ret = runPiped(&gen, &gen_ctx, &gen_rst, &ref, &ref_ctx, &rst))
+                == 0 && rst.judge_result != AC) {
+            ref_ctx.err = "reference did not finish normally";
+            ret = -1;
+        }
+        if (ret)
+            ctx.err = ref_ctx.err;
+    }
+    if (ret == 0) {
+        memset(&gen_rst, 0, sizeof(gen_rst));
+        memset(&rst, 0, sizeof(rst));
+        rst.re_call = gen_rst.re_call = -1;
+        ret = runPiped(&gen, &gen_ctx, &gen_rst, &runobj, &ctx, &rst);
+    }
+    if (ret == 0 && rst.judge_result == AC) {
+        if (is_ref)
+            ret = checkDiff(ref_io.out_fd, io.out_fd, &rst.judge_result, &ctx);
+        else if (answer_fd != -1)
+            ret = checkDiff(answer_fd, io.out_fd, &rst.judge_result, &ctx);
+        else if (view.obj && (ret = mapOutput(io.out_fd, &out, &out_len,
+                &ctx)) == 0) {
+            ret = checkBuffers((const char *) view.buf, view.len, out,
+                    out_len, &rst.judge_result, &ctx);
+            unmapOutput(out, out_len);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (ret == -1) {
+        RAISE(ctx.err);
+        goto out;
+    }
+
+    rst_obj = genResult(&rst, ctx.phases);
+    if (rst_obj) {
+        if ((output = takeOutput(&io)) == NULL)
+            Py_CLEAR(rst_obj);
+        else
+            ((ResultObject *) rst_obj)->output = output;
+    }
+
+out:
+    Py_DECREF(capture);
+    if (view.obj)
+        PyBuffer_Release(&view);
+    closeIO(&io);
+    closeIO(&ref_io);
+    freeRunctx(&gen_ctx);
+    freeRunctx(&ctx);
+    freeRunctx(&ref_ctx);
+    if (owned[0])
+        freeRun(&gen);
+    if (owned[1])
+        freeRun(&runobj);
+    if (owned[2])
+        freeRun(&ref);
+    return rst_obj;
+}
+
+/* check的一个参数：fd则映射文件，否则取其缓冲区(如run捕获的output) */
+struct CheckInput {
+    Py_buffer view;
+    int has_view;
+    const char *data;
+    size_t len;
+};
+
+static int getCheckInput(PyObject *obj, struct CheckInput *in,
+        struct Runctx *ctx)
+{
+    int fd;
+
+    if (PyObject_CheckBuffer(obj)) {
+        if (PyObject_GetBuffer(obj, &in->view, PyBUF_SIMPLE))
+            return -1;
+        in->has_view = 1;
+        in->data = (const char *) in->view.buf;
+        in->len = in->view.len;
+        return 0;
+    }
+    fd = PyLong_AsLong(obj);
+    if (fd == -1 && PyErr_Occurred())
+        return -1;
+    if (mapOutput(fd, &in->data, &in->len, ctx))
+        RAISE1(ctx->err);
+    return 0;
+}
+
+static void releaseCheckInput(struct CheckInput *in)
+{
+    if (in->has_view)
+        PyBuffer_Release(&in->view);
+    else
+        unmapOutput(in->data, in->len);
+}
+
+/* check(right, user[, phases])，right/user为fd或bytes/memoryview等缓冲区，
+ * phases为真时返回(result, phases) */
+PyObject* check(PyObject *self, PyObject *args)
+{
+    struct Runobj checkobj = {0};
+    struct Runctx ctx = {0};
+    struct CheckInput right = {{0}}, user = {{0}};
+    PyObject *right_obj, *user_obj, *r = NULL;
+    int rst, ret;
+    unsigned long long start = phaseStart();
+
+    if (!PyArg_ParseTuple(args, "OO|i", &right_obj, &user_obj,
+            &checkobj.phases))
+        RAISE0("run parseTuple failure");
+    if (initRunctx(&ctx, &checkobj))
+        RAISE0(ctx.err);
+    PARSED_PHASE(ctx.phases, start);
+
+    /* 两个都是fd时保持以前的行为：输出过大时不映射 */
+    if (!PyObject_CheckBuffer(right_obj) && !PyObject_CheckBuffer(user_obj)) {
+        int right_fd = PyLong_AsLong(right_obj);
+        int user_fd = PyLong_AsLong(user_obj);
+        if (PyErr_Occurred())
+            goto out;
+        Py_BEGIN_ALLOW_THREADS
+        ret = checkDiff(right_fd, user_fd, &rst, &ctx);
+        Py_END_ALLOW_THREADS
+    }
+    else {
+        if (getCheckInput(right_obj, &right, &ctx)
+                || getCheckInput(user_obj, &user, &ctx))
+            goto out;
+        MARK_PHASE(ctx.phases, PHASE_MAPPED, mapped);
+        Py_BEGIN_ALLOW_THREADS
+        ret = checkBuffers(right.data, right.len, user.data, user.len, &rst,
+                &ctx);
+        Py_END_ALLOW_THREADS
+    }
+    if (ret == -1) {
+        RAISE(ctx.err);
+        goto out;
+    }
+
+    r = withPhases(Py_BuildValue("i", rst), ctx.phases);
+
+out:
+    releaseCheckInput(&right);
+    releaseCheckInput(&user);
+    freeRunctx(&ctx);
+    return r;
 }
 
 /* 执行编译，返回NULL代表编译正常，否则返回错误信息字符串 */
@@ -150,26 +696,71 @@ PyObject* compile(PyObject *self, PyObject *args)
     }
     */
     struct Runobj comobj = {0};
-    if (initRun(&comobj, args)) {
-        if (comobj.args)
-            free((void*)comobj.args);
+    struct Runctx ctx = {0};
+    PyObject *config, *err;
+    int owned = 0;
+    unsigned long long start = phaseStart();
+    char * errbuffer;
+
+    if (!PyArg_ParseTuple(args, "O", &config))
+        return NULL;
+    if (loadRunobj(config, &comobj, &owned) || initRunctx(&ctx, &comobj)) {
+        PyErr_Clear();
+        if (owned)
+            freeRun(&comobj);
         return (PyObject *)PyString_FromString("init failure");
     }
+    PARSED_PHASE(ctx.phases, start);
 
-    char * errbuffer;
     /* 执行编译，编译成功返回空 */
-    if ((errbuffer = compileit(&comobj)) == NULL)
-        return (PyObject *)PyString_FromString("");
+    Py_BEGIN_ALLOW_THREADS
+    errbuffer = compileit(&comobj, &ctx);
+    Py_END_ALLOW_THREADS
+    if (owned)
+        freeRun(&comobj);
+
+    err = PyString_FromString(errbuffer ? errbuffer : "");
+    free(errbuffer);
+    err = withPhases(err, ctx.phases);
+    freeRunctx(&ctx);
+    return err;
+}
 
-    if (comobj.args)
-        free((void*)comobj.args);
-    PyObject * err = NULL;
-    if (errbuffer) {
-        err = PyString_FromString(errbuffer);
-        free((void*)errbuffer);
+/* 编译到封印的memfd，args中的MEMFD换成它的路径。
+ * 返回(fd, "")，fd用作run的exec_fd，由调用者关闭；编译失败时返回(None, 错误信息) */
+PyObject* compile_memfd(PyObject *self, PyObject *args)
+{
+    struct Runobj comobj = {0};
+    struct Runctx ctx = {0};
+    PyObject *config, *r;
+    int owned = 0, fd;
+    char * errbuffer;
+
+    if (!PyArg_ParseTuple(args, "O", &config))
+        return NULL;
+    if (loadRunobj(config, &comobj, &owned) || initRunctx(&ctx, &comobj)) {
+        if (!PyErr_Occurred())
+            RAISE(ctx.err);
+        if (owned)
+            freeRun(&comobj);
+        return NULL;
     }
 
-    return err;
+    Py_BEGIN_ALLOW_THREADS
+    errbuffer = compileMemfd(&comobj, &ctx, &fd);
+    Py_END_ALLOW_THREADS
+    if (owned)
+        freeRun(&comobj);
+    freeRunctx(&ctx);
+
+    if (errbuffer) {
+        r = Py_BuildValue("(Os)", Py_None, errbuffer);
+        free(errbuffer);
+        return r;
+    }
+    if ((r = Py_BuildValue("(is)", fd, "")) == NULL)
+        close(fd);
+    return r;
 }
 
 /* 执行spj，返回NULL代表通过测试，否则返回spj的输出 */
@@ -184,44 +775,125 @@ PyObject* special(PyObject *self, PyObject *args)
     }
     */
     struct Runobj spjobj = {0};
-    if (initRun(&spjobj, args)) {
-        if (spjobj.args)
-            free((void*)spjobj.args);
+    struct Runctx ctx = {0};
+    PyObject *config, *out;
+    int owned = 0;
+    unsigned long long start = phaseStart();
+    char * outbuffer;
+
+    if (!PyArg_ParseTuple(args, "O", &config))
+        return NULL;
+    if (loadRunobj(config, &spjobj, &owned) || initRunctx(&ctx, &spjobj)) {
+        PyErr_Clear();
+        if (owned)
+            freeRun(&spjobj);
         return (PyObject *)PyString_FromString("init failure");
     }
+    PARSED_PHASE(ctx.phases, start);
 
-    char * outbuffer;
     /* 执行spj，通过测试返回空 */
-    if ((outbuffer = special_judge(&spjobj)) == NULL)
-        return (PyObject *)PyString_FromString("");
+    Py_BEGIN_ALLOW_THREADS
+    outbuffer = special_judge(&spjobj, &ctx);
+    Py_END_ALLOW_THREADS
+    if (owned)
+        freeRun(&spjobj);
+
+    out = PyString_FromString(outbuffer ? outbuffer : "");
+    free(outbuffer);
+    out = withPhases(out, ctx.phases);
+    freeRunctx(&ctx);
+    return out;
+}
 
-    if (spjobj.args)
-        free((void*)spjobj.args);
-    PyObject * out = NULL;
-    if (outbuffer) {
-        out = PyString_FromString(outbuffer);
-        free((void*)outbuffer);
-    }
+/* 加载策略文件，返回加载的策略个数 */
+PyObject* load_policy(PyObject *self, PyObject *args)
+{
+    const char *path;
+    char err[256];
+    int n;
 
-    return out;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        RAISE0("load_policy parseTuple failure");
+
+    Py_BEGIN_ALLOW_THREADS
+    n = loadPolicies(path, err, sizeof(err));
+    Py_END_ALLOW_THREADS
+    if (n == -1)
+        RAISE0(err);
+
+    return Py_BuildValue("i", n);
 }
 
-#define run_description "run(argv_dict):\n"\
+#define run_description "run(argv_dict[, fd_in[, fd_out]]):\n"\
+    "\targv_dict may also be a RunConfig\n"\
+    "\tfd_in may be bytes; fd_out=CAPTURE returns stdout as result['output']\n"\
     "\targv_dict contains:\n"\
     "\t@args : cmd to run\n"\
     "\t@fd_in, fd_out, fd_err : stdin,stdout,stderr fd\n"\
     "\t@timelimit : program time limit\n"\
     "\t@memorylimit : program memory limit\n"\
     "\t@runner : run user\n"\
-    "\t@trace : trace?"
-
-#define check_description "check(right_fd, userout_fd)\n"
+    "\t@trace : trace?\n"\
+    "\t@path_max : max length of traced path arguments\n"\
+    "\t@policy : name of a loaded syscall policy\n"\
+    "\t@syscall_stats : return {call: (count, ns)} as result['syscalls']\n"\
+    "\t@phases : return {phase: ns since start} as result['phases']"
+
+#define check_description "check(right, userout[, phases])\n"\
+    "\tright/userout are fds or buffers such as a captured output\n"\
+    "\twith phases true, return (result, {phase: ns since start})"
+
+#define run_batch_description "run_batch(argv_dict, [(fd_in, fd_out[, fd_answer]), ...])\n"\
+    "\trun the same config over many cases, return a ResultArray;\n"\
+    "\twith fd_answer, AC runs are checked (fd_out must be readable).\n"\
+    "\tthe next case's input and answer are prefetched during each run"
+
+#define run_plan_description "run_plan(argv_dict, groups, workers=0)\n"\
+    "\tgroups: [{'cases': [(fd_in, fd_out[, fd_answer]), ...],\n"\
+    "\t          'policy': 'all' | 'group' | 'first'}, ...]\n"\
+    "\trun cases in parallel, cancel the ones that can no longer change\n"\
+    "\tthe result, return a list of per-group dicts"
+
+#define stress_description "stress(gen, ref, cand, iterations, workers=0)\n"\
+    "\trun gen with the iteration number appended to its args, feed its\n"\
+    "\toutput to ref and cand and compare their outputs like check, in\n"\
+    "\tparallel; return None, or a dict describing the first failure"
+
+#define run_piped_description "run_piped(gen, argv_dict[, answer])\n"\
+    "\tfeed the stdout of gen to the program through a pipe; only the\n"\
+    "\tprogram is measured and its stdout is returned as result['output'].\n"\
+    "\tanswer (fd or buffer) is checked against the output; a config as\n"\
+    "\tanswer is run the same way to produce it"
+
+#define prefetch_description "prefetch(fd, ...)\n"\
+    "\tstart reading the files into the page cache in the background"
+
+#define spawn_description "spawn(argv_dict[, fd_in[, fd_out]])\n"\
+    "\tstart a run without waiting, return a Process whose fileno() is a\n"\
+    "\tpidfd; call finish() when it is readable (not for trace mode)"
+
+#define compile_memfd_description "compile_memfd(cfg)\n"\
+    "\tcompile into a sealed memfd, with MEMFD in args as the output path;\n"\
+    "\treturn (fd, '') to run as exec_fd, or (None, error)"
+
+#define load_policy_description "load_policy(path)\n"\
+    "\tload the syscall policies of a policy file, return the count"
 
 static PyMethodDef lorun_methods[] = {
 	{"run", run, METH_VARARGS, run_description},
 	{"check", check, METH_VARARGS, check_description},
+    {"run_batch", run_batch, METH_VARARGS, run_batch_description},
+    {"prefetch", prefetch, METH_VARARGS, prefetch_description},
+    {"run_plan", run_plan, METH_VARARGS, run_plan_description},
+    {"stress", stress, METH_VARARGS, stress_description},
+    {"run_piped", run_piped, METH_VARARGS, run_piped_description},
+    {"spawn", spawn, METH_VARARGS, spawn_description},
+    {"spawn_compile", spawn_compile, METH_VARARGS, "spawn_compile(cfg)"},
+    {"spawn_special", spawn_special, METH_VARARGS, "spawn_special(cfg)"},
     {"compile", compile, METH_VARARGS, "compile"},
+    {"compile_memfd", compile_memfd, METH_VARARGS, compile_memfd_description},
     {"special", special, METH_VARARGS, "special"},
+    {"load_policy", load_policy, METH_VARARGS, load_policy_description},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -230,8 +902,37 @@ struct module_state {
     PyObject *error;
 };
 
+static int addType(PyObject *module, const char *name, PyTypeObject *type) {
+    if (PyType_Ready(type) < 0)
+        return -1;
+    Py_INCREF(type);
+    if (PyModule_AddObject(module, name, (PyObject *) type)) {
+        Py_DECREF(type);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 注册模块中的类型 */
+static int addTypes(PyObject *module) {
+    if (addType(module, "RunConfig", &RunConfigType)
+            || addType(module, "Result", &ResultType)
+            || addType(module, "ResultArray", &ResultArrayType)
+            || addType(module, "Process", &ProcessType)
+            || addType(module, "Output", &OutputType)
+            || addType(module, "Problem", &ProblemType)
+            || addType(module, "Testset", &TestsetType)
+            || PyModule_AddIntConstant(module, "CAPTURE", CAPTURE_FD)
+            || PyModule_AddStringConstant(module, "MEMFD", COMPILE_MEMFD))
+        return -1;
+
+    return 0;
+}
+
 #ifdef IS_PY3
 
+/* 多阶段初始化，每个(子)解释器有自己的模块对象和状态 */
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
 static int lorun_ext_traverse(PyObject *m, visitproc visit, void *arg) {
     Py_VISIT(GETSTATE(m)->error);
@@ -243,36 +944,50 @@ static int lorun_ext_clear(PyObject *m) {
     return 0;
 }
 
+static void lorun_ext_free(void *m) {
+    lorun_ext_clear((PyObject *) m);
+}
+
+static int lorun_ext_exec(PyObject *module) {
+    struct module_state *st = GETSTATE(module);
+
+    st->error = PyErr_NewException("_lorun_ext.Error", NULL, NULL);
+    if (st->error == NULL || addTypes(module))
+        return -1;
+
+    return 0;
+}
+
+static PyModuleDef_Slot lorun_ext_slots[] = {
+    {Py_mod_exec, lorun_ext_exec},
+#if PY_VERSION_HEX >= 0x030C0000
+    /* 类型是静态的，不能用于有独立GIL的子解释器 */
+    {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    /* 共享的C状态只有策略注册表，由其自身的锁保护 */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
 static struct PyModuleDef moduledef = {
     PyModuleDef_HEAD_INIT,
     "_lorun_ext",
     NULL,
     sizeof(struct module_state),
     lorun_methods,
-    NULL,
+    lorun_ext_slots,
     lorun_ext_traverse,
     lorun_ext_clear,
-    NULL
+    lorun_ext_free
 };
 
-PyObject *PyInit__lorun_ext(void) {
-    struct module_state *st;
-    PyObject *module = PyModule_Create(&moduledef);
-    if (module == NULL)
-        return NULL;
-
-    st = GETSTATE(module);
-    st->error = PyErr_NewException("_lorun_ext.Error", NULL, NULL);
-    if (st->error == NULL) {
-        Py_DECREF(module);
-        return NULL;
-    }
-
-    return module;
+PyMODINIT_FUNC PyInit__lorun_ext(void) {
+    return PyModuleDef_Init(&moduledef);
 }
 
 #else
-
 static struct module_state _state;
 void init_lorun_ext(void) {
     PyObject *module = Py_InitModule("_lorun_ext", lorun_methods);
@@ -281,7 +996,7 @@ void init_lorun_ext(void) {
     }
 
     _state.error = PyErr_NewException("_lorun_ext.Error", NULL, NULL);
-    if (_state.error == NULL) {
+    if (_state.error == NULL || addTypes(module)) {
         Py_DECREF(module);
         return;
     }
@@ -20,41 +20,7 @@
 #define __LO_GCC_HEADER
 
 #include <Python.h>
-#include <sys/types.h>
-#define CALLS_MAX 400
-#define MAX_OUTPUT 100000000
-
-enum JUDGE_RESULT {
-    AC = 0, //0 Accepted
-    PE,	    //1 Presentation Error
-    TLE,	//2 Time Limit Exceeded
-    MLE,	//3 Memory Limit Exceeded
-    WA,	    //4 Wrong Answer
-    RE,	    //5 Runtime Error
-    OLE,	//6 Output Limit Exceeded
-    CE,	    //7 Compile Error
-    SE,     //8 System Error
-};
-
-struct Result {
-    int judge_result; //JUDGE_RESULT
-    int time_used, memory_used;
-    int re_signum;
-    int re_call;
-    const char* re_file;
-    int re_file_flag;
-};
-
-struct Runobj {
-    PyObject *files;
-    u_char inttable[CALLS_MAX];
-    char * const* args;
-
-    int fd_in, fd_out, fd_err;
-    int time_limit, memory_limit;
-    int runner;
-    int trace;
-};
+#include "core.h"
 
 #define RAISE(msg) PyErr_SetString(PyExc_Exception,msg);
 
@@ -67,6 +33,7 @@ struct Runobj {
 
 #if PY_MAJOR_VERSION >= 3
 #define IS_PY3
+#define PyString_FromString PyUnicode_FromString
 #endif
 
 #endif
@@ -0,0 +1,775 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lorund评测守护进程，不依赖Python。在Unix套接字上接收JSON lines格式的提交，
+ * 按类别公平地调度到固定数量的worker上，每完成一个测试点就写回一行结果:
+ *
+ *   lorund -s /run/lorund.sock [-j workers] [-w 4:2:1] [-p policy]... [-u uid]...
+ *
+ *   {"id": 9, "class": "contest", "stop": true,
+ *    "compile": {"args": ["gcc", "m.c", "-o", "m"]},
+ *    "run": {"args": ["./m"], "timelimit": 1000, "trace": true, "policy": "c"},
+ *    "cases": [{"stdin": "1.in", "answer": "1.ans"}, ...]}
+ *
+ * cases也可以换成"testset": "p.lopack"，评测数据包中的全部测试点。
+ * compile和run的键与lorun的compile、run任务相同，cases中的键覆盖run中的。
+ * compile的args中有"@memfd"时编译到封印的memfd，测试点用fexecve执行它，
+ * 不经过文件系统。
+ * 依次写回：
+ *
+ *   {"id": 9, "stage": "compile", "output": ""}
+ *   {"id": 9, "case": 0, "result": 0, "timeused": 12, ...}
+ *   {"id": 9, "done": true, "passed": 10, "result": 0}
+ *
+ * 最后一行的result是编号最小的不通过测试点的结果，编译失败时为CE。
+ * stop为true时出现不通过的测试点后不再开始新的测试点。
+ * class为contest、practice(默认)或rejudge，类别之间按-w给出的权重
+ * 做stride调度，同一类别按提交顺序，一个提交的多个测试点可以同时评测。
+ * 连接断开后，它的提交中尚未开始的测试点被取消。
+ *
+ * 任务中的路径由lorund自己打开(stdout会被创建或截断)，能连接的一方可以
+ * 读写lorund能读写的任何文件。因此只接受与lorund同一用户、root和-u给出
+ * 的用户的连接(SO_PEERCRED)，lorund应以专门的用户运行。
+ */
+
+#include "job.h"
+#include "pack.h"
+#include "policy.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define WORKERS_MAX 256
+#define CONN_MAX 1024
+#define FIRST_CONN 2            //fds[0]是监听套接字，fds[1]是wake_fd
+#define READ_CHUNK 65536
+#define JOB_LINE_MAX (16 << 20)
+#define STRIDE_ONE (1 << 20)
+#define PEERS_MAX 16
+
+enum CLASS {
+    CLASS_CONTEST = 0, CLASS_PRACTICE, CLASS_REJUDGE, CLASS_MAX,
+};
+
+static const char *class_names[CLASS_MAX] = {
+    "contest", "practice", "rejudge",
+};
+
+enum STAGE {
+    STAGE_OPEN = 0,         //等待读取数据包中的测试点个数
+    STAGE_OPENING,
+    STAGE_COMPILE,          //等待编译
+    STAGE_COMPILING,
+    STAGE_RUN,              //编译成功或不需要编译，逐个评测测试点
+};
+
+enum TASK_KIND {
+    TASK_OPEN = 0, TASK_COMPILE, TASK_CASE, TASK_FINISH,
+};
+
+struct Conn {
+    struct JobOut out;      //结果行在out中排队，由主线程发送
+    int refs;               //主线程和每个未完成的提交各持有一个引用
+    int eof;                //对方已关闭写端，只剩发送结果
+    char *buf;              //还没有组成完整一行的数据
+    size_t len, cap;
+};
+
+struct Submit {
+    char *line;             //job中的raw指向这里
+    struct JValue job;
+    struct Conn *conn;
+    struct Submit *next;    //同一类别的等待队列
+    const struct JValue *compile, *run, *cases;
+    int cls, stop, queued, stage;
+    int n, next_case;       //测试点个数，下一个要开始的测试点
+    int running;            //正在执行的任务数
+    int passed;
+    int failed, result;     //编号最小的不通过测试点及其结果
+    int exe_fd;             //编译到memfd的程序，大于0时测试点执行它
+    const char *error;      //打开数据包失败，写在最后一行
+};
+
+struct Task {
+    struct Submit *s;
+    int kind;
+    int index;
+};
+
+/* 以下全部由lock保护 */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static struct Submit *heads[CLASS_MAX], *tails[CLASS_MAX];
+static unsigned long pass[CLASS_MAX], stride[CLASS_MAX], vtime;
+
+/* worker排队结果或释放连接后写这个eventfd，唤醒poll中的主线程 */
+static int wake_fd;
+/* 允许连接的用户，peers[0]是lorund自己的有效用户 */
+static uid_t peers[PEERS_MAX];
+static int npeers;
+
+static struct Conn *newConn(int fd) {
+    struct Conn *conn;
+
+    if ((conn = (struct Conn *) calloc(1, sizeof(struct Conn))) == NULL)
+        return NULL;
+    conn->out.fd = fd;
+    conn->out.sock = 1;
+    pthread_mutex_init(&conn->out.lock, NULL);
+    conn->out.wake = wake_fd;
+    conn->refs = 1;
+    return conn;
+}
+
+static void releaseConn(struct Conn *conn) {
+    int last;
+
+    pthread_mutex_lock(&lock);
+    last = --conn->refs == 0;
+    pthread_mutex_unlock(&lock);
+    if (!last) {
+        /* 主线程可能在等这个连接空闲，此后不能再访问conn */
+        wakeOut(wake_fd);
+        return;
+    }
+    close(conn->out.fd);
+    pthread_mutex_destroy(&conn->out.lock);
+    free(conn->out.buf);
+    free(conn->buf);
+    free(conn);
+}
+
+/* 在lock中调用，原子地读取而不取out.lock */
+static int connDead(struct Conn *conn) {
+    return __atomic_load_n(&conn->out.dead, __ATOMIC_RELAXED);
+}
+
+/* 还有任务可以开始 */
+static int dispatchable(struct Submit *s) {
+    if (connDead(s->conn) || (s->stop && s->failed != -1))
+        return 0;
+    return s->stage == STAGE_OPEN || s->stage == STAGE_COMPILE
+            || (s->stage == STAGE_RUN && s->next_case < s->n);
+}
+
+/* 空闲后重新排队的类别从当前虚拟时间开始，不能攒下份额 */
+static void enqueue(struct Submit *s, int front) {
+    int c = s->cls;
+
+    s->queued = 1;
+    if (heads[c] == NULL) {
+        if (pass[c] < vtime)
+            pass[c] = vtime;
+        s->next = NULL;
+        heads[c] = tails[c] = s;
+    }
+    else if (front) {
+        s->next = heads[c];
+        heads[c] = s;
+    }
+    else {
+        s->next = NULL;
+        tails[c]->next = s;
+        tails[c] = s;
+    }
+    pthread_cond_signal(&ready);
+}
+
+static void dequeue(struct Submit *s) {
+    struct Submit **p = &heads[s->cls], *prev = NULL;
+
+    while (*p != s) {
+        prev = *p;
+        p = &(*p)->next;
+    }
+    *p = s->next;
+    if (tails[s->cls] == s)
+        tails[s->cls] = prev;
+    s->queued = 0;
+}
+
+/* 选出pass最小的非空类别，取它队首提交的下一个任务，没有任务时返回-1。
+ * 已经没有任务可开始的提交出队，没有正在执行的任务时交给worker收尾 */
+static int pickTask(struct Task *t) {
+    struct Submit *s;
+    int c, best;
+
+    while (1) {
+        best = -1;
+        for (c = 0; c < CLASS_MAX; c++)
+            if (heads[c] && (best == -1 || pass[c] < pass[best]))
+                best = c;
+        if (best == -1)
+            return -1;
+
+        s = t->s = heads[best];
+        if (!dispatchable(s)) {
+            dequeue(s);
+            if (s->running)
+                continue;
+            t->kind = TASK_FINISH;
+            return 0;
+        }
+        s->running++;
+        if (s->stage == STAGE_OPEN) {
+            /* 只读取测试点个数，不计入类别的份额 */
+            s->stage = STAGE_OPENING;
+            t->kind = TASK_OPEN;
+            dequeue(s);
+            return 0;
+        }
+        vtime = pass[best];
+        pass[best] += stride[best];
+        if (s->stage == STAGE_COMPILE) {
+            /* 编译完成前不能开始测试点 */
+            s->stage = STAGE_COMPILING;
+            t->kind = TASK_COMPILE;
+            dequeue(s);
+        }
+        else {
+            t->kind = TASK_CASE;
+            t->index = s->next_case++;
+            if (s->next_case >= s->n)
+                dequeue(s);
+        }
+        return 0;
+    }
+}
+
+/* 把几个对象浅拷贝合并成一个只读对象，jget取第一个同名键，所以前面的优先 */
+static int mergeObjects(struct JValue *out, const struct JValue **objs, int n) {
+    int i, k, total = 0;
+
+    for (i = 0; i < n; i++)
+        total += objs[i]->n;
+    memset(out, 0, sizeof(*out));
+    out->type = J_OBJ;
+    out->keys = (char **) malloc(total * sizeof(char *));
+    out->items = (struct JValue *) malloc(total * sizeof(struct JValue));
+    if (out->keys == NULL || out->items == NULL) {
+        free(out->keys);
+        free(out->items);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        for (k = 0; k < objs[i]->n; k++) {
+            out->keys[out->n] = objs[i]->keys[k];
+            out->items[out->n++] = objs[i]->items[k];
+        }
+    return 0;
+}
+
+/* 给extra加一个键，值浅拷贝 */
+static void addKey(struct JValue *extra, char *key, const struct JValue *v) {
+    extra->keys[extra->n] = key;
+    extra->items[extra->n++] = *v;
+}
+
+/* 数据包的测试点个数，出错时返回-1。路径可能是FIFO之类会阻塞的文件，
+ * 所以在worker中而不是接受连接的主线程中打开 */
+static int countCases(struct Submit *s) {
+    struct Runctx ctx = {0};
+    struct Pack pack;
+    int n;
+
+    if (openPack(&pack, jstr(&s->job, "testset"), &ctx)) {
+        s->error = ctx.err;
+        return -1;
+    }
+    n = pack.n;
+    closePack(&pack);
+    return n;
+}
+
+/* 把提交中的compile或run与测试点合并成lorun的任务执行，返回判题结果 */
+static int runTask(const struct Task *t) {
+    struct Submit *s = t->s;
+    struct JValue extra = {0}, job, vals[5], v = {0};
+    const struct JValue *objs[3], *id = jget(&s->job, "id");
+    struct Reply reply = {0};
+    char *keys[5], tag[32];
+    int n = 0, verdict;
+
+    extra.type = J_OBJ;
+    extra.keys = keys;
+    extra.items = vals;
+    v.type = J_STR;
+    v.str = t->kind == TASK_COMPILE ? "compile" : "run";
+    addKey(&extra, "type", &v);
+    if (id)
+        addKey(&extra, "id", id);
+    objs[n++] = &extra;
+    if (t->kind == TASK_COMPILE) {
+        objs[n++] = s->compile;
+        strcpy(tag, "\"stage\": \"compile\"");
+    }
+    else {
+        if (s->cases)
+            objs[n++] = &s->cases->items[t->index];
+        else {
+            /* 数据包中的测试点，比较输出与包中的答案 */
+            addKey(&extra, "testset", jget(&s->job, "testset"));
+            v.type = J_NUM;
+            v.num = t->index;
+            addKey(&extra, "case", &v);
+            v.type = J_BOOL;
+            v.num = 1;
+            addKey(&extra, "check", &v);
+        }
+        objs[n++] = s->run;
+        snprintf(tag, sizeof(tag), "\"case\": %d", t->index);
+    }
+
+    if (mergeObjects(&job, objs, n)) {
+        reply.id = id;
+        reply.tag = tag;
+        reply.error = "malloc failure";
+        writeReply(&s->conn->out, &reply);
+        return SE;
+    }
+    verdict = runJob(&job, &s->conn->out, tag, &s->exe_fd);
+    free(job.keys);
+    free(job.items);
+    return verdict;
+}
+
+/* 写出最后一行并释放提交 */
+static void finishSubmit(struct Submit *s) {
+    struct Reply reply = {0};
+    char tag[64];
+
+    snprintf(tag, sizeof(tag), "\"done\": true, \"passed\": %d", s->passed);
+    reply.id = jget(&s->job, "id");
+    reply.tag = s->error ? "\"done\": true" : tag;
+    reply.error = s->error;
+    reply.check = s->result;
+    writeReply(&s->conn->out, &reply);
+    releaseConn(s->conn);
+    if (s->exe_fd > 0)
+        close(s->exe_fd);
+    jfree(&s->job);
+    free(s->line);
+    free(s);
+}
+
+static void *worker(void *unused) {
+    struct Task t;
+    struct Submit *s;
+    int c, verdict, done;
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while (pickTask(&t))
+            pthread_cond_wait(&ready, &lock);
+        /* enqueue只叫醒一个worker，还有任务时接着叫醒下一个，
+         * 这样一个提交的多个测试点才能同时评测 */
+        for (c = 0; c < CLASS_MAX; c++)
+            if (heads[c]) {
+                pthread_cond_signal(&ready);
+                break;
+            }
+        pthread_mutex_unlock(&lock);
+        s = t.s;
+        if (t.kind == TASK_FINISH) {
+            finishSubmit(s);
+            continue;
+        }
+
+        if (t.kind == TASK_OPEN)
+            verdict = countCases(s);
+        else
+            verdict = runTask(&t);
+
+        pthread_mutex_lock(&lock);
+        s->running--;
+        if (t.kind == TASK_OPEN) {
+            s->stage = s->compile ? STAGE_COMPILE : STAGE_RUN;
+            if (verdict == -1) {
+                s->result = SE;
+                s->stage = STAGE_RUN;
+            }
+            else
+                s->n = verdict;
+        }
+        else if (t.kind == TASK_COMPILE) {
+            s->stage = STAGE_RUN;
+            if (verdict != AC) {
+                s->result = verdict;
+                s->next_case = s->n;
+            }
+        }
+        else if (verdict == AC)
+            s->passed++;
+        else if (s->failed == -1 || t.index < s->failed) {
+            s->failed = t.index;
+            s->result = verdict;
+        }
+        done = 0;
+        if (dispatchable(s)) {
+            /* 编译完成或读出测试点个数的提交回到队首 */
+            if (!s->queued)
+                enqueue(s, 1);
+        }
+        else {
+            if (s->queued)
+                dequeue(s);
+            done = s->running == 0;
+        }
+        pthread_mutex_unlock(&lock);
+        if (done)
+            finishSubmit(s);
+    }
+    return NULL;
+}
+
+#define SUBMIT_ERR(msg) {reply.error = msg; goto fail;}
+
+/* 检查一行提交并放入等待队列，出错时直接写回，line由提交接管 */
+static void submitLine(struct Conn *conn, char *line) {
+    struct Submit *s;
+    struct Reply reply = {0};
+    const char *p = line, *name;
+    int i;
+
+    skipSpace(&p);
+    if (*p == 0) {
+        free(line);
+        return;
+    }
+    reply.tag = "\"done\": true";
+    if ((s = (struct Submit *) calloc(1, sizeof(struct Submit))) == NULL) {
+        free(line);
+        reply.error = "malloc failure";
+        writeReply(&conn->out, &reply);
+        return;
+    }
+    s->line = line;
+    s->conn = conn;
+    s->failed = -1;
+    s->result = AC;
+
+    if (jparse(&p, &s->job) || s->job.type != J_OBJ)
+        SUBMIT_ERR("bad json job");
+    reply.id = jget(&s->job, "id");
+
+    s->cls = CLASS_PRACTICE;
+    if ((name = jstr(&s->job, "class")) != NULL) {
+        for (s->cls = 0; s->cls < CLASS_MAX; s->cls++)
+            if (!strcmp(name, class_names[s->cls]))
+                break;
+        if (s->cls == CLASS_MAX)
+            SUBMIT_ERR("unknown class");
+    }
+    if ((s->run = jget(&s->job, "run")) == NULL || s->run->type != J_OBJ)
+        SUBMIT_ERR("run must be an object");
+    if ((s->compile = jget(&s->job, "compile")) != NULL
+            && s->compile->type != J_OBJ)
+        SUBMIT_ERR("compile must be an object");
+
+    s->stage = s->compile ? STAGE_COMPILE : STAGE_RUN;
+    if (jstr(&s->job, "testset") != NULL)
+        s->stage = STAGE_OPEN;
+    else if ((s->cases = jget(&s->job, "cases")) != NULL
+            && s->cases->type == J_ARR) {
+        for (i = 0; i < s->cases->n; i++)
+            if (s->cases->items[i].type != J_OBJ)
+                SUBMIT_ERR("cases must be a list of objects");
+        s->n = s->cases->n;
+    }
+    else
+        SUBMIT_ERR("cases or testset is required");
+    s->stop = jlong(&s->job, "stop", 0);
+
+    pthread_mutex_lock(&lock);
+    conn->refs++;
+    enqueue(s, 0);
+    pthread_mutex_unlock(&lock);
+    return;
+
+fail:
+    writeReply(&conn->out, &reply);
+    jfree(&s->job);
+    free(s->line);
+    free(s);
+}
+
+/* 读取可用的数据并提交其中完整的行，对方关闭写端或出错时返回-1 */
+static int readConn(struct Conn *conn) {
+    char *buf, *nl, *line;
+    size_t off = 0;
+    ssize_t r;
+
+    if (conn->cap - conn->len < READ_CHUNK) {
+        if (conn->cap >= JOB_LINE_MAX)
+            return -1;
+        if ((buf = (char *) realloc(conn->buf,
+                conn->cap + READ_CHUNK * 2)) == NULL)
+            return -1;
+        conn->buf = buf;
+        conn->cap += READ_CHUNK * 2;
+    }
+    r = recv(conn->out.fd, conn->buf + conn->len, conn->cap - conn->len, 0);
+    if (r == -1 && errno == EINTR)
+        return 0;
+    if (r <= 0)
+        return -1;
+    conn->len += r;
+
+    while ((nl = (char *) memchr(conn->buf + off, '\n',
+            conn->len - off)) != NULL) {
+        *nl = 0;
+        if ((line = strdup(conn->buf + off)) != NULL)
+            submitLine(conn, line);
+        off = nl - conn->buf + 1;
+    }
+    memmove(conn->buf, conn->buf + off, conn->len - off);
+    conn->len -= off;
+    return 0;
+}
+
+/* 非阻塞地发送排队的结果，发送不了的留到下次POLLOUT */
+static void flushConn(struct Conn *conn) {
+    struct JobOut *out = &conn->out;
+    size_t off = 0;
+    ssize_t w;
+
+    pthread_mutex_lock(&out->lock);
+    while (off < out->len && !out->dead) {
+        w = send(out->fd, out->buf + off, out->len - off,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (w <= 0)
+            __atomic_store_n(&out->dead, 1, __ATOMIC_RELAXED);
+        else
+            off += w;
+    }
+    if (out->dead)
+        off = out->len;
+    memmove(out->buf, out->buf + off, out->len - off);
+    out->len -= off;
+    pthread_mutex_unlock(&out->lock);
+}
+
+static int pending(struct Conn *conn) {
+    int ret;
+
+    pthread_mutex_lock(&conn->out.lock);
+    ret = conn->out.len > 0;
+    pthread_mutex_unlock(&conn->out.lock);
+    return ret;
+}
+
+/* 对方不再提交，已有的提交都已完成并且结果都已发送 */
+static int connIdle(struct Conn *conn) {
+    int refs;
+
+    if (!conn->eof)
+        return 0;
+    pthread_mutex_lock(&lock);
+    refs = conn->refs;
+    pthread_mutex_unlock(&lock);
+    return refs == 1 && !pending(conn);
+}
+
+/* 对方的用户不在允许的列表中时拒绝连接 */
+static int peerAllowed(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int i;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return 0;
+    if (cred.uid == 0)
+        return 1;
+    for (i = 0; i < npeers; i++)
+        if (peers[i] == cred.uid)
+            return 1;
+    return 0;
+}
+
+static int serve(int lfd) {
+    struct pollfd fds[CONN_MAX + FIRST_CONN];
+    struct Conn *conns[CONN_MAX + FIRST_CONN], *conn;
+    unsigned long long count;
+    int n = FIRST_CONN, i, fd;
+
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+    while (1) {
+        for (i = FIRST_CONN; i < n; i++)
+            fds[i].events = (conns[i]->eof ? 0 : POLLIN)
+                    | (pending(conns[i]) ? POLLOUT : 0);
+        if (poll(fds, n, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+        if (fds[1].revents & POLLIN)
+            read(wake_fd, &count, sizeof(count));
+        /* 倒序遍历，删除时用最后一个(已经处理过)填补空位 */
+        for (i = n - 1; i >= FIRST_CONN; i--) {
+            conn = conns[i];
+            /* 对方关闭写端后不再读取，已有的提交继续评测并写回 */
+            if ((fds[i].revents & POLLIN) && readConn(conn))
+                conn->eof = 1;
+            if (fds[i].revents & POLLOUT)
+                flushConn(conn);
+            /* 对方已经完全关闭，结果无处可写 */
+            if (fds[i].revents & (POLLERR | POLLHUP))
+                __atomic_store_n(&conn->out.dead, 1, __ATOMIC_RELAXED);
+            if (!connDead(conn) && !connIdle(conn))
+                continue;
+            releaseConn(conn);
+            fds[i] = fds[n - 1];
+            conns[i] = conns[n - 1];
+            n--;
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1)
+            continue;
+        if (n == CONN_MAX + FIRST_CONN || !peerAllowed(fd)
+                || (conn = newConn(fd)) == NULL) {
+            close(fd);
+            continue;
+        }
+        fds[n].fd = fd;
+        fds[n].revents = 0;
+        conns[n++] = conn;
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s -s socket [-j workers] [-w contest:practice:"
+            "rejudge] [-p policy_file]... [-u uid]...\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    struct stat st;
+    pthread_t thread;
+    const char *path = NULL;
+    char err[256];
+    int opt, i, lfd, null_fd, workers, weights[CLASS_MAX] = {4, 2, 1};
+
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+    peers[npeers++] = geteuid();
+    while ((opt = getopt(argc, argv, "s:j:w:p:u:h")) != -1) {
+        switch (opt) {
+            case 's':
+                path = optarg;
+                break;
+            case 'j':
+                workers = atoi(optarg);
+                if (workers < 1 || workers > WORKERS_MAX)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d:%d:%d", &weights[0], &weights[1],
+                        &weights[2]) != 3)
+                    usage(argv[0]);
+                for (i = 0; i < CLASS_MAX; i++)
+                    if (weights[i] < 1 || weights[i] > STRIDE_ONE)
+                        usage(argv[0]);
+                break;
+            case 'p':
+                if (loadPolicies(optarg, err, sizeof(err)) == -1) {
+                    fprintf(stderr, "%s\n", err);
+                    return 1;
+                }
+                break;
+            case 'u':
+                if (npeers == PEERS_MAX || *optarg < '0' || *optarg > '9')
+                    usage(argv[0]);
+                peers[npeers++] = (uid_t) strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc || path == NULL
+            || strlen(path) >= sizeof(addr.sun_path))
+        usage(argv[0]);
+    if (workers < 1 || workers > WORKERS_MAX)
+        workers = 1;
+    for (i = 0; i < CLASS_MAX; i++)
+        stride[i] = STRIDE_ONE / weights[i];
+
+    /* 先占住没有打开的0、1、2，监听套接字和连接不能用这几个描述符 */
+    do
+        null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    while (null_fd != -1 && null_fd <= STDERR_FILENO);
+    if (null_fd == -1) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        perror("socket");
+        return 1;
+    }
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("eventfd");
+        return 1;
+    }
+    /* 上次遗留的套接字文件，路径上是其他文件时不能删除 */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s: exists and is not a socket\n", path);
+            return 1;
+        }
+        unlink(path);
+    }
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+            || listen(lfd, 128) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    for (i = 0; i < workers; i++)
+        if (pthread_create(&thread, NULL, worker, NULL)
+                || pthread_detach(thread)) {
+            fprintf(stderr, "pthread_create failure\n");
+            return 1;
+        }
+    /* 启动后不再使用标准输入输出，评测的程序也不会继承它们 */
+    for (i = STDIN_FILENO; i <= STDERR_FILENO; i++)
+        dup2(null_fd, i);
+    close(null_fd);
+    return serve(lfd);
+}
@@ -0,0 +1,150 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pack.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAISE_PACK(msg) {ctx->err = msg;return -1;}
+
+#define INPUT_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+/* 检查[off, off+len)在文件内，不会溢出 */
+static int inPack(const struct Pack *pack, uint64_t off, uint64_t len)
+{
+    return off <= pack->size && len <= pack->size - off;
+}
+
+/* 映射整个数据包并校验索引，之后的读取都不再进入内核 */
+int openPack(struct Pack *pack, const char *path, struct Runctx *ctx)
+{
+    const struct PackHeader *hdr;
+    const struct PackEntry *e;
+    struct stat st;
+    void *p;
+    uint32_t i;
+    int fd;
+
+    memset(pack, 0, sizeof(struct Pack));
+    /* O_NONBLOCK：路径是FIFO时open不会一直等待写端 */
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK)) == -1)
+        RAISE_PACK("open testset failure");
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        RAISE_PACK("testset is not a regular file");
+    }
+    if (st.st_size < (off_t) sizeof(*hdr)) {
+        close(fd);
+        RAISE_PACK("testset is truncated");
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        RAISE_PACK("mmap testset failure");
+    pack->base = (const char *) p;
+    pack->size = st.st_size;
+
+    hdr = (const struct PackHeader *) pack->base;
+    if (memcmp(hdr->magic, PACK_MAGIC, sizeof(hdr->magic))) {
+        closePack(pack);
+        RAISE_PACK("not a testset");
+    }
+    pack->n = le32toh(hdr->ncases);
+    if (!inPack(pack, sizeof(*hdr),
+            (uint64_t) pack->n * sizeof(struct PackEntry))) {
+        closePack(pack);
+        RAISE_PACK("testset is truncated");
+    }
+    if ((pack->cases = (struct PackCase *) calloc(pack->n ? pack->n : 1,
+            sizeof(struct PackCase))) == NULL) {
+        closePack(pack);
+        RAISE_PACK("malloc testset failure");
+    }
+
+    e = (const struct PackEntry *) (pack->base + sizeof(*hdr));
+    for (i = 0; i < pack->n; i++, e++) {
+        if (!inPack(pack, le64toh(e->in_off), le64toh(e->in_len))
+                || !inPack(pack, le64toh(e->ans_off), le64toh(e->ans_len))) {
+            closePack(pack);
+            RAISE_PACK("testset is truncated");
+        }
+        pack->cases[i].in = pack->base + le64toh(e->in_off);
+        pack->cases[i].in_len = le64toh(e->in_len);
+        pack->cases[i].ans = pack->base + le64toh(e->ans_off);
+        pack->cases[i].ans_len = le64toh(e->ans_len);
+        memcpy(pack->cases[i].name, e->name, PACK_NAME_MAX);
+    }
+    return 0;
+}
+
+void closePack(struct Pack *pack)
+{
+    if (pack->base)
+        munmap((void *) pack->base, pack->size);
+    free(pack->cases);
+    memset(pack, 0, sizeof(struct Pack));
+}
+
+/* 把data写入密封的memfd，子进程不能修改，也不需要临时文件。
+ * 失败时返回-1并保留errno */
+int sealedMemfd(const char *data, size_t len)
+{
+    ssize_t n;
+    int fd, err;
+
+    if ((fd = memfd_create("lorun-stdin", MFD_CLOEXEC | MFD_ALLOW_SEALING))
+            == -1)
+        return -1;
+    for (; len > 0; data += n, len -= n) {
+        if ((n = write(fd, data, len)) == -1) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            goto fail;
+        }
+    }
+    if (fcntl(fd, F_ADD_SEALS, INPUT_SEALS) == -1
+            || lseek(fd, 0, SEEK_SET) == -1)
+        goto fail;
+    return fd;
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+/* 第i个测试点的输入，返回可以作为标准输入的memfd，由调用者关闭 */
+int packInput(const struct Pack *pack, uint32_t i, struct Runctx *ctx)
+{
+    int fd;
+
+    if (i >= pack->n)
+        RAISE_PACK("case out of range");
+    if ((fd = sealedMemfd(pack->cases[i].in, pack->cases[i].in_len)) == -1)
+        RAISE_PACK("memfd input failure");
+    return fd;
+}
@@ -0,0 +1,65 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PACK_HEADER
+#define __LO_PACK_HEADER
+
+#include "core.h"
+#include <stdint.h>
+
+/* 测试数据包，由lorun/pack.py生成：
+ *   struct PackHeader
+ *   struct PackEntry[ncases]
+ *   各测试点的输入和答案，起始偏移按PACK_ALIGN对齐，可以直接mmap
+ * 整数均为小端 */
+#define PACK_MAGIC "LOPACK\0\1"
+#define PACK_ALIGN 4096
+#define PACK_NAME_MAX 32
+
+struct PackHeader {
+    char magic[8];
+    uint32_t ncases;
+    uint32_t align;
+};
+
+struct PackEntry {
+    uint64_t in_off, in_len;
+    uint64_t ans_off, ans_len;
+    char name[PACK_NAME_MAX];   //例如"1"，不足时补\0
+};
+
+/* 解析后的测试点，指针指向映射 */
+struct PackCase {
+    const char *in, *ans;
+    size_t in_len, ans_len;
+    char name[PACK_NAME_MAX + 1];
+};
+
+struct Pack {
+    const char *base;
+    size_t size;
+    uint32_t n;
+    struct PackCase *cases;
+};
+
+int openPack(struct Pack *pack, const char *path, struct Runctx *ctx);
+void closePack(struct Pack *pack);
+int sealedMemfd(const char *data, size_t len);
+int packInput(const struct Pack *pack, uint32_t i, struct Runctx *ctx);
+
+#endif
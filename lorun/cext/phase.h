@@ -0,0 +1,62 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PHASE_HEADER
+#define __LO_PHASE_HEADER
+
+#include "core.h"
+#include <time.h>
+
+/* 有sys/sdt.h时在每个阶段放置USDT探针lorun:<name>，未被跟踪时只是一条nop */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LORUN_PROBE(name) DTRACE_PROBE(lorun, name)
+#endif
+#endif
+#ifndef LORUN_PROBE
+#define LORUN_PROBE(name)
+#endif
+
+static inline unsigned long long monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 进入run/compile/special/check时调用，ctx在解析配置后才有 */
+static inline unsigned long long phaseStart(void) {
+    LORUN_PROBE(start);
+    return monotonicNs();
+}
+
+/* vfork的子进程中也可以使用：clock_gettime走vDSO，phases与父进程共享 */
+#define MARK_PHASE(phases, phase, name) do {\
+        if (phases)\
+            (phases)[phase] = monotonicNs();\
+        LORUN_PROBE(name);\
+    } while (0)
+
+/* ctx初始化后补记start并记录parsed */
+#define PARSED_PHASE(phases, start) do {\
+        if (phases)\
+            (phases)[PHASE_START] = start;\
+        MARK_PHASE(phases, PHASE_PARSED, parsed);\
+    } while (0)
+
+#endif
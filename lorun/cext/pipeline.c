@@ -0,0 +1,99 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipeline.h"
+#include "run.h"
+#include "limit.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+/* 管道容量，生成器一次可以写入这么多而不必等待被测程序读取 */
+#define PIPE_SIZE (1 << 20)
+
+#define RAISE_PIPE(msg) {ctx->err = msg;return -1;}
+
+struct Generator {
+    struct Runobj *runobj;
+    struct Runctx *ctx;
+    struct Result *rst;
+    int fd;     //管道写端，生成器结束后关闭，被测程序随后读到EOF
+    int ret;
+};
+
+/* 生成器在单独的线程中启动和回收：tree模式跟踪时本线程不能有其他子进程，
+ * 不能与被测程序由同一个线程创建 */
+static void *generatorThread(void *arg)
+{
+    struct Generator *g = (struct Generator *) arg;
+
+    g->ret = runit(g->runobj, g->ctx, g->rst);
+    close(g->fd);
+    return NULL;
+}
+
+/* gen的标准输出通过管道直接作为runobj的标准输入，数据不经过本进程，
+ * 只有runobj的资源占用计入rst。生成器被杀死或超出限制时返回-1，
+ * 被测程序提前结束导致生成器收到SIGPIPE不算失败 */
+int runPiped(struct Runobj *gen, struct Runctx *gen_ctx,
+        struct Result *gen_rst, struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst)
+{
+    struct Generator g;
+    pthread_t thread;
+    int fds[2], ret;
+
+    if (pipe2(fds, O_CLOEXEC))
+        RAISE_PIPE("pipe: pipe2 failure");
+    /* 默认64KB的管道会让两个进程频繁切换，失败时保持默认大小 */
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    gen->fd_out = fds[1];
+    g.runobj = gen;
+    g.ctx = gen_ctx;
+    g.rst = gen_rst;
+    g.fd = fds[1];
+    g.ret = -1;
+    if (pthread_create(&thread, NULL, generatorThread, &g)) {
+        close(fds[0]);
+        close(fds[1]);
+        RAISE_PIPE("pipe: create generator thread failure");
+    }
+
+    /* 被测程序可能一直在等生成器的输出，墙钟计时器放宽生成器的限制；
+     * CPU时间仍由RLIMIT_CPU和ITIMER_PROF限制 */
+    runobj->fd_in = fds[0];
+    runobj->real_slack = realTimerMs(gen);
+    ret = runit(runobj, ctx, rst);
+    runobj->real_slack = 0;
+    /* 被测程序已经结束，之后生成器写入时收到SIGPIPE */
+    close(fds[0]);
+    pthread_join(thread, NULL);
+
+    if (ret)
+        return -1;
+    if (g.ret) {
+        ctx->err = gen_ctx->err;
+        return -1;
+    }
+    if (gen_rst->judge_result != AC && !(gen_rst->judge_result == RE
+            && gen_rst->re_signum == SIGPIPE))
+        RAISE_PIPE("pipe: generator did not finish normally");
+    return 0;
+}
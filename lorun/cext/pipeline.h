@@ -0,0 +1,28 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PIPELINE_HEADER
+#define __LO_PIPELINE_HEADER
+
+#include "core.h"
+
+int runPiped(struct Runobj *gen, struct Runctx *gen_ctx,
+        struct Result *gen_rst, struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst);
+
+#endif
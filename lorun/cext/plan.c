@@ -0,0 +1,208 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "plan.h"
+#include "run.h"
+#include "diff.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#define WORKERS_MAX 256
+
+/* 调用者持有锁。k失败后取消已不能影响结果的测试点 */
+static void cancelAfter(struct Plan *plan, int k) {
+    struct PlanGroup *g = &plan->groups[plan->cases[k].group];
+    struct PlanCase *c;
+    int i;
+
+    if (g->policy == PLAN_ALL)
+        return;
+    /* ACM只取消顺序在后面的，前面的仍可能先失败 */
+    i = g->policy == PLAN_FIRST ? k + 1 : g->first;
+    for (; i < g->first + g->n; i++) {
+        c = &plan->cases[i];
+        if (c->state == CASE_PENDING)
+            c->state = CASE_SKIPPED;
+        else if (c->state == CASE_RUNNING) {
+            c->state = CASE_CANCELLED;
+            if (c->pidfd != -1)
+                signalPidfd(c->pidfd, SIGKILL);
+        }
+    }
+}
+
+/* 运行并比较一个测试点，不持有锁 */
+static void runCase(struct Plan *plan, struct Runctx *ctx, int k) {
+    struct Runobj runobj = *plan->runobj;
+    struct PlanCase *c = &plan->cases[k];
+    struct Result *rst = &c->rst;
+    pid_t pid;
+    int pidfd, ret;
+
+    runobj.fd_in = c->fd_in;
+    runobj.fd_out = c->fd_out;
+    memset(rst, 0, sizeof(struct Result));
+    rst->re_call = -1;
+
+    ret = spawnRun(&runobj, ctx, &pid);
+    if (ret == 0) {
+        /* 登记pidfd后其他线程才能取消它；登记前已被取消则直接杀死。
+         * 没有pidfd(早于5.3的内核)时不能安全地取消运行中的测试点 */
+        pidfd = openPidfd(pid);
+        pthread_mutex_lock(&plan->lock);
+        c->pidfd = pidfd;
+        if (c->state == CASE_CANCELLED) {
+            if (pidfd != -1)
+                signalPidfd(pidfd, SIGKILL);
+            else
+                kill(pid, SIGKILL);
+        }
+        pthread_mutex_unlock(&plan->lock);
+
+        ret = waitRun(&runobj, ctx, rst, pid);
+
+        pthread_mutex_lock(&plan->lock);
+        c->pidfd = -1;
+        pthread_mutex_unlock(&plan->lock);
+        if (pidfd != -1)
+            close(pidfd);
+    }
+    if (ret == 0 && rst->judge_result == AC && c->fd_answer != -1)
+        ret = checkDiff(c->fd_answer, c->fd_out, &rst->judge_result, ctx);
+
+    if (ret == -1) {
+        rst->judge_result = SE;
+        strncpy(c->err, ctx->err, RUN_ERR_MAX - 1);
+    }
+    /* re_file指向本线程的ctx->path，下一次运行会覆盖 */
+    if (rst->re_file && (rst->re_file = strdup(rst->re_file)) == NULL)
+        rst->re_file = "";
+    rst->stats = NULL;
+    rst->samples = NULL;
+    rst->nsamples = 0;
+}
+
+static void *planWorker(void *arg) {
+    struct Plan *plan = (struct Plan *) arg;
+    struct Runctx ctx;
+    int k, ok;
+
+    /* 失败时仍然领取测试点，记为SE，避免它们一直处于等待状态 */
+    ok = initRunctx(&ctx, plan->runobj) == 0;
+    pthread_mutex_lock(&plan->lock);
+    while (plan->next < plan->ncases) {
+        k = plan->next++;
+        if (plan->cases[k].state != CASE_PENDING)
+            continue;
+        plan->cases[k].state = CASE_RUNNING;
+        pthread_mutex_unlock(&plan->lock);
+
+        if (ok)
+            runCase(plan, &ctx, k);
+        else {
+            plan->cases[k].rst.judge_result = SE;
+            strncpy(plan->cases[k].err, ctx.err, RUN_ERR_MAX - 1);
+        }
+
+        pthread_mutex_lock(&plan->lock);
+        if (plan->cases[k].state == CASE_RUNNING) {
+            plan->cases[k].state = CASE_DONE;
+            if (plan->cases[k].rst.judge_result != AC)
+                cancelAfter(plan, k);
+        }
+    }
+    pthread_mutex_unlock(&plan->lock);
+    freeRunctx(&ctx);
+    return NULL;
+}
+
+/* 按顺序取第一个失败的测试点作为子任务的结果 */
+static void judgeGroups(struct Plan *plan) {
+    struct PlanGroup *g;
+    struct PlanCase *c;
+    int i, j;
+
+    for (i = 0; i < plan->ngroups; i++) {
+        g = &plan->groups[i];
+        g->verdict = AC;
+        g->failed = -1;
+        g->passed = 0;
+        for (j = g->first; j < g->first + g->n; j++) {
+            c = &plan->cases[j];
+            if (c->state != CASE_DONE)
+                continue;
+            if (c->rst.judge_result == AC)
+                g->passed++;
+            else if (g->failed == -1) {
+                g->verdict = c->rst.judge_result;
+                g->failed = j;
+            }
+        }
+    }
+}
+
+/* 调用者填好runobj、cases(fd_in, fd_out, fd_answer, group)和groups，
+ * 测试点按子任务顺序连续存放。不调用Python API，可以释放GIL */
+int runPlan(struct Plan *plan) {
+    pthread_t threads[WORKERS_MAX];
+    int i, n;
+
+    for (i = 0; i < plan->ncases; i++) {
+        plan->cases[i].state = CASE_PENDING;
+        plan->cases[i].pidfd = -1;
+        plan->cases[i].err[0] = 0;
+        memset(&plan->cases[i].rst, 0, sizeof(struct Result));
+    }
+    plan->next = 0;
+    n = plan->workers;
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > plan->ncases)
+        n = plan->ncases;
+    if (n > WORKERS_MAX)
+        n = WORKERS_MAX;
+    if (pthread_mutex_init(&plan->lock, NULL))
+        return -1;
+
+    /* 创建线程失败时由已有的线程(或当前线程)完成剩余的测试点 */
+    for (i = 0; i < n; i++)
+        if (pthread_create(&threads[i], NULL, planWorker, plan))
+            break;
+    if (i == 0)
+        planWorker(plan);
+    n = i;
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&plan->lock);
+    judgeGroups(plan);
+    return 0;
+}
+
+/* 释放runPlan复制的re_file，cases和groups由调用者释放 */
+void freePlan(struct Plan *plan) {
+    int i;
+
+    for (i = 0; i < plan->ncases; i++) {
+        if (plan->cases[i].rst.re_file && plan->cases[i].rst.re_file[0])
+            free((char *) plan->cases[i].rst.re_file);
+        plan->cases[i].rst.re_file = NULL;
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PLAN_HEADER
+#define __LO_PLAN_HEADER
+
+#include "core.h"
+#include <pthread.h>
+
+/* 子任务中有测试点失败时的处理方式 */
+enum PLAN_POLICY {
+    PLAN_ALL = 0,   //全部运行，按测试点计分
+    PLAN_GROUP,     //OI子任务：任一测试点失败则整组无分，取消组内其余测试点
+    PLAN_FIRST,     //ACM：按顺序第一个失败的测试点决定结果，取消它之后的测试点
+};
+
+enum CASE_STATE {
+    CASE_PENDING = 0,   //等待运行
+    CASE_RUNNING,       //正在运行
+    CASE_DONE,          //已完成，rst有效
+    CASE_CANCELLED,     //运行中被杀死
+    CASE_SKIPPED,       //没有开始就被取消
+};
+
+struct PlanCase {
+    int fd_in, fd_out, fd_answer;   //fd_answer为-1时不比较
+    int group;
+    int state;                      //CASE_STATE
+    int pidfd;                      //运行中时用于取消，否则为-1
+    struct Result rst;              //re_file由freePlan释放
+    char err[RUN_ERR_MAX];          //结果为SE时的错误信息
+};
+
+struct PlanGroup {
+    int policy;     //PLAN_POLICY
+    int first, n;   //组内测试点在cases中的范围
+    int verdict;    //按顺序第一个失败测试点的结果，没有失败时为AC
+    int failed;     //决定verdict的测试点下标，没有时为-1
+    int passed;     //通过的测试点数
+};
+
+/* 一个测试计划：测试点按子任务连续存放，多个线程并行运行 */
+struct Plan {
+    struct Runobj *runobj;
+    struct PlanCase *cases;
+    int ncases;
+    struct PlanGroup *groups;
+    int ngroups;
+    int workers;
+
+    pthread_mutex_t lock;
+    int next;       //下一个待领取的测试点
+};
+
+int runPlan(struct Plan *plan);
+void freePlan(struct Plan *plan);
+
+#endif
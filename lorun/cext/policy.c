@@ -0,0 +1,516 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 系统调用策略文件格式，每行一条指令，#开头为注释:
+ *
+ *   [c]                        开始一个名为c的策略
+ *   include c                  复制已定义的策略c
+ *   allow read write 60        允许的调用，可以是名称或调用号
+ *   deny clone                 禁止的调用
+ *   enosys clone3              不执行，返回ENOSYS(libc会改用clone)
+ *   arg clone 0 mask 0x7e020000   参数0与掩码按位与必须为0
+ *   arg socket 0 eq 1          参数0必须等于给定值之一
+ *   file /etc/ld.so.cache ro   open/openat允许的文件，以*结尾按前缀匹配，
+ *                              flags为数字(完全相等)、ro(只读)或*(任意)
+ */
+
+#include "policy.h"
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define POLICY_MAX 64
+#define LINE_MAX_LEN 1024
+#define TOKENS_MAX (RULE_VALUES_MAX + 4)
+
+#define SC(x) {#x, SYS_##x}
+static const struct {
+    const char *name;
+    int nr;
+} syscall_names[] = {
+    SC(read), SC(write), SC(close), SC(fstat), SC(lseek), SC(mmap),
+    SC(mprotect), SC(munmap), SC(brk), SC(rt_sigaction),
+    SC(rt_sigprocmask), SC(rt_sigreturn), SC(ioctl), SC(pread64),
+    SC(pwrite64), SC(readv), SC(writev), SC(sched_yield), SC(mremap),
+    SC(msync), SC(mincore), SC(madvise), SC(dup), SC(dup3),
+    SC(nanosleep), SC(getpid), SC(clone), SC(execve), SC(exit), SC(wait4),
+    SC(kill), SC(uname), SC(fcntl), SC(flock), SC(fsync), SC(ftruncate),
+    SC(getcwd), SC(chdir), SC(rename), SC(mkdir), SC(rmdir), SC(link),
+    SC(unlink), SC(chmod), SC(fchmod), SC(chown), SC(umask),
+    SC(gettimeofday), SC(getrlimit), SC(getrusage), SC(sysinfo), SC(times),
+    SC(ptrace), SC(getuid), SC(getgid), SC(setuid), SC(setgid),
+    SC(geteuid), SC(getegid), SC(getppid), SC(getpgrp), SC(setsid),
+    SC(sigaltstack), SC(prctl), SC(setrlimit), SC(gettid), SC(futex),
+    SC(sched_getaffinity), SC(sched_setaffinity), SC(set_tid_address),
+    SC(getdents64), SC(clock_gettime), SC(clock_getres),
+    SC(clock_nanosleep), SC(exit_group), SC(tgkill), SC(openat),
+    SC(mkdirat), SC(newfstatat), SC(unlinkat), SC(readlinkat),
+    SC(faccessat), SC(set_robust_list), SC(get_robust_list), SC(pipe2),
+    SC(prlimit64), SC(getrandom), SC(memfd_create), SC(statx),
+    SC(socket), SC(connect), SC(accept), SC(sendto), SC(recvfrom),
+    SC(bind), SC(listen), SC(socketpair), SC(execveat),
+    SC(sched_getparam), SC(sched_getscheduler),
+    SC(sched_get_priority_max), SC(sched_get_priority_min),
+    SC(epoll_create1), SC(epoll_ctl), SC(eventfd2), SC(ppoll),
+    SC(pselect6), SC(getpgid), SC(setpgid), SC(mlock), SC(munlock),
+    SC(membarrier), SC(waitid), SC(restart_syscall),
+#ifdef SYS_open
+    SC(open), SC(stat), SC(lstat), SC(access), SC(pipe), SC(getdents),
+    SC(arch_prctl), SC(time), SC(creat), SC(epoll_wait), SC(readlink),
+    SC(epoll_create), SC(eventfd), SC(alarm), SC(pause), SC(dup2),
+    SC(poll), SC(select), SC(fork), SC(vfork),
+#endif
+#ifdef SYS_rseq
+    SC(rseq),
+#endif
+#ifdef SYS_clone3
+    SC(clone3),
+#endif
+#ifdef SYS_openat2
+    SC(openat2),
+#endif
+#ifdef SYS_faccessat2
+    SC(faccessat2),
+#endif
+    {NULL, 0}
+};
+
+/* 注册表在所有解释器和线程间共享，由registry_lock保护 */
+static struct Policy *registry[POLICY_MAX];
+static int nregistry;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct Policy *newPolicy(const char *name) {
+    struct Policy *policy;
+
+    if ((policy = (struct Policy *) calloc(1, sizeof(struct Policy))) == NULL)
+        return NULL;
+    if (name)
+        snprintf(policy->name, POLICY_NAME_MAX, "%s", name);
+    policy->refcnt = 1;
+    return policy;
+}
+
+/* 引用计数可能在释放了GIL的线程中修改 */
+void retainPolicy(struct Policy *policy) {
+    __atomic_add_fetch(&policy->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+void releasePolicy(struct Policy *policy) {
+    int i;
+
+    if (policy == NULL
+            || __atomic_sub_fetch(&policy->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    for (i = 0; i < policy->nfiles; i++)
+        free(policy->files[i].path);
+    for (i = 0; i < policy->nprefixes; i++)
+        free(policy->prefixes[i].path);
+    free(policy->files);
+    free(policy->prefixes);
+    free(policy->rules);
+    free(policy);
+}
+
+int policyAddFile(struct Policy *policy, const char *path, int prefix,
+        int flag_type, long flags) {
+    struct PolicyFile **list, *t, *f;
+    int *n;
+
+    if (prefix) {
+        list = &policy->prefixes;
+        n = &policy->nprefixes;
+    }
+    else {
+        list = &policy->files;
+        n = &policy->nfiles;
+    }
+
+    if ((t = (struct PolicyFile *) realloc(*list,
+            sizeof(struct PolicyFile) * (*n + 1))) == NULL)
+        return -1;
+    *list = t;
+
+    f = &t[*n];
+    if ((f->path = strdup(path)) == NULL)
+        return -1;
+    f->prefix = prefix;
+    f->flag_type = flag_type;
+    f->flags = flags;
+    (*n)++;
+    return 0;
+}
+
+static int addRule(struct Policy *policy, const struct PolicyRule *rule) {
+    struct PolicyRule *t;
+
+    if ((t = (struct PolicyRule *) realloc(policy->rules,
+            sizeof(struct PolicyRule) * (policy->nrules + 1))) == NULL)
+        return -1;
+    policy->rules = t;
+    policy->rules[policy->nrules++] = *rule;
+    policy->table[rule->call] |= CALL_ARGS;
+    return 0;
+}
+
+static int cmpFile(const void *a, const void *b) {
+    return strcmp(((const struct PolicyFile *) a)->path,
+            ((const struct PolicyFile *) b)->path);
+}
+
+/* 编译结束，对精确匹配的文件排序以便二分查找 */
+void policyFinish(struct Policy *policy) {
+    if (policy->nfiles > 1)
+        qsort(policy->files, policy->nfiles, sizeof(struct PolicyFile),
+                cmpFile);
+}
+
+int policyCheckArgs(const struct Policy *policy, long call,
+        const long args[6]) {
+    int i, j, ok;
+    const struct PolicyRule *rule;
+
+    for (i = 0; i < policy->nrules; i++) {
+        rule = &policy->rules[i];
+        if (rule->call != call)
+            continue;
+
+        if (rule->type == RULE_MASK) {
+            if (args[rule->arg] & rule->values[0])
+                return 0;
+        }
+        else {
+            ok = 0;
+            for (j = 0; j < rule->nvalues; j++) {
+                if (args[rule->arg] == rule->values[j]) {
+                    ok = 1;
+                    break;
+                }
+            }
+            if (!ok)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int flagsMatch(const struct PolicyFile *f, long flags) {
+    switch (f->flag_type) {
+        case FILE_FLAG_ANY:
+            return 1;
+        case FILE_FLAG_RO:
+            return (flags & O_ACCMODE) == O_RDONLY
+                    && !(flags & (O_CREAT | O_TRUNC | O_APPEND));
+        default:
+            return f->flags == flags;
+    }
+}
+
+int policyCheckFile(const struct Policy *policy, const char *path,
+        long flags) {
+    int lo = 0, hi = policy->nfiles - 1, mid, i, c;
+
+    /* 同一路径可能有多条记录，找到后向两边扫描 */
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = strcmp(path, policy->files[mid].path);
+        if (c == 0) {
+            for (i = mid; i >= 0 && !strcmp(path, policy->files[i].path); i--)
+                if (flagsMatch(&policy->files[i], flags))
+                    return 1;
+            for (i = mid + 1; i < policy->nfiles
+                    && !strcmp(path, policy->files[i].path); i++)
+                if (flagsMatch(&policy->files[i], flags))
+                    return 1;
+            break;
+        }
+        if (c < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+
+    /* 前缀匹配时不允许用..跳出目录 */
+    if (strstr(path, "/../") || (strlen(path) >= 3
+                && !strcmp(path + strlen(path) - 3, "/..")))
+        return 0;
+    for (i = 0; i < policy->nprefixes; i++) {
+        if (!strncmp(path, policy->prefixes[i].path,
+                    strlen(policy->prefixes[i].path))
+                && flagsMatch(&policy->prefixes[i], flags))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* 返回的策略已增加引用计数，用完后releasePolicy */
+struct Policy *findPolicy(const char *name) {
+    struct Policy *policy = NULL;
+    int i;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < nregistry; i++) {
+        if (!strcmp(registry[i]->name, name)) {
+            policy = registry[i];
+            retainPolicy(policy);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return policy;
+}
+
+/* 注册策略，同名的旧策略由正在使用它的运行继续持有 */
+static int registerPolicy(struct Policy *policy) {
+    struct Policy *old = NULL;
+    int i, ret = 0;
+
+    pthread_mutex_lock(&registry_lock);
+    for (i = 0; i < nregistry; i++) {
+        if (!strcmp(registry[i]->name, policy->name)) {
+            old = registry[i];
+            registry[i] = policy;
+            break;
+        }
+    }
+    if (i == nregistry) {
+        if (nregistry < POLICY_MAX)
+            registry[nregistry++] = policy;
+        else
+            ret = -1;
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    releasePolicy(old);
+    return ret;
+}
+
+static int syscallNumber(const char *name) {
+    char *end;
+    long nr;
+    int i;
+
+    nr = strtol(name, &end, 0);
+    if (*name && *end == 0)
+        return (nr >= 0 && nr < CALLS_MAX) ? (int) nr : -1;
+
+    for (i = 0; syscall_names[i].name; i++)
+        if (!strcmp(syscall_names[i].name, name))
+            return syscall_names[i].nr < CALLS_MAX ? syscall_names[i].nr : -1;
+    return -1;
+}
+
+static int parseLong(const char *s, long *v) {
+    char *end;
+
+    errno = 0;
+    *v = strtol(s, &end, 0);
+    return (*s == 0 || *end != 0 || errno) ? -1 : 0;
+}
+
+static struct Policy *copyPolicy(const struct Policy *src, const char *name) {
+    struct Policy *policy;
+    int i;
+
+    if ((policy = newPolicy(name)) == NULL)
+        return NULL;
+    memcpy(policy->table, src->table, sizeof(policy->table));
+    for (i = 0; i < src->nrules; i++)
+        if (addRule(policy, &src->rules[i]))
+            goto fail;
+    for (i = 0; i < src->nfiles; i++)
+        if (policyAddFile(policy, src->files[i].path, 0,
+                src->files[i].flag_type, src->files[i].flags))
+            goto fail;
+    for (i = 0; i < src->nprefixes; i++)
+        if (policyAddFile(policy, src->prefixes[i].path, 1,
+                src->prefixes[i].flag_type, src->prefixes[i].flags))
+            goto fail;
+    return policy;
+
+fail:
+    releasePolicy(policy);
+    return NULL;
+}
+
+/* 结束当前策略：open/openat需要检查路径，然后注册 */
+static int finishCurrent(struct Policy *policy) {
+#ifdef SYS_open
+    if (policy->table[SYS_open] & CALL_ALLOW)
+        policy->table[SYS_open] |= CALL_PATH;
+#endif
+    if (policy->table[SYS_openat] & CALL_ALLOW)
+        policy->table[SYS_openat] |= CALL_PATH;
+    policyFinish(policy);
+    return registerPolicy(policy);
+}
+
+#define PARSE_ERR(msg) {\
+            snprintf(err, errlen, "%s:%d: %s", path, lineno, msg);\
+            goto fail;\
+        }
+
+/* 读取策略文件并注册其中的所有策略，返回策略个数，失败返回-1 */
+int loadPolicies(const char *path, char *err, size_t errlen) {
+    FILE *fp;
+    char line[LINE_MAX_LEN], *tok[TOKENS_MAX], *p, *save;
+    struct Policy *cur = NULL, *src;
+    struct PolicyRule rule;
+    int lineno = 0, ntok, i, nr, count = 0;
+    long v;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        if ((p = strchr(line, '#')) != NULL)
+            *p = 0;
+
+        ntok = 0;
+        for (p = strtok_r(line, " \t\r\n", &save); p;
+                p = strtok_r(NULL, " \t\r\n", &save)) {
+            if (ntok >= TOKENS_MAX)
+                PARSE_ERR("too many tokens");
+            tok[ntok++] = p;
+        }
+        if (ntok == 0)
+            continue;
+
+        if (tok[0][0] == '[') {
+            size_t len = strlen(tok[0]);
+            if (ntok != 1 || len < 3 || tok[0][len - 1] != ']'
+                    || len - 2 >= POLICY_NAME_MAX)
+                PARSE_ERR("bad profile header");
+            if (cur) {
+                if (finishCurrent(cur)) {
+                    releasePolicy(cur);
+                    cur = NULL;
+                    PARSE_ERR("too many profiles");
+                }
+                count++;
+            }
+            tok[0][len - 1] = 0;
+            if ((cur = newPolicy(tok[0] + 1)) == NULL)
+                PARSE_ERR("out of memory");
+            continue;
+        }
+
+        if (cur == NULL)
+            PARSE_ERR("directive outside of a profile");
+
+        if (!strcmp(tok[0], "include")) {
+            struct Policy *copy;
+
+            /* include只能作为第一条指令 */
+            if (cur->nrules || cur->nfiles || cur->nprefixes)
+                PARSE_ERR("include must come first");
+            if (ntok != 2 || (src = findPolicy(tok[1])) == NULL)
+                PARSE_ERR("include of unknown profile");
+            copy = copyPolicy(src, cur->name);
+            releasePolicy(src);
+            if (copy == NULL)
+                PARSE_ERR("out of memory");
+            releasePolicy(cur);
+            cur = copy;
+        }
+        else if (!strcmp(tok[0], "allow") || !strcmp(tok[0], "deny")
+                || !strcmp(tok[0], "enosys")) {
+            for (i = 1; i < ntok; i++) {
+                if ((nr = syscallNumber(tok[i])) < 0)
+                    PARSE_ERR("unknown system call");
+                if (tok[0][0] == 'a')
+                    cur->table[nr] |= CALL_ALLOW;
+                else if (tok[0][0] == 'e')
+                    cur->table[nr] = CALL_ENOSYS;
+                else
+                    cur->table[nr] = 0;
+            }
+        }
+        else if (!strcmp(tok[0], "arg")) {
+            if (ntok < 5)
+                PARSE_ERR("usage: arg CALL N eq|mask VALUE...");
+            memset(&rule, 0, sizeof(rule));
+            if ((rule.call = syscallNumber(tok[1])) < 0)
+                PARSE_ERR("unknown system call");
+            if (parseLong(tok[2], &v) || v < 0 || v > 5)
+                PARSE_ERR("argument index must be 0-5");
+            rule.arg = (int) v;
+            if (!strcmp(tok[3], "mask") && ntok == 5)
+                rule.type = RULE_MASK;
+            else if (!strcmp(tok[3], "eq"))
+                rule.type = RULE_EQ;
+            else
+                PARSE_ERR("bad argument rule");
+            for (i = 4; i < ntok; i++) {
+                if (parseLong(tok[i], &rule.values[rule.nvalues++]))
+                    PARSE_ERR("bad argument value");
+            }
+            if (addRule(cur, &rule))
+                PARSE_ERR("out of memory");
+        }
+        else if (!strcmp(tok[0], "file")) {
+            int type = FILE_FLAG_EQ, prefix = 0;
+            size_t len;
+            v = 0;
+            if (ntok != 3)
+                PARSE_ERR("usage: file PATH FLAGS");
+            len = strlen(tok[1]);
+            if (tok[1][len - 1] == '*') {
+                tok[1][len - 1] = 0;
+                prefix = 1;
+            }
+            if (!strcmp(tok[2], "*"))
+                type = FILE_FLAG_ANY;
+            else if (!strcmp(tok[2], "ro"))
+                type = FILE_FLAG_RO;
+            else if (parseLong(tok[2], &v))
+                PARSE_ERR("bad file flags");
+            if (policyAddFile(cur, tok[1], prefix, type, v))
+                PARSE_ERR("out of memory");
+        }
+        else
+            PARSE_ERR("unknown directive");
+    }
+
+    fclose(fp);
+    if (cur) {
+        if (finishCurrent(cur)) {
+            releasePolicy(cur);
+            snprintf(err, errlen, "%s: too many profiles", path);
+            return -1;
+        }
+        count++;
+    }
+    return count;
+
+fail:
+    fclose(fp);
+    releasePolicy(cur);
+    return -1;
+}
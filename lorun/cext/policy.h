@@ -0,0 +1,85 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_POLICY_HEADER
+#define __LO_POLICY_HEADER
+
+#include "core.h"
+
+#define POLICY_NAME_MAX 32
+#define RULE_VALUES_MAX 8
+
+/* table中每个调用号的标志位 */
+#define CALL_ALLOW 1    //允许调用
+#define CALL_ARGS 2     //需要检查参数规则
+#define CALL_PATH 4     //需要检查路径白名单(open/openat)
+#define CALL_ENOSYS 8   //跳过调用并返回-ENOSYS，让libc退回到旧的调用
+
+enum RULE_TYPE {
+    RULE_EQ = 0,    //参数必须等于values之一
+    RULE_MASK,      //参数与values[0]按位与必须为0
+};
+
+struct PolicyRule {
+    int call, arg, type;
+    int nvalues;
+    long values[RULE_VALUES_MAX];
+};
+
+enum FILE_FLAG_TYPE {
+    FILE_FLAG_EQ = 0,   //open的flags必须完全相等
+    FILE_FLAG_ANY,      //任意flags
+    FILE_FLAG_RO,       //只读打开，不允许O_CREAT/O_TRUNC
+};
+
+struct PolicyFile {
+    char *path;
+    int prefix;         //按前缀匹配(策略文件中path以*结尾)
+    int flag_type;
+    long flags;
+};
+
+struct Policy {
+    char name[POLICY_NAME_MAX];
+    int refcnt;
+    u_char table[CALLS_MAX];
+
+    struct PolicyRule *rules;
+    int nrules;
+    struct PolicyFile *files;   //精确匹配部分按path排序
+    int nfiles;
+    struct PolicyFile *prefixes;
+    int nprefixes;
+};
+
+struct Policy *newPolicy(const char *name);
+void retainPolicy(struct Policy *policy);
+void releasePolicy(struct Policy *policy);
+
+int policyAddFile(struct Policy *policy, const char *path, int prefix,
+        int flag_type, long flags);
+void policyFinish(struct Policy *policy);
+int policyCheckArgs(const struct Policy *policy, long call,
+        const long args[6]);
+int policyCheckFile(const struct Policy *policy, const char *path,
+        long flags);
+
+int loadPolicies(const char *path, char *err, size_t errlen);
+struct Policy *findPolicy(const char *name);
+
+#endif
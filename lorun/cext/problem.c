@@ -0,0 +1,481 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "problem.h"
+#include "config.h"
+#include "convert.h"
+#include "testset.h"
+#include "result.h"
+#include "diff.h"
+#include "run.h"
+#include "special.h"
+#include <structmember.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RAISE_PROBLEM(msg) {ctx->err = msg;return -1;}
+
+/* 把输入读入memfd，映射答案并预先去掉其中的空白。不调用Python API */
+static int loadCase(struct ProblemCase *c, struct Runctx *ctx)
+{
+    const char *data;
+    size_t len;
+    int fd, ret;
+
+    if ((fd = open(c->input, O_RDONLY | O_CLOEXEC)) == -1)
+        RAISE_PROBLEM("open input failure");
+    ret = mapOutput(fd, &data, &len, ctx);
+    close(fd);
+    if (ret)
+        return -1;
+    c->in_fd = sealedMemfd(data, len);
+    unmapOutput(data, len);
+    if (c->in_fd == -1)
+        RAISE_PROBLEM("memfd input failure");
+
+    if ((fd = open(c->answer, O_RDONLY | O_CLOEXEC)) == -1)
+        RAISE_PROBLEM("open answer failure");
+    ret = mapOutput(fd, &c->ans, &c->ans_len, ctx);
+    close(fd);
+    if (ret)
+        return -1;
+    if ((c->norm = (char *) malloc(c->ans_len ? c->ans_len : 1)) == NULL)
+        RAISE_PROBLEM("malloc answer failure");
+    c->norm_len = normalizeOutput(c->ans, c->ans_len, c->norm);
+    return 0;
+}
+
+static void freeCases(struct ProblemCase *cases, Py_ssize_t n)
+{
+    Py_ssize_t i;
+
+    if (cases == NULL)
+        return;
+    for (i = 0; i < n; i++) {
+        if (cases[i].in_fd != -1)
+            close(cases[i].in_fd);
+        if (cases[i].answer)
+            unmapOutput(cases[i].ans, cases[i].ans_len);
+        free(cases[i].norm);
+        free(cases[i].input);
+        free(cases[i].answer);
+    }
+    free(cases);
+}
+
+/* dict解析为RunConfig，RunConfig直接使用。程序由judge给出，cfg可以没有args */
+static PyObject *toRunConfig(PyObject *cfg, int need_args)
+{
+    PyObject *r;
+
+    if (PyObject_TypeCheck(cfg, &RunConfigType)) {
+        Py_INCREF(cfg);
+        return cfg;
+    }
+    if (!PyDict_Check(cfg))
+        RAISE0("config must be a dict or RunConfig");
+    if (need_args || PyDict_GetItemString(cfg, "args"))
+        return PyObject_CallFunctionObjArgs((PyObject *) &RunConfigType, cfg,
+                NULL);
+
+    if ((cfg = PyDict_Copy(cfg)) == NULL)
+        return NULL;
+    if ((r = PyList_New(0)) == NULL || PyDict_SetItemString(cfg, "args", r)) {
+        Py_XDECREF(r);
+        Py_DECREF(cfg);
+        return NULL;
+    }
+    Py_DECREF(r);
+    r = PyObject_CallFunctionObjArgs((PyObject *) &RunConfigType, cfg, NULL);
+    Py_DECREF(cfg);
+    return r;
+}
+
+/* checker的路径只解析一次，每次评测不再搜索PATH */
+static int resolveChecker(RunConfigObject *checker)
+{
+    char **args = (char **) checker->runobj.args, *path;
+
+    if (args == NULL || args[0] == NULL)
+        RAISE1("checker must supply args");
+    if (strchr(args[0], '/') == NULL)
+        return 0;
+    if ((path = realpath(args[0], NULL)) == NULL || access(path, X_OK)) {
+        free(path);
+        RAISE1("checker is not executable");
+    }
+    free(args[0]);
+    args[0] = path;
+    return 0;
+}
+
+/* 释放Testset和它导出的缓冲区，只在Problem释放时调用 */
+static void releaseTestset(ProblemObject *self)
+{
+    if (self->pack_view.obj)
+        PyBuffer_Release(&self->pack_view);
+    Py_CLEAR(self->testset);
+}
+
+/* 输入复制到memfd，答案直接使用数据包中的映射。
+ * 持有Testset导出的缓冲区，使映射在Problem存活期间不被重新打开换掉 */
+static int loadTestset(ProblemObject *self, TestsetObject *ts)
+{
+    struct Runctx ctx = {0};
+    const struct PackCase *pc;
+    struct ProblemCase *c;
+    uint32_t i;
+    int ret = 0;
+
+    if (self->checker)
+        RAISE1("a checker needs cases from files");
+    if (PyObject_GetBuffer((PyObject *) ts, &self->pack_view, PyBUF_SIMPLE))
+        return -1;
+    if ((self->cases = (struct ProblemCase *) calloc(ts->pack.n ? ts->pack.n
+            : 1, sizeof(struct ProblemCase))) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    Py_INCREF(ts);
+    self->testset = (PyObject *) ts;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < ts->pack.n && ret == 0; i++) {
+        pc = &ts->pack.cases[i];
+        c = &self->cases[i];
+        self->n = i + 1;
+        c->ans = pc->ans;
+        c->ans_len = pc->ans_len;
+        if ((c->in_fd = packInput(&ts->pack, i, &ctx)) == -1
+                || (c->norm = (char *) malloc(c->ans_len ? c->ans_len : 1))
+                == NULL) {
+            ctx.err = ctx.err ? ctx.err : "malloc answer failure";
+            ret = -1;
+            break;
+        }
+        c->norm_len = normalizeOutput(c->ans, c->ans_len, c->norm);
+    }
+    Py_END_ALLOW_THREADS
+    if (ret)
+        RAISE1(ctx.err);
+    return 0;
+}
+
+/* Problem(cfg, cases[, checker])，cases为[(input, answer), ...]或Testset。
+ * 只能初始化一次：judge在释放GIL后使用cases，再次初始化会释放它们 */
+static int Problem_init(ProblemObject *self, PyObject *args, PyObject *kwds)
+{
+    struct Runctx ctx = {0};
+    PyObject *cfg, *cases, *checker = NULL, *item;
+    const char *input, *answer;
+    Py_ssize_t n, i;
+    int ret = 0;
+
+    if (!PyArg_ParseTuple(args, "OO|O", &cfg, &cases, &checker))
+        return -1;
+    if (self->config)
+        RAISE1("Problem is already initialized");
+
+    if ((self->config = toRunConfig(cfg, 0)) == NULL)
+        return -1;
+    if (checker && checker != Py_None) {
+        if ((self->checker = toRunConfig(checker, 1)) == NULL
+                || resolveChecker((RunConfigObject *) self->checker))
+            return -1;
+    }
+    if (PyObject_TypeCheck(cases, &TestsetType))
+        return loadTestset(self, (TestsetObject *) cases);
+
+    if ((cases = PySequence_Fast(cases, "cases must be a sequence")) == NULL)
+        return -1;
+    n = PySequence_Fast_GET_SIZE(cases);
+    if ((self->cases = (struct ProblemCase *) calloc(n ? n : 1,
+            sizeof(struct ProblemCase))) == NULL) {
+        Py_DECREF(cases);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        item = PySequence_Fast_GET_ITEM(cases, i);
+        self->cases[i].in_fd = -1;
+        self->n = i + 1;
+        if (!PyArg_ParseTuple(item, "ss", &input, &answer)) {
+            Py_DECREF(cases);
+            return -1;
+        }
+        if ((self->cases[i].input = strdup(input)) == NULL
+                || (self->cases[i].answer = strdup(answer)) == NULL) {
+            Py_DECREF(cases);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    Py_DECREF(cases);
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < n && ret == 0; i++)
+        ret = loadCase(&self->cases[i], &ctx);
+    Py_END_ALLOW_THREADS
+    if (ret)
+        RAISE1(ctx.err);
+    return 0;
+}
+
+/* 运行一个测试点并比较输出，不调用Python API。
+ * 每次重新打开输入memfd，使并发的judge不共享文件偏移 */
+static int judgeCase(const struct ProblemCase *c, struct Runobj *runobj,
+        struct Runctx *ctx, struct Runobj *spjobj, struct Runctx *spjctx,
+        struct Result *rst)
+{
+    char path[32], *msg;
+    const char *out;
+    size_t out_len;
+    pid_t pid;
+    int ret, fd;
+
+    if (ftruncate(runobj->fd_out, 0) || lseek(runobj->fd_out, 0, SEEK_SET))
+        RAISE_PROBLEM("reset output failure");
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", c->in_fd);
+    if ((runobj->fd_in = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        RAISE_PROBLEM("reopen input failure");
+    ret = runit(runobj, ctx, rst);
+    close(runobj->fd_in);
+    if (ret || rst->judge_result != AC)
+        return ret;
+
+    if (spjobj == NULL) {
+        if (mapOutput(runobj->fd_out, &out, &out_len, ctx))
+            return -1;
+        ret = checkNormalized(c->ans, c->ans_len, c->norm, c->norm_len,
+                out, out_len, &rst->judge_result, ctx);
+        unmapOutput(out, out_len);
+        return ret;
+    }
+
+    /* checker input /dev/stdin answer，标准输入为被测程序的输出 */
+    if (lseek(runobj->fd_out, 0, SEEK_SET))
+        RAISE_PROBLEM("rewind output failure");
+    if (spawnSpecial(spjobj, spjctx, &pid, &fd))
+        RAISE_PROBLEM(spjctx->err);
+    if ((msg = finishSpecial(spjctx, pid, fd)) != NULL) {
+        rst->judge_result = WA;
+        free(msg);
+    }
+    return 0;
+}
+
+/* judge(binary)，binary为程序路径、args列表或compile_memfd得到的fd，
+ * 依次运行全部测试点，返回ResultArray */
+static PyObject *Problem_judge(ProblemObject *self, PyObject *args)
+{
+    struct Runobj runobj, spjobj;
+    struct Runctx ctx = {0}, spjctx = {0};
+    struct Result rst;
+    ResultArrayObject *arr = NULL;
+    PyObject *binary, *argv_obj;
+    char * const *argv = NULL;
+    const char **spj_argv = NULL;
+    Py_ssize_t i, nbase = 0;
+    long exec_fd = 0;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "O", &binary))
+        return NULL;
+    if (self->config == NULL)
+        RAISE0("Problem is not initialized");
+    #ifdef IS_PY3
+    if (PyLong_Check(binary))
+        exec_fd = PyLong_AsLong(binary);
+    #else
+    if (PyInt_Check(binary) || PyLong_Check(binary))
+        exec_fd = PyInt_AsLong(binary);
+    #endif
+    if (exec_fd < 0 || PyErr_Occurred())
+        RAISE0("exec_fd must be a positive fd");
+
+    #ifdef IS_PY3
+    if (PyUnicode_Check(binary))
+    #else
+    if (PyString_Check(binary))
+    #endif
+        argv_obj = Py_BuildValue("[O]", binary);
+    else if (exec_fd > 0)
+        argv_obj = Py_BuildValue("[s]", "main");
+    else
+        argv_obj = PySequence_List(binary);
+    if (argv_obj == NULL)
+        return NULL;
+    argv = genRunArgs(argv_obj);
+    Py_DECREF(argv_obj);
+    if (argv == NULL)
+        return NULL;
+    if (argv[0] == NULL) {
+        freeRunArgs(argv);
+        RAISE0("must supply the program to judge");
+    }
+
+    runobj = ((RunConfigObject *) self->config)->runobj;
+    runobj.args = argv;
+    runobj.exec_fd = exec_fd;
+    runobj.fd_in = runobj.fd_err = -1;
+    /* 输出保存在复用的memfd中，与CAPTURE一样限制大小 */
+    runobj.output_limit = MAX_OUTPUT;
+    if ((runobj.fd_out = memfd_create("lorun-stdout", MFD_CLOEXEC)) == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto fail;
+    }
+    if (initRunctx(&ctx, &runobj)) {
+        RAISE(ctx.err);
+        goto fail;
+    }
+
+    if (self->checker) {
+        spjobj = ((RunConfigObject *) self->checker)->runobj;
+        for (nbase = 0; spjobj.args[nbase]; nbase++)
+            ;
+        if ((spj_argv = (const char **) malloc((nbase + 4)
+                * sizeof(char *))) == NULL) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        memcpy(spj_argv, spjobj.args, nbase * sizeof(char *));
+        spj_argv[nbase + 1] = "/dev/stdin";
+        spj_argv[nbase + 3] = NULL;
+        spjobj.args = (char * const *) spj_argv;
+        spjobj.fd_in = runobj.fd_out;
+        spjobj.fd_out = spjobj.fd_err = -1;
+        if (initRunctx(&spjctx, &spjobj)) {
+            RAISE(spjctx.err);
+            goto fail;
+        }
+    }
+
+    if ((arr = newResultArray(self->n)) == NULL)
+        goto fail;
+    for (i = 0; i < self->n; i++) {
+        if (spj_argv) {
+            spj_argv[nbase] = self->cases[i].input;
+            spj_argv[nbase + 2] = self->cases[i].answer;
+        }
+        memset(&rst, 0, sizeof(rst));
+        rst.re_call = -1;
+        Py_BEGIN_ALLOW_THREADS
+        ret = judgeCase(&self->cases[i], &runobj, &ctx,
+                spj_argv ? &spjobj : NULL, &spjctx, &rst);
+        Py_END_ALLOW_THREADS
+        if (ret == -1) {
+            RAISE(ctx.err);
+            goto fail;
+        }
+        if (setResultRecord(arr, i, &rst))
+            goto fail;
+    }
+
+    close(runobj.fd_out);
+    freeRunctx(&ctx);
+    freeRunctx(&spjctx);
+    free(spj_argv);
+    freeRunArgs(argv);
+    return (PyObject *) arr;
+
+fail:
+    Py_XDECREF(arr);
+    if (runobj.fd_out != -1)
+        close(runobj.fd_out);
+    freeRunctx(&ctx);
+    freeRunctx(&spjctx);
+    free(spj_argv);
+    freeRunArgs(argv);
+    return NULL;
+}
+
+static void Problem_dealloc(ProblemObject *self)
+{
+    Py_XDECREF(self->config);
+    Py_XDECREF(self->checker);
+    freeCases(self->cases, self->n);
+    releaseTestset(self);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMemberDef Problem_members[] = {
+    {"cases", T_PYSSIZET, offsetof(ProblemObject, n), READONLY,
+        "number of test cases"},
+    {"config", T_OBJECT, offsetof(ProblemObject, config), READONLY, NULL},
+    {"checker", T_OBJECT, offsetof(ProblemObject, checker), READONLY, NULL},
+    {"testset", T_OBJECT, offsetof(ProblemObject, testset), READONLY, NULL},
+    {NULL}
+};
+
+static PyMethodDef Problem_methods[] = {
+    {"judge", (PyCFunction) Problem_judge, METH_VARARGS,
+        "judge(binary) run every case and return a ResultArray;\n"
+        "binary is a path, an args list or a compile_memfd() fd"},
+    {NULL}
+};
+
+#define Problem_doc "Problem(cfg, cases[, checker])\n"\
+    "\tkeep the test data, answers, run config and checker of a problem\n"\
+    "\tloaded; cases is [(input, answer), ...] or a Testset.\n"\
+    "\tjudge(binary) only runs the submission"
+
+PyTypeObject ProblemType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.Problem",               /* tp_name */
+    sizeof(ProblemObject),              /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) Problem_dealloc,       /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    Problem_doc,                        /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    Problem_methods,                    /* tp_methods */
+    Problem_members,                    /* tp_members */
+    0,                                  /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    (initproc) Problem_init,            /* tp_init */
+    0,                                  /* tp_alloc */
+    PyType_GenericNew,                  /* tp_new */
+};
@@ -0,0 +1,47 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PROBLEM_HEADER
+#define __LO_PROBLEM_HEADER
+
+#include "lorun.h"
+
+/* 常驻内存的一个测试点 */
+struct ProblemCase {
+    char *input, *answer;   //文件路径，传给checker；来自Testset时为NULL
+    int in_fd;              //保存输入的密封memfd
+    const char *ans;        //映射的答案，空文件时为NULL，来自Testset时指向其映射
+    size_t ans_len;
+    char *norm;             //去掉空白的答案
+    size_t norm_len;
+};
+
+/* 一道题的测试数据、运行配置和checker，被所有提交共享 */
+typedef struct {
+    PyObject_HEAD
+    PyObject *config;       //RunConfig
+    PyObject *checker;      //RunConfig，没有时为NULL
+    PyObject *testset;      //cases来自的Testset，保持映射存活
+    Py_buffer pack_view;    //Testset导出的缓冲区，导出期间它不能重新打开；没有时obj为NULL
+    Py_ssize_t n;
+    struct ProblemCase *cases;
+} ProblemObject;
+
+extern PyTypeObject ProblemType;
+
+#endif
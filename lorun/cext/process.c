@@ -0,0 +1,297 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "process.h"
+#include "phase.h"
+#include "config.h"
+#include "run.h"
+#include "compile.h"
+#include "special.h"
+#include "result.h"
+#include "convert.h"
+#include <structmember.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <errno.h>
+
+static ProcessObject *newProcess(int kind, PyObject *config)
+{
+    ProcessObject *self;
+
+    if ((self = PyObject_New(ProcessObject, &ProcessType)) == NULL)
+        return NULL;
+    self->kind = kind;
+    self->pid = 0;
+    self->pidfd = -1;
+    self->out_fd = -1;
+    self->owned = 0;
+    memset(&self->runobj, 0, sizeof(struct Runobj));
+    memset(&self->ctx, 0, sizeof(struct Runctx));
+    self->io.in_fd = self->io.out_fd = -1;
+    self->config = NULL;
+
+    if (loadRunobj(config, &self->runobj, &self->owned)) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    if (!self->owned) {
+        Py_INCREF(config);
+        self->config = config;
+    }
+    if (self->runobj.trace) {
+        /* ptrace的停止不会让pidfd可读，跟踪模式只能同步等待 */
+        Py_DECREF(self);
+        RAISE0("spawn does not support trace mode");
+    }
+    return self;
+}
+
+/* 启动成功后打开pidfd，失败时杀死并回收子进程 */
+static PyObject *attachPidfd(ProcessObject *self)
+{
+    if ((self->pidfd = openPidfd(self->pid)) == -1) {
+        int err = errno;
+        kill(self->pid, SIGKILL);
+        waitpid(self->pid, NULL, 0);
+        self->pid = 0;
+        errno = err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *) self;
+}
+
+/* spawn(cfg[, fd_in[, fd_out]])，参数与run相同，返回Process */
+PyObject *spawn(PyObject *self, PyObject *args)
+{
+    ProcessObject *proc;
+    PyObject *config, *in_obj = NULL, *out_obj = NULL;
+    unsigned long long start = phaseStart();
+
+    if (!PyArg_ParseTuple(args, "O|OO", &config, &in_obj, &out_obj))
+        return NULL;
+    if ((proc = newProcess(PROCESS_RUN, config)) == NULL)
+        return NULL;
+    if (setupIO(&proc->runobj, &proc->io, in_obj, out_obj)) {
+        Py_DECREF(proc);
+        return NULL;
+    }
+
+    if (initRunctx(&proc->ctx, &proc->runobj)) {
+        RAISE(proc->ctx.err);
+        Py_DECREF(proc);
+        return NULL;
+    }
+    PARSED_PHASE(proc->ctx.phases, start);
+    if (spawnRun(&proc->runobj, &proc->ctx, &proc->pid)) {
+        RAISE(proc->ctx.err);
+        Py_DECREF(proc);
+        return NULL;
+    }
+    return attachPidfd(proc);
+}
+
+static PyObject *spawnCaptured(PyObject *args, int kind)
+{
+    ProcessObject *proc;
+    PyObject *config;
+    int r;
+    unsigned long long start = phaseStart();
+
+    if (!PyArg_ParseTuple(args, "O", &config))
+        return NULL;
+    if ((proc = newProcess(kind, config)) == NULL)
+        return NULL;
+    if (initRunctx(&proc->ctx, &proc->runobj)) {
+        RAISE(proc->ctx.err);
+        Py_DECREF(proc);
+        return NULL;
+    }
+    PARSED_PHASE(proc->ctx.phases, start);
+
+    if (kind == PROCESS_COMPILE)
+        r = spawnCompile(&proc->runobj, &proc->ctx, &proc->pid, &proc->out_fd);
+    else
+        r = spawnSpecial(&proc->runobj, &proc->ctx, &proc->pid, &proc->out_fd);
+    if (r) {
+        RAISE(proc->ctx.err);
+        Py_DECREF(proc);
+        return NULL;
+    }
+    return attachPidfd(proc);
+}
+
+/* spawn_compile(cfg)，参数与compile相同，返回Process */
+PyObject *spawn_compile(PyObject *self, PyObject *args)
+{
+    return spawnCaptured(args, PROCESS_COMPILE);
+}
+
+/* spawn_special(cfg)，参数与special相同，返回Process */
+PyObject *spawn_special(PyObject *self, PyObject *args)
+{
+    return spawnCaptured(args, PROCESS_SPECIAL);
+}
+
+static PyObject *Process_fileno(ProcessObject *self, PyObject *unused)
+{
+    return PyLong_FromLong(self->pidfd);
+}
+
+/* 回收子进程并返回与run/compile/special相同的结果，
+ * 子进程未结束时会阻塞，应在pidfd可读后调用 */
+static PyObject *Process_finish(ProcessObject *self, PyObject *unused)
+{
+    struct Result rst = {0};
+    char *buffer;
+    PyObject *r, *output;
+    int out_fd, ret;
+    pid_t pid;
+
+    /* 没有GIL时可能有多个线程同时调用finish，只有一个能取得pid */
+    if ((pid = __atomic_exchange_n(&self->pid, 0, __ATOMIC_ACQ_REL)) == 0)
+        RAISE0("process already finished");
+    out_fd = self->out_fd;
+    self->out_fd = -1;
+
+    if (self->kind == PROCESS_RUN) {
+        rst.re_call = -1;
+        Py_BEGIN_ALLOW_THREADS
+        ret = waitRun(&self->runobj, &self->ctx, &rst, pid);
+        Py_END_ALLOW_THREADS
+        if (ret == -1)
+            RAISE0(self->ctx.err);
+        r = genResult(&rst, self->ctx.phases);
+        if (r && self->io.out_fd != -1) {
+            if ((output = takeOutput(&self->io)) == NULL)
+                Py_CLEAR(r);
+            else
+                ((ResultObject *) r)->output = output;
+        }
+        closeIO(&self->io);
+        return r;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    if (self->kind == PROCESS_COMPILE)
+        buffer = finishCompile(&self->ctx, pid, out_fd);
+    else
+        buffer = finishSpecial(&self->ctx, pid, out_fd);
+    Py_END_ALLOW_THREADS
+    r = PyString_FromString(buffer ? buffer : "");
+    free(buffer);
+    return withPhases(r, self->ctx.phases);
+}
+
+/* pidfd可读时记下结束时间，finish较晚调用时回收的延迟不计入墙钟时间 */
+static PyObject *Process_poll(ProcessObject *self, PyObject *unused)
+{
+    struct pollfd p;
+
+    if (self->pid == 0)
+        Py_RETURN_TRUE;
+    p.fd = self->pidfd;
+    p.events = POLLIN;
+    if (poll(&p, 1, 0) != 1)
+        Py_RETURN_FALSE;
+    markExited(&self->ctx);
+    Py_RETURN_TRUE;
+}
+
+static PyObject *Process_kill(ProcessObject *self, PyObject *args)
+{
+    int sig = SIGKILL;
+
+    if (!PyArg_ParseTuple(args, "|i", &sig))
+        return NULL;
+    /* 通过pidfd发送信号，子进程已被其他线程回收时不会误杀重用了pid的进程 */
+    if (self->pid && signalPidfd(self->pidfd, sig) == -1 && errno != ESRCH)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+}
+
+static void Process_dealloc(ProcessObject *self)
+{
+    /* 没有回收的子进程直接杀死，避免留下僵尸进程 */
+    if (self->pid) {
+        kill(self->pid, SIGKILL);
+        waitpid(self->pid, NULL, 0);
+    }
+    if (self->pidfd != -1)
+        close(self->pidfd);
+    if (self->out_fd != -1)
+        close(self->out_fd);
+    freeRunctx(&self->ctx);
+    closeIO(&self->io);
+    if (self->owned)
+        freeRun(&self->runobj);
+    Py_XDECREF(self->config);
+    PyObject_Del(self);
+}
+
+static PyMemberDef Process_members[] = {
+    {"pid", T_INT, offsetof(ProcessObject, pid), READONLY, NULL},
+    {NULL}
+};
+
+static PyMethodDef Process_methods[] = {
+    {"fileno", (PyCFunction) Process_fileno, METH_NOARGS,
+        "pidfd, readable when the child exits"},
+    {"finish", (PyCFunction) Process_finish, METH_NOARGS,
+        "reap the child and return its result"},
+    {"poll", (PyCFunction) Process_poll, METH_NOARGS,
+        "return whether the child has exited, recording when it was seen"},
+    {"kill", (PyCFunction) Process_kill, METH_VARARGS,
+        "kill([signum]) the child if it was not reaped"},
+    {NULL}
+};
+
+PyTypeObject ProcessType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.Process",               /* tp_name */
+    sizeof(ProcessObject),              /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) Process_dealloc,       /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    "child started by spawn(), spawn_compile() or spawn_special()",
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    Process_methods,                    /* tp_methods */
+    Process_members,                    /* tp_members */
+};
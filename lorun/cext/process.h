@@ -0,0 +1,51 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_PROCESS_HEADER
+#define __LO_PROCESS_HEADER
+
+#include "lorun.h"
+#include "capture.h"
+
+enum PROCESS_KIND {
+    PROCESS_RUN = 0,
+    PROCESS_COMPILE,
+    PROCESS_SPECIAL,
+};
+
+/* 已经启动但还没有回收的子进程，pidfd可以交给事件循环等待 */
+typedef struct {
+    PyObject_HEAD
+    int kind;           //PROCESS_KIND
+    pid_t pid;          //回收后为0
+    int pidfd;
+    int out_fd;         //compile/special保存输出的memfd
+    int owned;          //runobj由dict解析而来，需要freeRun
+    struct Runobj runobj;
+    struct Runctx ctx;
+    PyObject *config;   //保持RunConfig存活
+    struct RunIO io;    //run的输入/捕获输出memfd
+} ProcessObject;
+
+extern PyTypeObject ProcessType;
+
+PyObject *spawn(PyObject *self, PyObject *args);
+PyObject *spawn_compile(PyObject *self, PyObject *args);
+PyObject *spawn_special(PyObject *self, PyObject *args);
+
+#endif
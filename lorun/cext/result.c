@@ -0,0 +1,627 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "result.h"
+#include <structmember.h>
+
+static const char *result_keys[] = {
+    "result", "timeused", "memoryused", "re_signum", "re_call",
+    "re_file", "re_file_flag", "walltime", "instructions", "syscalls", "phases", "output",
+    "samples", NULL
+};
+
+/* 接管syscalls和phases的引用 */
+PyObject *newResultObject(const struct Result *rst, PyObject *syscalls,
+        PyObject *phases)
+{
+    ResultObject *self;
+
+    if ((self = PyObject_New(ResultObject, &ResultType)) == NULL) {
+        Py_XDECREF(syscalls);
+        Py_XDECREF(phases);
+        return NULL;
+    }
+    self->result = rst->judge_result;
+    self->timeused = rst->time_used;
+    self->memoryused = rst->memory_used;
+    self->re_signum = rst->re_signum;
+    self->re_call = rst->re_call;
+    self->re_file_flag = rst->re_file_flag;
+    self->walltime = rst->wall_used;
+    self->instructions = rst->instructions;
+    self->re_file = NULL;
+    self->syscalls = syscalls;
+    self->phases = phases;
+    self->output = NULL;
+    self->samples = NULL;
+    self->dict = NULL;
+    if (rst->re_file) {
+        #ifdef IS_PY3
+        self->re_file = PyUnicode_DecodeFSDefault(rst->re_file);
+        #else
+        self->re_file = PyString_FromString(rst->re_file);
+        #endif
+        if (self->re_file == NULL) {
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+    /* 采样序列在ctx中，ctx释放前复制出来 */
+    if (rst->samples) {
+        const struct Sample *s;
+        PyObject *t;
+        int i;
+
+        if ((self->samples = PyList_New(rst->nsamples)) == NULL) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        for (i = 0; i < rst->nsamples; i++) {
+            s = rst->samples + i;
+            if ((t = Py_BuildValue("(III)", s->ms, s->cpu_ms, s->rss_kb))
+                    == NULL) {
+                Py_DECREF(self);
+                return NULL;
+            }
+            PyList_SET_ITEM(self->samples, i, t);
+        }
+    }
+
+    return (PyObject *) self;
+}
+
+/* 与以前的dict一致：可选字段只在有值时存在。返回新引用，不存在时返回NULL且不设置异常 */
+static PyObject *resultGet(ResultObject *self, const char *key)
+{
+    if (!strcmp(key, "result"))
+        return PyLong_FromLong(self->result);
+    if (!strcmp(key, "timeused"))
+        return PyLong_FromLong(self->timeused);
+    if (!strcmp(key, "memoryused"))
+        return PyLong_FromLong(self->memoryused);
+    if (!strcmp(key, "re_signum") && self->re_signum)
+        return PyLong_FromLong(self->re_signum);
+    if (!strcmp(key, "re_call") && self->re_call != -1)
+        return PyLong_FromLong(self->re_call);
+    if (self->re_file) {
+        if (!strcmp(key, "re_file")) {
+            Py_INCREF(self->re_file);
+            return self->re_file;
+        }
+        if (!strcmp(key, "re_file_flag"))
+            return PyLong_FromLong(self->re_file_flag);
+    }
+    if (!strcmp(key, "walltime") && self->walltime != -1)
+        return PyLong_FromLong(self->walltime);
+    /* 开启了计数但计数器不可用时为None */
+    if (!strcmp(key, "instructions") && self->instructions != INSN_OFF) {
+        if (self->instructions == INSN_UNAVAILABLE)
+            Py_RETURN_NONE;
+        return PyLong_FromLongLong(self->instructions);
+    }
+    if (!strcmp(key, "syscalls") && self->syscalls) {
+        Py_INCREF(self->syscalls);
+        return self->syscalls;
+    }
+    if (!strcmp(key, "phases") && self->phases) {
+        Py_INCREF(self->phases);
+        return self->phases;
+    }
+    if (!strcmp(key, "output") && self->output) {
+        Py_INCREF(self->output);
+        return self->output;
+    }
+    if (!strcmp(key, "samples") && self->samples) {
+        Py_INCREF(self->samples);
+        return self->samples;
+    }
+    return NULL;
+}
+
+static const char *keyString(PyObject *key)
+{
+    #ifdef IS_PY3
+    if (PyUnicode_Check(key))
+        return PyUnicode_AsUTF8(key);
+    #else
+    if (PyString_Check(key))
+        return PyString_AsString(key);
+    #endif
+    return NULL;
+}
+
+/* 与以前的dict一致，只包含有值的字段 */
+static PyObject *nativeDict(ResultObject *self)
+{
+    PyObject *d, *v;
+    int i;
+
+    if ((d = PyDict_New()) == NULL)
+        return NULL;
+    for (i = 0; result_keys[i]; i++) {
+        if ((v = resultGet(self, result_keys[i])) == NULL)
+            continue;
+        if (PyDict_SetItemString(d, result_keys[i], v)) {
+            Py_DECREF(v);
+            Py_DECREF(d);
+            return NULL;
+        }
+        Py_DECREF(v);
+    }
+
+    return d;
+}
+
+/* 以前的调用者会修改结果，如rst['result'] = check(...)，写入前转成dict */
+static PyObject *writableDict(ResultObject *self)
+{
+    if (self->dict == NULL)
+        self->dict = nativeDict(self);
+    return self->dict;
+}
+
+static PyObject *Result_subscript(ResultObject *self, PyObject *key)
+{
+    const char *k = keyString(key);
+    PyObject *v;
+
+    if (self->dict)
+        return PyObject_GetItem(self->dict, key);
+    if (k && (v = resultGet(self, k)) != NULL)
+        return v;
+    if (!PyErr_Occurred())
+        PyErr_SetObject(PyExc_KeyError, key);
+    return NULL;
+}
+
+static int Result_ass_subscript(ResultObject *self, PyObject *key,
+        PyObject *value)
+{
+    if (writableDict(self) == NULL)
+        return -1;
+    if (value == NULL)
+        return PyObject_DelItem(self->dict, key);
+    return PyObject_SetItem(self->dict, key, value);
+}
+
+static int Result_contains(ResultObject *self, PyObject *key)
+{
+    const char *k = keyString(key);
+    PyObject *v;
+
+    if (self->dict)
+        return PyDict_Contains(self->dict, key);
+    if (k == NULL || (v = resultGet(self, k)) == NULL)
+        return PyErr_Occurred() ? -1 : 0;
+    Py_DECREF(v);
+    return 1;
+}
+
+static PyObject *Result_keys(ResultObject *self, PyObject *unused)
+{
+    PyObject *keys, *v, *k;
+    int i;
+
+    if (self->dict)
+        return PyDict_Keys(self->dict);
+    if ((keys = PyList_New(0)) == NULL)
+        return NULL;
+    for (i = 0; result_keys[i]; i++) {
+        if ((v = resultGet(self, result_keys[i])) == NULL)
+            continue;
+        Py_DECREF(v);
+        #ifdef IS_PY3
+        k = PyUnicode_FromString(result_keys[i]);
+        #else
+        k = PyString_FromString(result_keys[i]);
+        #endif
+        if (k == NULL || PyList_Append(keys, k)) {
+            Py_XDECREF(k);
+            Py_DECREF(keys);
+            return NULL;
+        }
+        Py_DECREF(k);
+    }
+
+    return keys;
+}
+
+static Py_ssize_t Result_length(ResultObject *self)
+{
+    PyObject *keys = Result_keys(self, NULL);
+    Py_ssize_t n;
+
+    if (keys == NULL)
+        return -1;
+    n = PyList_GET_SIZE(keys);
+    Py_DECREF(keys);
+    return n;
+}
+
+static PyObject *Result_iter(ResultObject *self)
+{
+    PyObject *keys = Result_keys(self, NULL), *it;
+
+    if (keys == NULL)
+        return NULL;
+    it = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return it;
+}
+
+/* 转成和以前一样的dict，包含按键写入的修改 */
+static PyObject *Result_to_dict(ResultObject *self, PyObject *unused)
+{
+    if (self->dict)
+        return PyDict_Copy(self->dict);
+    return nativeDict(self);
+}
+
+/* update/pop/setdefault等修改方法转给写入用的dict */
+static PyObject *forwardWrite(ResultObject *self, const char *name,
+        PyObject *args, PyObject *kwds)
+{
+    PyObject *f, *r;
+
+    if (writableDict(self) == NULL
+            || (f = PyObject_GetAttrString(self->dict, name)) == NULL)
+        return NULL;
+    r = PyObject_Call(f, args, kwds);
+    Py_DECREF(f);
+    return r;
+}
+
+static PyObject *Result_update(ResultObject *self, PyObject *args,
+        PyObject *kwds)
+{
+    return forwardWrite(self, "update", args, kwds);
+}
+
+static PyObject *Result_pop(ResultObject *self, PyObject *args)
+{
+    return forwardWrite(self, "pop", args, NULL);
+}
+
+static PyObject *Result_setdefault(ResultObject *self, PyObject *args)
+{
+    return forwardWrite(self, "setdefault", args, NULL);
+}
+
+static PyObject *Result_get(ResultObject *self, PyObject *args)
+{
+    PyObject *key, *def = Py_None, *v;
+    const char *k;
+
+    if (!PyArg_ParseTuple(args, "O|O", &key, &def))
+        return NULL;
+    if (self->dict) {
+        #ifdef IS_PY3
+        if ((v = PyDict_GetItemWithError(self->dict, key)) == NULL) {
+            if (PyErr_Occurred())
+                return NULL;
+            v = def;
+        }
+        #else
+        if ((v = PyDict_GetItem(self->dict, key)) == NULL)
+            v = def;
+        #endif
+        Py_INCREF(v);
+        return v;
+    }
+    if ((k = keyString(key)) != NULL && (v = resultGet(self, k)) != NULL)
+        return v;
+    if (PyErr_Occurred())
+        return NULL;
+    Py_INCREF(def);
+    return def;
+}
+
+static PyObject *Result_items(ResultObject *self, PyObject *unused)
+{
+    PyObject *d = Result_to_dict(self, NULL), *items;
+
+    if (d == NULL)
+        return NULL;
+    items = PyDict_Items(d);
+    Py_DECREF(d);
+    return items;
+}
+
+static PyObject *Result_repr(ResultObject *self)
+{
+    PyObject *d = Result_to_dict(self, NULL), *r;
+
+    if (d == NULL)
+        return NULL;
+    r = PyObject_Repr(d);
+    Py_DECREF(d);
+    return r;
+}
+
+static PyObject *Result_richcompare(ResultObject *self, PyObject *other, int op)
+{
+    PyObject *d, *r;
+
+    /* 可以和dict直接比较 */
+    if ((op != Py_EQ && op != Py_NE) || !PyDict_Check(other)) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    if ((d = Result_to_dict(self, NULL)) == NULL)
+        return NULL;
+    r = PyObject_RichCompare(d, other, op);
+    Py_DECREF(d);
+    return r;
+}
+
+static void Result_dealloc(ResultObject *self)
+{
+    Py_XDECREF(self->re_file);
+    Py_XDECREF(self->syscalls);
+    Py_XDECREF(self->phases);
+    Py_XDECREF(self->output);
+    Py_XDECREF(self->samples);
+    Py_XDECREF(self->dict);
+    PyObject_Del(self);
+}
+
+static PyMemberDef Result_members[] = {
+    {"result", T_INT, offsetof(ResultObject, result), READONLY, NULL},
+    {"timeused", T_INT, offsetof(ResultObject, timeused), READONLY, NULL},
+    {"memoryused", T_INT, offsetof(ResultObject, memoryused), READONLY, NULL},
+    {"re_signum", T_INT, offsetof(ResultObject, re_signum), READONLY, NULL},
+    {"re_call", T_INT, offsetof(ResultObject, re_call), READONLY, NULL},
+    {"re_file", T_OBJECT, offsetof(ResultObject, re_file), READONLY, NULL},
+    {"re_file_flag", T_INT, offsetof(ResultObject, re_file_flag),
+        READONLY, NULL},
+    {"walltime", T_INT, offsetof(ResultObject, walltime), READONLY,
+        "wall time (ms), -1 if not measured"},
+    {"instructions", T_LONGLONG, offsetof(ResultObject, instructions),
+        READONLY, "user-space instructions, -1 if not counted, "
+        "-2 if counters are unavailable"},
+    {"syscalls", T_OBJECT, offsetof(ResultObject, syscalls), READONLY, NULL},
+    {"phases", T_OBJECT, offsetof(ResultObject, phases), READONLY, NULL},
+    {"output", T_OBJECT, offsetof(ResultObject, output), READONLY, NULL},
+    {"samples", T_OBJECT, offsetof(ResultObject, samples), READONLY,
+        "[(ms, cpu_ms, rss_kb), ...] if sampling was enabled"},
+    {NULL}
+};
+
+static PyMethodDef Result_methods[] = {
+    {"keys", (PyCFunction) Result_keys, METH_NOARGS, NULL},
+    {"items", (PyCFunction) Result_items, METH_NOARGS, NULL},
+    {"get", (PyCFunction) Result_get, METH_VARARGS, NULL},
+    {"to_dict", (PyCFunction) Result_to_dict, METH_NOARGS, NULL},
+    {"update", (PyCFunction) Result_update, METH_VARARGS | METH_KEYWORDS,
+        NULL},
+    {"pop", (PyCFunction) Result_pop, METH_VARARGS, NULL},
+    {"setdefault", (PyCFunction) Result_setdefault, METH_VARARGS, NULL},
+    {NULL}
+};
+
+static PyMappingMethods Result_as_mapping = {
+    (lenfunc) Result_length,
+    (binaryfunc) Result_subscript,
+    (objobjargproc) Result_ass_subscript,
+};
+
+static PySequenceMethods Result_as_sequence = {
+    0, 0, 0, 0, 0, 0, 0,
+    (objobjproc) Result_contains,
+};
+
+#define Result_doc "Result of run(). Fields are read-only attributes; the object\n"\
+    "is also a mapping with the keys of the old result dict. Writing a key\n"\
+    "works as on the dict and does not change the attributes"
+
+PyTypeObject ResultType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.Result",                /* tp_name */
+    sizeof(ResultObject),               /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) Result_dealloc,        /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    (reprfunc) Result_repr,             /* tp_repr */
+    0,                                  /* tp_as_number */
+    &Result_as_sequence,                /* tp_as_sequence */
+    &Result_as_mapping,                 /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    Result_doc,                         /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    (richcmpfunc) Result_richcompare,   /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    (getiterfunc) Result_iter,          /* tp_iter */
+    0,                                  /* tp_iternext */
+    Result_methods,                     /* tp_methods */
+    Result_members,                     /* tp_members */
+};
+
+ResultArrayObject *newResultArray(Py_ssize_t n)
+{
+    ResultArrayObject *self;
+
+    if ((self = PyObject_New(ResultArrayObject, &ResultArrayType)) == NULL)
+        return NULL;
+    self->n = n;
+    self->re_files = NULL;
+    if ((self->records = (struct ResultRecord *) calloc(n ? n : 1,
+            sizeof(struct ResultRecord))) == NULL) {
+        Py_DECREF(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return self;
+}
+
+int setResultRecord(ResultArrayObject *arr, Py_ssize_t i,
+        const struct Result *rst)
+{
+    struct ResultRecord *rec = &arr->records[i];
+    PyObject *k, *v;
+    int r;
+
+    rec->result = rst->judge_result;
+    rec->timeused = rst->time_used;
+    rec->memoryused = rst->memory_used;
+    rec->re_signum = rst->re_signum;
+    rec->re_call = rst->re_call;
+    rec->re_file_flag = rst->re_file_flag;
+    rec->walltime = rst->wall_used;
+    rec->instructions = rst->instructions;
+    if (rst->re_file == NULL)
+        return 0;
+
+    if (arr->re_files == NULL && (arr->re_files = PyDict_New()) == NULL)
+        return -1;
+    k = PyLong_FromSsize_t(i);
+    #ifdef IS_PY3
+    v = PyUnicode_DecodeFSDefault(rst->re_file);
+    #else
+    v = PyString_FromString(rst->re_file);
+    #endif
+    r = (k && v) ? PyDict_SetItem(arr->re_files, k, v) : -1;
+    Py_XDECREF(k);
+    Py_XDECREF(v);
+    return r;
+}
+
+static Py_ssize_t ResultArray_length(ResultArrayObject *self)
+{
+    return self->n;
+}
+
+static PyObject *ResultArray_item(ResultArrayObject *self, Py_ssize_t i)
+{
+    const struct ResultRecord *rec;
+    struct Result rst = {0};
+    PyObject *k, *file = NULL, *obj;
+
+    if (i < 0 || i >= self->n) {
+        PyErr_SetString(PyExc_IndexError, "result index out of range");
+        return NULL;
+    }
+    rec = &self->records[i];
+    rst.judge_result = rec->result;
+    rst.time_used = rec->timeused;
+    rst.memory_used = rec->memoryused;
+    rst.re_signum = rec->re_signum;
+    rst.re_call = rec->re_call;
+    rst.re_file_flag = rec->re_file_flag;
+    rst.wall_used = rec->walltime;
+    rst.instructions = rec->instructions;
+
+    if ((obj = newResultObject(&rst, NULL, NULL)) == NULL)
+        return NULL;
+    if (self->re_files) {
+        if ((k = PyLong_FromSsize_t(i)) == NULL) {
+            Py_DECREF(obj);
+            return NULL;
+        }
+        file = PyDict_GetItem(self->re_files, k);
+        Py_DECREF(k);
+        Py_XINCREF(file);
+        ((ResultObject *) obj)->re_file = file;
+    }
+    return obj;
+}
+
+static int ResultArray_getbuffer(ResultArrayObject *self, Py_buffer *view,
+        int flags)
+{
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "ResultArray is read-only");
+        return -1;
+    }
+    view->obj = (PyObject *) self;
+    Py_INCREF(self);
+    view->buf = self->records;
+    view->len = self->n * sizeof(struct ResultRecord);
+    view->readonly = 1;
+    view->itemsize = sizeof(struct ResultRecord);
+    view->format = (flags & PyBUF_FORMAT) ? RESULT_RECORD_FORMAT : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->n : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &view->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static void ResultArray_dealloc(ResultArrayObject *self)
+{
+    free(self->records);
+    Py_XDECREF(self->re_files);
+    PyObject_Del(self);
+}
+
+static PySequenceMethods ResultArray_as_sequence = {
+    (lenfunc) ResultArray_length,
+    0,
+    0,
+    (ssizeargfunc) ResultArray_item,
+};
+
+static PyBufferProcs ResultArray_as_buffer = {
+#ifndef IS_PY3
+    0, 0, 0, 0,
+#endif
+    (getbufferproc) ResultArray_getbuffer,
+    0,
+};
+
+#define ResultArray_doc "Results of run_batch(). Items are Result objects;\n"\
+    "the buffer protocol exposes the packed records with format\n"\
+    RESULT_RECORD_FORMAT
+
+PyTypeObject ResultArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.ResultArray",           /* tp_name */
+    sizeof(ResultArrayObject),          /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) ResultArray_dealloc,   /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    &ResultArray_as_sequence,           /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    &ResultArray_as_buffer,             /* tp_as_buffer */
+#ifdef IS_PY3
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+    ResultArray_doc,                    /* tp_doc */
+};
@@ -0,0 +1,69 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_RESULT_HEADER
+#define __LO_RESULT_HEADER
+
+#include "lorun.h"
+#include <stdint.h>
+
+/* run()的返回值，字段可以按属性访问，也可以像以前的dict一样按键访问 */
+typedef struct {
+    PyObject_HEAD
+    int result, timeused, memoryused;
+    int re_signum, re_call, re_file_flag;
+    int walltime;           //-1时不在键中
+    long long instructions; //INSN_OFF或INSN_UNAVAILABLE时不在键中
+    PyObject *re_file;      //没有时为NULL
+    PyObject *syscalls;     //没有时为NULL
+    PyObject *phases;       //没有时为NULL
+    PyObject *output;       //捕获的标准输出(memoryview)，没有时为NULL
+    PyObject *samples;      //[(ms, cpu_ms, rss_kb), ...]，没有采样时为NULL
+    PyObject *dict;         //第一次按键写入或删除时转成的dict，此后按键访问都用它；
+                            //属性仍是原来的值。没有写入过时为NULL
+} ResultObject;
+
+/* 批量结果中的一条记录，通过缓冲区协议导出 */
+struct ResultRecord {
+    int32_t result, timeused, memoryused;
+    int32_t re_signum, re_call, re_file_flag;
+    int32_t walltime;
+    int64_t instructions;
+};
+
+#define RESULT_RECORD_FORMAT "T{i:result:i:timeused:i:memoryused:"\
+    "i:re_signum:i:re_call:i:re_file_flag:i:walltime:"\
+    "q:instructions:}"
+
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t n;
+    struct ResultRecord *records;
+    PyObject *re_files;     //{下标: re_file}，没有被拒绝的文件时为NULL
+} ResultArrayObject;
+
+extern PyTypeObject ResultType;
+extern PyTypeObject ResultArrayType;
+
+PyObject *newResultObject(const struct Result *rst, PyObject *syscalls,
+        PyObject *phases);
+ResultArrayObject *newResultArray(Py_ssize_t n);
+int setResultRecord(ResultArrayObject *arr, Py_ssize_t i,
+        const struct Result *rst);
+
+#endif
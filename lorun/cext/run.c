@@ -20,57 +20,153 @@
 #include <sys/ptrace.h>
 #include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/user.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <dirent.h>
 #include "access.h"
+#include "counter.h"
+#include "sample.h"
 #include "limit.h"
+#include "phase.h"
+
+#define RAISE_RUN(msg) {ctx->err = msg;return -1;}
+#define SHIM_DRAIN_TRIES 1000   //组中还有未被shim收养的进程时，最多等这么多次1ms
+
+/* 不跟踪的tree模式下，shim经管道报告两次：程序exec之后和整个进程组回收之后 */
+struct ShimReport {
+    pid_t pid;                          //主进程
+    unsigned long long forked, exec;    //主进程的PHASE_FORKED和PHASE_EXEC
+    int status;                         //主进程的结束状态
+    struct rusage ru;                   //shim的RUSAGE_CHILDREN，即整棵进程树
+};
+
+/* 输出达到output_limit时写入会被截断，程序可能正常退出 */
+static int outputExceeded(const struct Runobj *runobj) {
+    struct stat st;
+
+    return runobj->output_limit > 0 && runobj->fd_out != -1
+            && fstat(runobj->fd_out, &st) == 0
+            && st.st_size >= runobj->output_limit;
+}
+
+/* 记录第一次观察到主进程结束的时间，之后回收的延迟不计入墙钟时间 */
+void markExited(struct Runctx *ctx) {
+    if (ctx->spawned && ctx->exited == 0)
+        ctx->exited = monotonicNs();
+}
 
-const char *last_run_err;
-#define RAISE_RUN(err) {last_run_err = err;return -1;}
+/* 子进程结束后记录墙钟时间，读出指令数并关闭计数器，可以重复调用 */
+static void collectUsage(const struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst) {
+    markExited(ctx);
+    if (ctx->spawned && (runobj->tree || runobj->wall_limit > 0))
+        rst->wall_used = (ctx->exited - ctx->spawned) / 1000000;
+    ctx->spawned = 0;
+    ctx->exited = 0;
+
+    if (ctx->insn_fd == -1)
+        return;
+    rst->instructions = readCounter(ctx->insn_fd);
+    close(ctx->insn_fd);
+    ctx->insn_fd = -1;
+}
+
+/* 有指令数限制且计数器可用时按指令数判断，结果不受频率和负载影响；
+ * 有墙钟时间限制时不再按CPU时间判断，并行程序的CPU时间是各线程之和 */
+static int timeExceeded(const struct Runobj *runobj, const struct Result *rst) {
+    if (runobj->wall_limit > 0 && rst->wall_used > runobj->wall_limit)
+        return 1;
+    if (runobj->insn_limit > 0 && rst->instructions >= 0)
+        return rst->instructions > runobj->insn_limit;
+    if (runobj->wall_limit > 0)
+        return 0;
+    return rst->time_used > runobj->time_limit;
+}
+
+/* 子进程因信号sig结束 */
+static void signalVerdict(const struct Runobj *runobj, struct Result *rst,
+        int sig) {
+    switch (sig) {
+        case SIGSEGV:
+            if (rst->memory_used > runobj->memory_limit)
+                rst->judge_result = MLE;
+            else
+                rst->judge_result = RE;
+            break;
+        case SIGALRM:
+        case SIGXCPU:
+        case SIGPROF:
+            rst->judge_result = TLE;
+            break;
+        case SIGXFSZ:
+            rst->judge_result = OLE;
+            break;
+        default:
+            rst->judge_result = RE;
+            break;
+    }
+    rst->re_signum = sig;
+}
+
+/* 子进程正常退出，此处的AC并不代表正确，只是说明没有异常错误 */
+static void exitVerdict(const struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst) {
+    collectUsage(runobj, ctx, rst);
+    if (timeExceeded(runobj, rst))
+        rst->judge_result = TLE;
+    else if (rst->memory_used > runobj->memory_limit)
+        rst->judge_result = MLE;
+    else if (outputExceeded(runobj))
+        rst->judge_result = OLE;
+    else
+        rst->judge_result = AC;
+}
+
+static int msTime(const struct rusage *ru) {
+    return ru->ru_utime.tv_sec * 1000 + ru->ru_utime.tv_usec / 1000
+            + ru->ru_stime.tv_sec * 1000 + ru->ru_stime.tv_usec / 1000;
+}
 
 /* 监控系统调用运行子进程 */
-int traceLoop(struct Runobj *runobj, struct Result *rst, pid_t pid) {
+int traceLoop(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst,
+        pid_t pid) {
     int status, incall = 0;
+    long call;
+    unsigned long long stopped = 0;
     struct rusage ru;
     struct user_regs_struct regs;
 
     while (1) {
         if (wait4(pid, &status, WSTOPPED, &ru) == -1)
             RAISE_RUN("wait4 [WSTOPPED] failure");
+        if (rst->stats)
+            stopped = monotonicNs();
 
         /* 检查是否停止 */
-        if (WIFEXITED(status))
+        if (WIFEXITED(status)) {
+            markExited(ctx);
             break;
+        }
         else if (WSTOPSIG(status) != SIGTRAP) {
             /* 非内核产生的调停 */
             ptrace(PTRACE_KILL, pid, NULL, NULL);
             waitpid(pid, NULL, 0);
 
-            rst->time_used = ru.ru_utime.tv_sec * 1000
-                             + ru.ru_utime.tv_usec / 1000
-                             + ru.ru_stime.tv_sec * 1000
-                             + ru.ru_stime.tv_usec / 1000;
+            rst->time_used = msTime(&ru);
             rst->memory_used = ru.ru_maxrss;
-
-            switch (WSTOPSIG(status)) {
-                case SIGSEGV:
-                    if (rst->memory_used > runobj->memory_limit)
-                        rst->judge_result = MLE;
-                    else
-                        rst->judge_result = RE;
-                    break;
-                case SIGALRM:
-                case SIGXCPU:
-                    rst->judge_result = TLE;
-                    break;
-                default:
-                    rst->judge_result = RE;
-                    break;
-            }
-
-            rst->re_signum = WSTOPSIG(status);
+            signalVerdict(runobj, rst, WSTOPSIG(status));
             return 0;
         }
 
@@ -78,16 +174,17 @@ int traceLoop(struct Runobj *runobj, struct Result *rst, pid_t pid) {
         if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) == -1)
             RAISE_RUN("PTRACE_GETREGS failure");
 
+        call = REG_SYS_CALL(&regs);
+        if (rst->stats && incall && call >= 0 && call < CALLS_MAX)
+            rst->stats[call].count++;
+
         if (incall) {
-            int ret = checkAccess(runobj, pid, &regs);
-            if (ret != ACCESS_OK) {
+            int ret = checkAccess(runobj, ctx, pid, &regs);
+            if (ret != ACCESS_OK && ret != ACCESS_ENOSYS) {
                 ptrace(PTRACE_KILL, pid, NULL, NULL);
                 waitpid(pid, NULL, 0);
 
-                rst->time_used = ru.ru_utime.tv_sec * 1000
-                        + ru.ru_utime.tv_usec / 1000
-                        + ru.ru_stime.tv_sec * 1000
-                        + ru.ru_stime.tv_usec / 1000;
+                rst->time_used = msTime(&ru);
                 rst->memory_used = ru.ru_maxrss
                         * (sysconf(_SC_PAGESIZE) / 1024);
 
@@ -96,8 +193,8 @@ int traceLoop(struct Runobj *runobj, struct Result *rst, pid_t pid) {
                     rst->re_call = REG_SYS_CALL(&regs);
                 }
                 else {
-                    rst->re_file = lastFileAccess();
-                    rst->re_file_flag = REG_ARG_2(&regs);
+                    rst->re_file = ctx->path;
+                    rst->re_file_flag = ctx->path_flag;
                 }
                 return 0;
             }
@@ -106,152 +203,715 @@ int traceLoop(struct Runobj *runobj, struct Result *rst, pid_t pid) {
         else
             incall = 1;
 
+        /* 进入和退出两次停止的时间都计入该调用 */
+        if (rst->stats && call >= 0 && call < CALLS_MAX)
+            rst->stats[call].ns += monotonicNs() - stopped;
+
         /* 重新启动跟踪 */
         ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
     }
     
 
-    rst->time_used = ru.ru_utime.tv_sec * 1000
-                     + ru.ru_utime.tv_usec / 1000
-                     + ru.ru_stime.tv_sec * 1000
-                     + ru.ru_stime.tv_usec / 1000;
+    rst->time_used = msTime(&ru);
     rst->memory_used = ru.ru_maxrss;
+    exitVerdict(runobj, ctx, rst);
 
-    if (rst->time_used > runobj->time_limit)
-        rst->judge_result = TLE;
-    else if (rst->memory_used > runobj->memory_limit)
-        rst->judge_result = MLE;
+    return 0;
+}
+
+/* tree模式下跟踪的线程 */
+struct Tracee {
+    pid_t tid;
+    int incall;     //下一次系统调用停止是退出
+    int leader;     //fork出的进程而不是线程，回收时计入内存
+};
+
+struct TraceeSet {
+    struct Tracee *v;
+    int n, cap;
+};
+
+static struct Tracee *findTracee(struct TraceeSet *set, pid_t tid) {
+    int i;
+
+    for (i = 0; i < set->n; i++)
+        if (set->v[i].tid == tid)
+            return &set->v[i];
+    return NULL;
+}
+
+/* 返回的指针在下一次addTracee之前有效 */
+static struct Tracee *addTracee(struct TraceeSet *set, pid_t tid, int leader) {
+    struct Tracee *v;
+
+    if (set->n == set->cap) {
+        v = (struct Tracee *) realloc(set->v,
+                (set->cap * 2 + 8) * sizeof(struct Tracee));
+        if (v == NULL)
+            return NULL;
+        set->v = v;
+        set->cap = set->cap * 2 + 8;
+    }
+    v = &set->v[set->n++];
+    v->tid = tid;
+    v->incall = 0;
+    v->leader = leader;
+    return v;
+}
+
+static void dropTracee(struct TraceeSet *set, pid_t tid) {
+    struct Tracee *t = findTracee(set, tid);
+
+    if (t)
+        *t = set->v[--set->n];
+}
+
+/* 被跟踪的线程在回收之前pid不会被重用 */
+static void killTracees(struct TraceeSet *set) {
+    int i;
+
+    for (i = 0; i < set->n; i++)
+        kill(set->v[i].tid, SIGKILL);
+}
+
+/* 已结束、未回收的线程自己用掉的CPU时间(纳秒)。schedstat是纳秒精度的，
+ * 没有时退回task/<tid>/stat中的时钟滴答，/proc/<tid>/stat是整个进程的 */
+static unsigned long long taskCpuNs(pid_t tid) {
+    char path[64], buf[512], *p;
+    unsigned long long ns, utime, stime;
+    int fd, r;
+
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int) tid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) != -1) {
+        r = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (r > 0) {
+            buf[r] = 0;
+            if (sscanf(buf, "%llu", &ns) == 1)
+                return ns;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", (int) tid, (int) tid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return 0;
+    r = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (r <= 0)
+        return 0;
+    buf[r] = 0;
+    if ((p = strrchr(buf, ')')) == NULL || sscanf(p + 2,
+            "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+            &utime, &stime) != 2)
+        return 0;
+    return (utime + stime) * (1000000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+#define TREE_OPTIONS (PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE \
+        | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC \
+        | PTRACE_O_EXITKILL)
+
+/* 跟踪整个进程树：线程和子进程自动被跟踪，每个线程的系统调用都经过检查。
+ * 主进程结束或出现被拒绝的调用时杀死其余进程，并等到所有线程结束。
+ * CPU时间为每个线程结束时各自的CPU时间之和，内存为各进程峰值之和。
+ * 用__WNOTHREAD只等待本线程的子进程，spawnRun保证此时没有其他子进程 */
+int treeTraceLoop(struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst, pid_t pid) {
+    struct TraceeSet set = {NULL, 0, 0};
+    struct Tracee *t;
+    struct user_regs_struct regs;
+    struct rusage ru, main_ru;
+    siginfo_t info;
+    unsigned long msg;
+    unsigned long long stopped = 0, cpu_ns = 0;
+    long call, memory = 0;
+    int status, main_status, sig, event, ret, denied = 0, done = 0;
+    pid_t tid;
+
+    /* 第一次停止是exec之后的SIGTRAP，此后才能设置选项 */
+    if (wait4(pid, &status, __WALL, &ru) == -1)
+        RAISE_RUN("wait4 [WSTOPPED] failure");
+    main_status = status;
+    main_ru = ru;
+    if (WIFSTOPPED(status)) {
+        if (ptrace(PTRACE_SETOPTIONS, pid, NULL, TREE_OPTIONS) == -1
+                || addTracee(&set, pid, 1) == NULL) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, __WALL);
+            free(set.v);
+            RAISE_RUN("PTRACE_SETOPTIONS failure");
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    }
     else
-        rst->judge_result = AC;
+        memory = ru.ru_maxrss;
+
+    while (set.n > 0) {
+        /* 先不回收地取得事件，结束的线程要在回收之前读出CPU时间 */
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT | __WALL
+                | __WNOTHREAD) == -1) {
+            if (errno == EINTR)
+                continue;
+            /* 不应发生：剩余的线程已不在本线程的跟踪之下 */
+            killTracees(&set);
+            break;
+        }
+        tid = info.si_pid;
+        if (info.si_code == CLD_EXITED || info.si_code == CLD_KILLED
+                || info.si_code == CLD_DUMPED)
+            cpu_ns += taskCpuNs(tid);
+        while ((ret = wait4(tid, &status, __WALL | __WNOTHREAD, &ru)) == -1
+                && errno == EINTR)
+            ;
+        if (ret == -1)
+            continue;
+        if (rst->stats)
+            stopped = monotonicNs();
+        t = findTracee(&set, tid);
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (t && t->leader)
+                memory += ru.ru_maxrss;
+            dropTracee(&set, tid);
+            if (tid == pid) {
+                markExited(ctx);
+                main_status = status;
+                main_ru = ru;
+                done = 1;
+                killTracees(&set);
+            }
+            continue;
+        }
+
+        /* 新线程/进程的第一次停止可能早于创建它的事件 */
+        if (t == NULL && (t = addTracee(&set, tid, 0)) == NULL) {
+            kill(tid, SIGKILL);
+            continue;
+        }
+        if (denied || done) {
+            kill(tid, SIGKILL);
+            continue;
+        }
+
+        sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) == -1) {
+                /* 线程在停止后被杀死 */
+                continue;
+            }
+            call = REG_SYS_CALL(&regs);
+            if (!t->incall) {
+                if (rst->stats && call >= 0 && call < CALLS_MAX)
+                    rst->stats[call].count++;
+                ret = checkAccess(runobj, ctx, tid, &regs);
+                if (ret != ACCESS_OK && ret != ACCESS_ENOSYS) {
+                    rst->judge_result = RE;
+                    if (ret == ACCESS_CALL_ERR)
+                        rst->re_call = call;
+                    else {
+                        rst->re_file = ctx->path;
+                        rst->re_file_flag = ctx->path_flag;
+                    }
+                    denied = 1;
+                    killTracees(&set);
+                    continue;
+                }
+            }
+            t->incall = !t->incall;
+            if (rst->stats && call >= 0 && call < CALLS_MAX)
+                rst->stats[call].ns += monotonicNs() - stopped;
+            sig = 0;
+        }
+        else if (sig == SIGTRAP && (event = status >> 16) != 0) {
+            ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg);
+            if (event == PTRACE_EVENT_EXEC) {
+                /* 非主线程exec后原线程号消失，不会收到它的退出 */
+                if ((pid_t) msg != tid)
+                    dropTracee(&set, msg);
+                if ((t = findTracee(&set, tid)) != NULL)
+                    t->incall = 1;
+            }
+            else if ((t = findTracee(&set, msg)) != NULL)
+                t->leader = event != PTRACE_EVENT_CLONE;
+            else if (addTracee(&set, msg, event != PTRACE_EVENT_CLONE) == NULL)
+                kill(msg, SIGKILL);
+            sig = 0;
+        }
+        /* 停止类信号不转发，避免进入组停止；其余信号交给程序处理 */
+        else if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN
+                || sig == SIGTTOU)
+            sig = 0;
 
+        ptrace(PTRACE_SYSCALL, tid, NULL, sig);
+    }
+    free(set.v);
+
+    /* 读不到/proc时退回主进程的rusage */
+    rst->time_used = cpu_ns / 1000000;
+    if (rst->time_used < msTime(&main_ru))
+        rst->time_used = msTime(&main_ru);
+    rst->memory_used = memory;
+    collectUsage(runobj, ctx, rst);
+    if (denied)
+        return 0;
+    if (WIFSIGNALED(main_status))
+        signalVerdict(runobj, rst, WTERMSIG(main_status));
+    else
+        exitVerdict(runobj, ctx, rst);
     return 0;
 }
 
 /* 不监控系统调用 */
-int waitExit(struct Runobj *runobj, struct Result *rst, pid_t pid) {
-    int status;
+int waitExit(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst,
+        pid_t pid) {
+    int status, r;
     struct rusage ru;
+    struct ShimReport rep;
 
     /* 等待子进程结束 */
     if (wait4(pid, &status, 0, &ru) == -1)
         RAISE_RUN("wait4 failure");
+    collectUsage(runobj, ctx, rst);
+
+    /* tree模式下等待的是shim，换成它报告的主进程状态和整棵树的资源占用。
+     * shim被杀死时主进程也随之被杀死，组中其余的进程在这里杀死 */
+    if (ctx->tree_fd != -1) {
+        do
+            r = read(ctx->tree_fd, &rep, sizeof(rep));
+        while (r == -1 && errno == EINTR);
+        close(ctx->tree_fd);
+        ctx->tree_fd = -1;
+        if (r == sizeof(rep)) {
+            status = rep.status;
+            ru = rep.ru;
+        }
+        else
+            kill(-ctx->tree_pid, SIGKILL);
+    }
 
     /* 获得子进程的资源占用 */
-    rst->time_used = ru.ru_utime.tv_sec * 1000
-                     + ru.ru_utime.tv_usec / 1000
-                     + ru.ru_stime.tv_sec * 1000
-                     + ru.ru_stime.tv_usec / 1000;
+    rst->time_used = msTime(&ru);
     //rst->memory_used = ru.ru_maxrss;
     rst->memory_used = ru.ru_minflt * (sysconf(_SC_PAGESIZE) / 1024);
     /* 判断是否为异常退出 */
-    if (WIFSIGNALED(status)) {
-        /* 获得退出原因 */
-        switch (WTERMSIG(status)) {
-            case SIGSEGV:
-                if (rst->memory_used > runobj->memory_limit)
-                    rst->judge_result = MLE;
-                else
-                    rst->judge_result = RE;
-                break;
-            case SIGALRM:
-            case SIGXCPU:
-                rst->judge_result = TLE;
-                break;
-            default:
-                rst->judge_result = RE;
-                break;
-        }
-        rst->re_signum = WTERMSIG(status);
+    if (WIFSIGNALED(status))
+        signalVerdict(runobj, rst, WTERMSIG(status));
+    else
+        exitVerdict(runobj, ctx, rst);
+
+    return 0;
+}
+
+/* 分配一次运行所需的缓冲区 */
+int initRunctx(struct Runctx *ctx, const struct Runobj *runobj) {
+    memset(ctx, 0, sizeof(struct Runctx));
+    ctx->insn_fd = -1;
+    ctx->tree_fd = -1;
+    if (runobj->trace) {
+        if ((ctx->path = (char*) malloc(runobj->path_max + 1)) == NULL)
+            RAISE_RUN("malloc path buffer failure");
+        ctx->path[0] = 0;
     }
-    else {
-        /* 判断是否超过限制，此处的AC并不代表正确，只是说明没有异常错误 */
-        if (rst->time_used > runobj->time_limit)
-            rst->judge_result = TLE;
-        else if (rst->memory_used > runobj->memory_limit)
-            rst->judge_result = MLE;
-        else
-            rst->judge_result = AC;
+    if (runobj->phases) {
+        ctx->phases = (unsigned long long*) calloc(PHASE_MAX,
+                sizeof(unsigned long long));
+        if (ctx->phases == NULL)
+            RAISE_RUN("malloc phases failure");
     }
-
     return 0;
 }
 
-int runit(struct Runobj *runobj, struct Result *rst) {
-    pid_t pid;
-    int fd_err[2];
+void freeRunctx(struct Runctx *ctx) {
+    free(ctx->path);
+    free(ctx->phases);
+    /* 只用{0}初始化、没有经过initRunctx的ctx中insn_fd为0 */
+    if (ctx->insn_fd > 0)
+        close(ctx->insn_fd);
+    if (ctx->tree_fd > 0)
+        close(ctx->tree_fd);
+    ctx->insn_fd = -1;
+    ctx->tree_fd = -1;
+    freeSampler(ctx->sampler);
+    ctx->sampler = NULL;
+    ctx->path = NULL;
+    ctx->phases = NULL;
+}
 
-    if (pipe2(fd_err, O_NONBLOCK))
-        RAISE1("run :pipe2(fd_err) failure");
+/* 本线程还有(运行中或未回收的)子进程 */
+static int hasChildren(void) {
+    siginfo_t info;
 
-    pid = vfork();
-    if (pid < 0) {
-        close(fd_err[0]);
-        close(fd_err[1]);
-        RAISE1("run : vfork failure");
-    }
+    return waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WCONTINUED | WNOHANG
+            | WNOWAIT | __WALL | __WNOTHREAD) == 0;
+}
 
-    if (pid == 0) {
-        close(fd_err[0]);
+static void closePair(int fd[2]) {
+    if (fd[0] != -1) {
+        close(fd[0]);
+        close(fd[1]);
+    }
+}
 
+/* vfork的子进程：设置好输入输出、限制和用户后exec，失败时把错误写到err_fd。
+ * shim不为0时是shim的子进程，shim结束时随之被杀死 */
+static void execChild(struct Runobj *runobj, struct Runctx *ctx, int err_fd,
+        int insn_fd, pid_t shim) {
 #define RAISE_EXIT(err) {\
-            int r = write(fd_err[1],err,strlen(err));\
-            _exit(r);\
+        int r = write(err_fd,err,strlen(err));\
+        _exit(r);\
+    }
+
+    /* 重定向输入输出和错误流 */
+    if (runobj->fd_in != -1)
+        if (dup2(runobj->fd_in, 0) == -1)
+            RAISE_EXIT("dup2 stdin failure!")
+
+    if (runobj->fd_out != -1)
+        if (dup2(runobj->fd_out, 1) == -1)
+            RAISE_EXIT("dup2 stdout failure")
+
+    if (runobj->fd_err != -1)
+        if (dup2(runobj->fd_err, 2) == -1)
+            RAISE_EXIT("dup2 stderr failure")
+
+    /* Python忽略了SIGPIPE和SIGXFSZ，忽略状态会被exec继承，恢复默认 */
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGXFSZ, SIG_DFL);
+
+    /* 进程树放在以子进程为首的进程组中，结束时整组杀死 */
+    if (runobj->tree && setpgid(0, 0) == -1)
+        RAISE_EXIT("setpgid failure")
+
+    /* 为进程设置限制 */
+    if (setResLimit(runobj, ctx) == -1)
+        RAISE_EXIT(ctx->err)
+
+    /* 在setuid之前打开，不受perf_event_paranoid对运行用户的限制 */
+    if (runobj->instructions)
+        sendCounter(insn_fd, openInsnCounter(runobj->insn_limit));
+
+    /* 修改运行用户(如果提供了此参数的话)，防止恶意代码或者自行修改限制
+     * glibc的setuid会通知父进程的所有线程，vfork后不能使用 */
+    if (runobj->runner != -1)
+        if (syscall(SYS_setuid, runobj->runner))
+            RAISE_EXIT("setuid failure")
+
+    /* setuid会清除PDEATHSIG，放在其后；shim此前已经结束时不再exec */
+    if (shim && (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1 || getppid() != shim))
+        RAISE_EXIT("prctl(PR_SET_PDEATHSIG) failure")
+
+    /* 监控系统调用(如果开启了的话)，防止恶意代码 */
+    if (runobj->trace)
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+            RAISE_EXIT("TRACEME failure")
+
+    /* 开始执行 */
+    MARK_PHASE(ctx->phases, PHASE_EXEC, exec);
+    if (runobj->exec_fd > 0) {
+        /* 由execveat(AT_EMPTY_PATH)执行，不经过文件系统查找 */
+        fexecve(runobj->exec_fd, (char * const *) runobj->args, environ);
+        RAISE_EXIT("fexecve failure")
+    }
+    execvp(runobj->args[0], (char * const *) runobj->args);
+
+    RAISE_EXIT("execvp failure")
+#undef RAISE_EXIT
+}
+
+/* 关闭from及以上除keep之外的描述符。shim由fork得到，不经过exec，
+ * 继承了父进程所有线程打开的描述符，包括其他运行的管道 */
+static void closeOtherFds(const int *keep, int n, int from) {
+    char buf[4096];
+    struct dirent64 *e;
+    struct rlimit rl;
+    int dir, fd, i, off, r;
+
+    if ((dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        /* 没有/proc时逐个关闭 */
+        if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur > 65536)
+            rl.rlim_cur = 65536;
+        for (fd = from; fd < (int) rl.rlim_cur; fd++) {
+            for (i = 0; i < n && keep[i] != fd; i++)
+                ;
+            if (i == n)
+                close(fd);
+        }
+        return;
+    }
+    /* 目录项在关闭时会变化，每次都从头读 */
+    do {
+        lseek(dir, 0, SEEK_SET);
+        r = syscall(SYS_getdents64, dir, buf, sizeof(buf));
+        for (off = 0; off < r; off += e->d_reclen) {
+            e = (struct dirent64 *) (buf + off);
+            if (e->d_name[0] < '0' || e->d_name[0] > '9')
+                continue;
+            fd = atoi(e->d_name);
+            for (i = 0; i < n && keep[i] != fd; i++)
+                ;
+            if (fd >= from && fd != dir && i == n && close(fd) == 0)
+                break;
         }
+    } while (r > 0 && off < r);
+    close(dir);
+}
 
-        /* 重定向输入输出和错误流 */
-        if (runobj->fd_in != -1)
-            if (dup2(runobj->fd_in, 0) == -1)
-                RAISE_EXIT("dup2 stdin failure!")
+static volatile pid_t shim_child;
 
-        if (runobj->fd_out != -1)
-            if (dup2(runobj->fd_out, 1) == -1)
-                RAISE_EXIT("dup2 stdout failure")
+/* shim把其他进程(如Process.kill)发来的信号转给主进程，
+ * 终端等内核产生的信号忽略 */
+static void forwardSignal(int sig, siginfo_t *info, void *unused) {
+    if (shim_child > 0 && info->si_code <= 0)
+        kill(shim_child, sig);
+}
 
-        if (runobj->fd_err != -1)
-            if (dup2(runobj->fd_err, 2) == -1)
-                RAISE_EXIT("dup2 stderr failure")
+/* 不跟踪的tree模式下fork出的shim，成为subreaper后启动主进程。主进程结束
+ * 时杀死并回收整个进程组，收养的孤儿进程也由它回收，从而RUSAGE_CHILDREN
+ * 包含整棵进程树。由多线程的父进程fork而来，只使用异步信号安全的调用 */
+static void runShim(struct Runobj *runobj, struct Runctx *ctx, int err_fd,
+        int insn_fd, int rep_fd) {
+    struct ShimReport rep;
+    struct sigaction sa;
+    struct timespec ms = {0, 1000000};
+    sigset_t all, old;
+    int keep[7], sig, status = 0, tries = 0;
+    pid_t self = getpid(), w;
+
+    /* 主进程需要的描述符之外都关闭，其余运行的管道不会因为shim而收不到EOF */
+    keep[0] = err_fd;
+    keep[1] = insn_fd;
+    keep[2] = rep_fd;
+    keep[3] = runobj->fd_in;
+    keep[4] = runobj->fd_out;
+    keep[5] = runobj->fd_err;
+    keep[6] = runobj->exec_fd;
+    closeOtherFds(keep, 7, STDERR_FILENO + 1);
+
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old);
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+        sig = write(err_fd, "prctl(PR_SET_CHILD_SUBREAPER) failure", 37);
+        _exit(1);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = forwardSignal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    for (sig = 1; sig < NSIG; sig++)
+        if (sig != SIGKILL && sig != SIGSTOP && sig != SIGCHLD)
+            sigaction(sig, &sa, NULL);
+    /* 忽略SIGCHLD时子进程自动回收，不计入RUSAGE_CHILDREN */
+    signal(SIGCHLD, SIG_DFL);
+
+    shim_child = vfork();
+    if (shim_child == 0) {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        MARK_PHASE(ctx->phases, PHASE_FORKED, forked);
+        execChild(runobj, ctx, err_fd, insn_fd, self);
+    }
+    if (shim_child == -1) {
+        sig = write(err_fd, "vfork failure", 13);
+        _exit(1);
+    }
+
+    /* 主进程exec失败时错误已经写到err_fd，父进程据此回收shim */
+    memset(&rep, 0, sizeof(rep));
+    rep.pid = shim_child;
+    if (ctx->phases) {
+        rep.forked = ctx->phases[PHASE_FORKED];
+        rep.exec = ctx->phases[PHASE_EXEC];
+    }
+    closeOtherFds(&rep_fd, 1, 0);
+    if (write(rep_fd, &rep, sizeof(rep)) != sizeof(rep))
+        kill(shim_child, SIGKILL);
+    sigemptyset(&all);
+    sigprocmask(SIG_SETMASK, &all, NULL);
+
+    while ((w = wait4(-1, &status, 0, NULL)) != shim_child)
+        if (w == -1 && errno != EINTR)
+            break;
+    rep.status = status;
+
+    /* 被杀死的进程在其父进程结束后才由shim收养，组还不空时等待 */
+    kill(-shim_child, SIGKILL);
+    while (1) {
+        w = wait4(-shim_child, NULL, 0, NULL);
+        if (w > 0 || (w == -1 && errno == EINTR))
+            continue;
+        if (kill(-shim_child, 0) == -1 || ++tries > SHIM_DRAIN_TRIES)
+            break;
+        nanosleep(&ms, NULL);
+    }
 
-        /* 为进程设置限制 */
-        if (setResLimit(runobj) == -1)
-            RAISE_EXIT(last_limit_err)
+    getrusage(RUSAGE_CHILDREN, &rep.ru);
+    sig = write(rep_fd, &rep, sizeof(rep));
+    _exit(0);
+}
 
-        /* 修改运行用户(如果提供了此参数的话)，防止恶意代码或者自行修改限制 */
-        if (runobj->runner != -1)
-            if (setuid(runobj->runner))
-                RAISE_EXIT("setuid failure")
+/* 启动子进程，返回时子进程已经exec，不等待其结束。
+ * 不跟踪的tree模式下启动的是shim，*pid_out为shim */
+int spawnRun(struct Runobj *runobj, struct Runctx *ctx, pid_t *pid_out) {
+    pid_t pid;
+    int fd_err[2], fd_insn[2] = {-1, -1}, fd_rep[2] = {-1, -1};
+    int shim = runobj->tree && !runobj->trace;
+    struct ShimReport rep;
+
+    /* tree模式的跟踪循环等待本线程的任意子进程，其他子进程会被当作被跟踪的
+     * 进程回收，例如同一线程中spawn启动的Process */
+    if (runobj->trace && runobj->tree && hasChildren())
+        RAISE_RUN("run : tree mode needs a thread with no other child processes");
+
+    if (pipe2(fd_err, O_NONBLOCK | O_CLOEXEC))
+        RAISE_RUN("run :pipe2(fd_err) failure");
+
+    /* 子进程通过它把指令计数器交给父进程 */
+    if (runobj->instructions && socketpair(AF_UNIX,
+            SOCK_DGRAM | SOCK_CLOEXEC, 0, fd_insn)) {
+        closePair(fd_err);
+        RAISE_RUN("run : socketpair(fd_insn) failure");
+    }
 
-        /* 监控系统调用(如果开启了的话)，防止恶意代码 */
-        if (runobj->trace)
-            if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
-                RAISE_EXIT("TRACEME failure")
+    /* shim通过它报告主进程和结果 */
+    if (shim && pipe2(fd_rep, O_CLOEXEC)) {
+        closePair(fd_err);
+        closePair(fd_insn);
+        RAISE_RUN("run : pipe2(fd_rep) failure");
+    }
 
-        /* 开始执行 */
-        execvp(runobj->args[0], (char * const *) runobj->args);
+    /* shim要与父进程并行运行，只能fork */
+    pid = shim ? fork() : vfork();
+    if (pid < 0) {
+        closePair(fd_err);
+        closePair(fd_insn);
+        closePair(fd_rep);
+        RAISE_RUN(shim ? "run : fork failure" : "run : vfork failure");
+    }
 
-        RAISE_EXIT("execvp failure")
+    if (pid == 0) {
+        if (shim)
+            runShim(runobj, ctx, fd_err[1], fd_insn[1], fd_rep[1]);
+        MARK_PHASE(ctx->phases, PHASE_FORKED, forked);
+        close(fd_err[0]);
+        execChild(runobj, ctx, fd_err[1], fd_insn[1], 0);
     }
     else {
         int r;
-        char errbuffer[100] = { 0 };
 
         close(fd_err[1]);
-        r = read(fd_err[0], errbuffer, 90);
+        if (shim) {
+            /* shim在主进程exec或失败之后报告，此时错误信息也已写好 */
+            close(fd_rep[1]);
+            do
+                r = read(fd_rep[0], &rep, sizeof(rep));
+            while (r == -1 && errno == EINTR);
+            if (ctx->tree_fd != -1)
+                close(ctx->tree_fd);
+            ctx->tree_fd = -1;
+            if (r == sizeof(rep)) {
+                ctx->tree_fd = fd_rep[0];
+                ctx->tree_pid = rep.pid;
+                if (ctx->phases) {
+                    ctx->phases[PHASE_FORKED] = rep.forked;
+                    ctx->phases[PHASE_EXEC] = rep.exec;
+                }
+            }
+            else
+                close(fd_rep[0]);
+        }
+        MARK_PHASE(ctx->phases, PHASE_SPAWNED, spawned);
+
+        r = read(fd_err[0], ctx->errbuf, RUN_ERR_MAX - 1);
         close(fd_err[0]);
-        if (r > 0) {
-            waitpid(pid, NULL, WNOHANG);
-            RAISE(errbuffer);
-            return -1;
+        if (shim && ctx->tree_fd == -1 && r <= 0)
+            r = snprintf(ctx->errbuf, RUN_ERR_MAX, "run : tree shim failure");
+
+        if (fd_insn[0] != -1) {
+            close(fd_insn[1]);
+            if (ctx->insn_fd != -1)
+                close(ctx->insn_fd);
+            ctx->insn_fd = r > 0 ? -1 : recvCounter(fd_insn[0]);
+            close(fd_insn[0]);
         }
 
-        /* 根据是否提供trace来决定使用哪种运行方式 */
-        if (runobj->trace)
-            r = traceLoop(runobj, rst, pid);
-        else
-            r = waitExit(runobj, rst, pid);
+        if (r > 0) {
+            ctx->errbuf[r] = 0;
+            if (ctx->tree_fd != -1) {
+                close(ctx->tree_fd);
+                ctx->tree_fd = -1;
+            }
+            waitpid(pid, NULL, 0);
+            RAISE_RUN(ctx->errbuf);
+        }
 
-        if (r)
-            RAISE1(last_run_err);
+        ctx->spawned = monotonicNs();
+        ctx->exited = 0;
+        if (runobj->sample > 0) {
+            freeSampler(ctx->sampler);
+            ctx->sampler = startSampler(shim ? ctx->tree_pid : pid,
+                    runobj->sample);
+        }
+        *pid_out = pid;
         return 0;
     }
+    return -1;
+}
+
+/* 等待spawnRun启动的子进程并填写结果 */
+int waitRun(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst,
+        pid_t pid) {
+    int ret;
+
+    rst->instructions = runobj->instructions ? INSN_UNAVAILABLE : INSN_OFF;
+    rst->wall_used = -1;
+    rst->samples = NULL;
+    rst->nsamples = 0;
+
+    /* 根据是否提供trace来决定使用哪种运行方式 */
+    if (runobj->trace && runobj->tree)
+        ret = treeTraceLoop(runobj, ctx, rst, pid);
+    else if (runobj->trace)
+        ret = traceLoop(runobj, ctx, rst, pid);
+    else
+        ret = waitExit(runobj, ctx, rst, pid);
+    collectUsage(runobj, ctx, rst);
+    if (ctx->sampler) {
+        stopSampler(ctx->sampler);
+        rst->samples = ctx->sampler->v;
+        rst->nsamples = ctx->sampler->n;
+    }
+    MARK_PHASE(ctx->phases, PHASE_EXITED, exited);
+    return ret;
+}
+
+int runit(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst) {
+    pid_t pid;
+
+    if (spawnRun(runobj, ctx, &pid))
+        return -1;
+    return waitRun(runobj, ctx, rst, pid);
 }
 
+/* 让内核异步读入fd的内容，下一个测试点的数据在当前运行期间进入页缓存 */
+void prefetchFd(int fd) {
+    if (fd >= 0)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+}
+
+/* 子进程结束时可读的pidfd，内核不支持(早于5.3)时返回-1 */
+int openPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int signalPidfd(int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -19,8 +19,17 @@
 #ifndef __LO_RUN_HEADER
 #define __LO_RUN_HEADER
 
-#include "lorun.h"
+#include "core.h"
 
-int runit(struct Runobj *runobj, struct Result *rst);
+int initRunctx(struct Runctx *ctx, const struct Runobj *runobj);
+void freeRunctx(struct Runctx *ctx);
+int spawnRun(struct Runobj *runobj, struct Runctx *ctx, pid_t *pid_out);
+int waitRun(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst,
+        pid_t pid);
+int runit(struct Runobj *runobj, struct Runctx *ctx, struct Result *rst);
+void markExited(struct Runctx *ctx);
+void prefetchFd(int fd);
+int openPidfd(pid_t pid);
+int signalPidfd(int pidfd, int sig);
 
 #endif
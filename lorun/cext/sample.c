@@ -0,0 +1,151 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sample.h"
+#include "phase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+/* 读取一个采样点，子进程已经被回收时返回-1 */
+static int readSample(struct Sampler *s, struct Sample *out) {
+    static long tick = 0, page = 0;
+    unsigned long utime, stime, rss;
+    char buf[1024], *p;
+    ssize_t r;
+
+    if (!tick) {
+        tick = sysconf(_SC_CLK_TCK);
+        page = sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    /* /proc/<pid>/stat的第二项(comm)可能含空格，从最后一个')'之后开始解析 */
+    if ((r = pread(s->stat_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return -1;
+    buf[r] = 0;
+    if ((p = strrchr(buf, ')')) == NULL || sscanf(p + 2,
+            "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime) != 2)
+        return -1;
+
+    if ((r = pread(s->statm_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return -1;
+    buf[r] = 0;
+    if (sscanf(buf, "%*u %lu", &rss) != 1)
+        return -1;
+
+    out->ms = (monotonicNs() - s->start) / 1000000;
+    out->cpu_ms = (utime + stime) * 1000 / tick;
+    out->rss_kb = rss * page;
+    return 0;
+}
+
+static void *samplerLoop(void *arg) {
+    struct Sampler *s = (struct Sampler *) arg;
+    struct timespec deadline;
+    unsigned long long next;
+    int i;
+
+    pthread_mutex_lock(&s->lock);
+    next = s->start;
+    while (!s->stop) {
+        if (s->n == SAMPLES_MAX) {
+            for (i = 0; i < SAMPLES_MAX / 2; i++)
+                s->v[i] = s->v[i * 2];
+            s->n = SAMPLES_MAX / 2;
+            s->interval *= 2;
+        }
+        if (readSample(s, &s->v[s->n]))
+            break;
+        s->n++;
+
+        next += (unsigned long long) s->interval * 1000000;
+        deadline.tv_sec = next / 1000000000;
+        deadline.tv_nsec = next % 1000000000;
+        while (!s->stop && pthread_cond_timedwait(&s->cond, &s->lock,
+                &deadline) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* 在spawnRun中子进程exec之后调用，失败时返回NULL，运行不受影响 */
+struct Sampler *startSampler(pid_t pid, int interval) {
+    struct Sampler *s;
+    pthread_condattr_t attr;
+    char path[64];
+
+    if ((s = (struct Sampler *) calloc(1, sizeof(struct Sampler))) == NULL)
+        return NULL;
+    if ((s->v = (struct Sample *) malloc(SAMPLES_MAX
+            * sizeof(struct Sample))) == NULL) {
+        free(s);
+        return NULL;
+    }
+    s->interval = interval;
+    s->start = monotonicNs();
+
+    /* 打开后一直使用同一个fd，子进程被回收后读取失败，不会读到重用pid的进程 */
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    s->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int) pid);
+    s->statm_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (s->stat_fd == -1 || s->statm_fd == -1
+            || pthread_create(&s->thread, NULL, samplerLoop, s)) {
+        s->stop = -1;
+        freeSampler(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* 停止并等待采样线程，保留已有的采样，可以重复调用 */
+void stopSampler(struct Sampler *s) {
+    if (s->stop)
+        return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+}
+
+void freeSampler(struct Sampler *s) {
+    if (s == NULL)
+        return;
+    stopSampler(s);
+    if (s->stat_fd != -1)
+        close(s->stat_fd);
+    if (s->statm_fd != -1)
+        close(s->statm_fd);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s->v);
+    free(s);
+}
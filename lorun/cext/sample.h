@@ -0,0 +1,47 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_SAMPLE_HEADER
+#define __LO_SAMPLE_HEADER
+
+#include "core.h"
+#include <pthread.h>
+
+/* 最多保留的采样数，满了以后隔一个丢弃并把间隔加倍 */
+#define SAMPLES_MAX 1024
+
+/* 在父进程的线程中定期读取子进程的/proc/<pid>/stat和statm */
+struct Sampler {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+
+    int stat_fd, statm_fd;
+    int interval;               //当前采样间隔(毫秒)
+    unsigned long long start;   //开始采样的单调时间
+
+    struct Sample *v;
+    int n;
+};
+
+struct Sampler *startSampler(pid_t pid, int interval);
+void stopSampler(struct Sampler *s);
+void freeSampler(struct Sampler *s);
+
+#endif
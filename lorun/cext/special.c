@@ -3,86 +3,152 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/user.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include "limit.h"
+#include "phase.h"
 
-char * special_judge(struct Runobj *spjobj)
+/* 启动spj，stdout写入memfd，不等待spj结束。失败时设置ctx->err */
+int spawnSpecial(struct Runobj *spjobj, struct Runctx *ctx, pid_t *pid_out,
+        int *out_fd)
 {
     pid_t pid;
-    int fd_err[2];
-    char * outbuffer;
-    outbuffer = (char * ) malloc (sizeof(char) * 110);
-
-#define RAISE_EXITC(out) {\
-            strcpy(outbuffer, out);\
-            return outbuffer;\
-        }
+    int fd, null_fd;
 
-    if (pipe(fd_err) < 0)
-        RAISE_EXITC("special: pip(fd_err) failure");
+    if ((fd = memfd_create("lorun-special", MFD_CLOEXEC)) == -1) {
+        ctx->err = "special: memfd_create failure";
+        return -1;
+    }
+    /* 没有给出的stdin和stderr接到/dev/null，不交给spj调用者自己的 */
+    if ((null_fd = open("/dev/null", O_RDWR | O_CLOEXEC)) == -1) {
+        close(fd);
+        ctx->err = "special: open /dev/null failure";
+        return -1;
+    }
 
+    ctx->errbuf[0] = 0;
     pid = vfork();
     if (pid < 0) {
-        close(fd_err[0]);
-        close(fd_err[1]);
-        RAISE_EXITC("special : vfork failure");
+        close(fd);
+        close(null_fd);
+        ctx->err = "special : vfork failure";
+        return -1;
     }
 
     if (pid == 0) {
-        close(fd_err[0]);
+        MARK_PHASE(ctx->phases, PHASE_FORKED, forked);
+/* vfork的子进程与父进程共享内存，直接把错误写入ctx */
+#define RAISE_CHILD(out) {\
+            strncpy(ctx->errbuf, out, RUN_ERR_MAX - 1);\
+            _exit(127);\
+        }
         /* 重定向stdout流 */
-        if (dup2(fd_err[1], STDOUT_FILENO) == -1)
-            RAISE_EXITC("dup2 stderr failure!")
+        if (dup2(fd, STDOUT_FILENO) == -1)
+            RAISE_CHILD("dup2 stdout failure!")
+        /* 给出fd_in时作为spj的标准输入，例如被测程序的输出 */
+        if (dup2(spjobj->fd_in != -1 ? spjobj->fd_in : null_fd,
+                STDIN_FILENO) == -1)
+            RAISE_CHILD("dup2 stdin failure!")
+        if (dup2(null_fd, STDERR_FILENO) == -1)
+            RAISE_CHILD("dup2 stderr failure!")
         /* 为spj过程设置限制 */
-        if (setResLimit(spjobj) == -1)
-            RAISE_EXITC(last_limit_err)
+        if (setResLimit(spjobj, ctx) == -1)
+            RAISE_CHILD(ctx->err)
         /* 修改运行用户(为确保安全，请务必提供此参数) */
         if (spjobj->runner != -1)
-            if (setuid(spjobj->runner))
-                RAISE_EXITC("setuid failure")
+            if (syscall(SYS_setuid, spjobj->runner))
+                RAISE_CHILD("setuid failure")
 
         /* 开始spj */
+        MARK_PHASE(ctx->phases, PHASE_EXEC, exec);
         execvp(spjobj->args[0], (char * const *) spjobj->args);
 
-        RAISE_EXITC("execvp failure")
+        RAISE_CHILD("execvp failure")
+    }
+
+    MARK_PHASE(ctx->phases, PHASE_SPAWNED, spawned);
+    close(null_fd);
+    if (ctx->errbuf[0]) {
+        waitpid(pid, NULL, 0);
+        close(fd);
+        ctx->err = ctx->errbuf;
+        return -1;
     }
-    else {
-        close(fd_err[1]);
 
-        int r;
-        int status;
-        struct rusage ru;
+    *pid_out = pid;
+    *out_fd = fd;
+    return 0;
+}
+
+/* 等待spj结束并关闭out_fd，通过测试返回NULL，否则返回spj的输出 */
+char * finishSpecial(struct Runctx *ctx, pid_t pid, int out_fd)
+{
+    int status;
+    ssize_t r;
+    struct rusage ru;
+    char * outbuffer;
+    outbuffer = (char * ) malloc (sizeof(char) * 110);
 
-        /* 等待spj结束 */
-        if (wait4(pid, &status, 0, &ru) == -1)
-            RAISE_EXITC("wait4 failure")
+    /* 等待spj结束 */
+    if (wait4(pid, &status, 0, &ru) == -1) {
+        close(out_fd);
+        strcpy(outbuffer, "wait4 failure");
+        return outbuffer;
+    }
+    MARK_PHASE(ctx->phases, PHASE_EXITED, exited);
 
-        /* 判断是否发生异常 */
-        if (status || WIFSIGNALED(status)) {
-            /* 程序运行无异常，结果错误 */
-            if (status == 256) {
-                r = read(fd_err[0], outbuffer, 100);
-                outbuffer[r] = '\0';
-                return outbuffer;
-            }
-            switch (WTERMSIG(status)) {
-                /* 若编译期间占用资源超出限制 */
-                case SIGSEGV:
-                case SIGALRM:
-                case SIGXCPU:
-                    strcpy(outbuffer, "special error\n");
-                    break;
-                default:
-                    /* 读取spj输出的前一百个字符 */
-                    r = read(fd_err[0], outbuffer, 100);
-                    outbuffer[r] = '\0';
-                    break;
-            }
+    /* 判断是否发生异常 */
+    if (status || WIFSIGNALED(status)) {
+        /* 程序运行无异常，结果错误 */
+        if (status == 256) {
+            r = pread(out_fd, outbuffer, 100, 0);
+            outbuffer[r > 0 ? r : 0] = '\0';
+            close(out_fd);
+            MARK_PHASE(ctx->phases, PHASE_COLLECTED, collected);
             return outbuffer;
         }
-        else
-            return NULL;
+        switch (WTERMSIG(status)) {
+            /* 若编译期间占用资源超出限制 */
+            case SIGSEGV:
+            case SIGALRM:
+            case SIGXCPU:
+            case SIGPROF:
+                strcpy(outbuffer, "special error\n");
+                break;
+            default:
+                /* 读取spj输出的前一百个字符 */
+                r = pread(out_fd, outbuffer, 100, 0);
+                outbuffer[r > 0 ? r : 0] = '\0';
+                break;
+        }
     }
-}
\ No newline at end of file
+    else {
+        free(outbuffer);
+        outbuffer = NULL;
+    }
+
+    close(out_fd);
+    MARK_PHASE(ctx->phases, PHASE_COLLECTED, collected);
+    return outbuffer;
+}
+
+/* ctx由调用者用initRunctx初始化 */
+char * special_judge(struct Runobj *spjobj, struct Runctx *ctx)
+{
+    pid_t pid;
+    int out_fd;
+    char * outbuffer;
+
+    if (spawnSpecial(spjobj, ctx, &pid, &out_fd)) {
+        outbuffer = (char * ) malloc (sizeof(char) * 110);
+        strncpy(outbuffer, ctx->err, 109);
+        outbuffer[109] = '\0';
+        return outbuffer;
+    }
+
+    return finishSpecial(ctx, pid, out_fd);
+}
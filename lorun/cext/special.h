@@ -1,8 +1,11 @@
 #ifndef __SPECIAL_HEADER
 #define __SPECIAL_HEADER
 
-#include "lorun.h"
+#include "core.h"
 
-char * special_judge(struct Runobj *spjobj);
+int spawnSpecial(struct Runobj *spjobj, struct Runctx *ctx, pid_t *pid_out,
+        int *out_fd);
+char * finishSpecial(struct Runctx *ctx, pid_t pid, int out_fd);
+char * special_judge(struct Runobj *spjobj, struct Runctx *ctx);
 
 #endif
\ No newline at end of file
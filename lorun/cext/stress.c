@@ -0,0 +1,304 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stress.h"
+#include "run.h"
+#include "diff.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKERS_MAX 256
+#define SEED_MAX 24
+
+/* 一个线程的运行环境，三个程序各有自己的ctx */
+struct StressWorker {
+    struct Stress *st;
+    struct Runobj gen, ref, cand;
+    struct Runctx gen_ctx, ref_ctx, cand_ctx;
+    int null_fd;                //生成器的标准输入
+    int in_fd, ans_fd, out_fd;  //每轮复用的memfd，失败时交给st
+    const char **gen_args;      //生成器的args加上轮次
+    char seed[SEED_MAX];
+};
+
+#define RAISE_STRESS(msg) {ctx->err = msg;return -1;}
+
+/* 清空memfd，作为下一步的标准输出 */
+static int resetFd(int fd, struct Runctx *ctx)
+{
+    if (ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET))
+        RAISE_STRESS("stress: reset memfd failure");
+    return 0;
+}
+
+/* 通过/proc重新打开输入，读取偏移从0开始 */
+static int reopenFd(int fd, struct Runctx *ctx)
+{
+    char path[32];
+    int r;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    if ((r = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        RAISE_STRESS("stress: reopen memfd failure");
+    return r;
+}
+
+static int newMemfds(struct StressWorker *w)
+{
+    w->in_fd = memfd_create("lorun-stress-in", MFD_CLOEXEC);
+    w->ans_fd = memfd_create("lorun-stress-ans", MFD_CLOEXEC);
+    w->out_fd = memfd_create("lorun-stress-out", MFD_CLOEXEC);
+    return w->in_fd == -1 || w->ans_fd == -1 || w->out_fd == -1 ? -1 : 0;
+}
+
+static void closeFd(int *fd)
+{
+    if (*fd != -1)
+        close(*fd);
+    *fd = -1;
+}
+
+/* 记录第k轮的失败，只保留最小的轮次。取走本轮的memfd，换上新的 */
+static int recordFailure(struct StressWorker *w, long k, int stage,
+        struct Result *rst, struct Runctx *ctx)
+{
+    struct Stress *st = w->st;
+    int ret = 0;
+
+    pthread_mutex_lock(&st->lock);
+    if (st->failed == -1 || k < st->failed) {
+        st->failed = k;
+        st->stage = stage;
+        if (st->rst.re_file)
+            free((char *) st->rst.re_file);
+        st->rst = *rst;
+        /* re_file指向本线程的ctx->path，下一次运行会覆盖 */
+        if (rst->re_file && (st->rst.re_file = strdup(rst->re_file)) == NULL)
+            st->rst.re_file = NULL;
+        st->rst.stats = NULL;
+        st->rst.samples = NULL;
+        st->rst.nsamples = 0;
+        closeFd(&st->in_fd);
+        closeFd(&st->ans_fd);
+        closeFd(&st->out_fd);
+        st->in_fd = w->in_fd;
+        st->ans_fd = w->ans_fd;
+        st->out_fd = w->out_fd;
+        if (newMemfds(w)) {
+            ctx->err = "stress: memfd_create failure";
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
+
+/* 运行一步，stdin和stdout已经设置好。返回1表示这一步失败 */
+static int runStep(struct Runobj *runobj, struct Runctx *ctx,
+        struct Result *rst)
+{
+    memset(rst, 0, sizeof(struct Result));
+    rst->re_call = -1;
+    if (runit(runobj, ctx, rst))
+        return -1;
+    return rst->judge_result != AC;
+}
+
+/* 第k轮，系统错误时返回-1并设置ctx->err */
+static int runIteration(struct StressWorker *w, long k, struct Runctx **err)
+{
+    struct Result rst;
+    int ret, stage;
+
+    snprintf(w->seed, sizeof(w->seed), "%ld", k);
+
+    *err = &w->gen_ctx;
+    if (resetFd(w->in_fd, &w->gen_ctx))
+        return -1;
+    w->gen.fd_in = w->null_fd;
+    w->gen.fd_out = w->in_fd;
+    stage = STRESS_GENERATOR;
+    if ((ret = runStep(&w->gen, &w->gen_ctx, &rst)))
+        goto out;
+
+    *err = &w->ref_ctx;
+    if (resetFd(w->ans_fd, &w->ref_ctx)
+            || (w->ref.fd_in = reopenFd(w->in_fd, &w->ref_ctx)) == -1)
+        return -1;
+    w->ref.fd_out = w->ans_fd;
+    stage = STRESS_REFERENCE;
+    ret = runStep(&w->ref, &w->ref_ctx, &rst);
+    close(w->ref.fd_in);
+    if (ret)
+        goto out;
+
+    *err = &w->cand_ctx;
+    if (resetFd(w->out_fd, &w->cand_ctx)
+            || (w->cand.fd_in = reopenFd(w->in_fd, &w->cand_ctx)) == -1)
+        return -1;
+    w->cand.fd_out = w->out_fd;
+    stage = STRESS_CANDIDATE;
+    ret = runStep(&w->cand, &w->cand_ctx, &rst);
+    close(w->cand.fd_in);
+    if (ret == 0) {
+        if (checkDiff(w->ans_fd, w->out_fd, &rst.judge_result, &w->cand_ctx))
+            return -1;
+        ret = rst.judge_result != AC;
+    }
+
+out:
+    if (ret == 1)
+        ret = recordFailure(w, k, stage, &rst, *err);
+    return ret;
+}
+
+/* 失败时返回错误信息 */
+static const char *initWorker(struct StressWorker *w, struct Stress *st)
+{
+    int n;
+
+    memset(w, 0, sizeof(struct StressWorker));
+    w->st = st;
+    w->in_fd = w->ans_fd = w->out_fd = w->null_fd = -1;
+    w->gen = *st->gen;
+    w->ref = *st->ref;
+    w->cand = *st->cand;
+    /* 输出都在内存中，超过MAX_OUTPUT时收到SIGXFSZ */
+    w->gen.output_limit = w->ref.output_limit = w->cand.output_limit =
+        MAX_OUTPUT;
+    if (initRunctx(&w->gen_ctx, &w->gen) || initRunctx(&w->ref_ctx, &w->ref)
+            || initRunctx(&w->cand_ctx, &w->cand))
+        return "stress: init run context failure";
+
+    for (n = 0; st->gen->args[n]; n++)
+        ;
+    if ((w->gen_args = (const char **) malloc((n + 2) * sizeof(char *)))
+            == NULL)
+        return "stress: malloc args failure";
+    memcpy(w->gen_args, st->gen->args, n * sizeof(char *));
+    w->gen_args[n] = w->seed;
+    w->gen_args[n + 1] = NULL;
+    w->gen.args = (char * const *) w->gen_args;
+
+    if ((w->null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) == -1
+            || newMemfds(w))
+        return "stress: open memfd failure";
+    return NULL;
+}
+
+static void freeWorker(struct StressWorker *w)
+{
+    freeRunctx(&w->gen_ctx);
+    freeRunctx(&w->ref_ctx);
+    freeRunctx(&w->cand_ctx);
+    free(w->gen_args);
+    closeFd(&w->null_fd);
+    closeFd(&w->in_fd);
+    closeFd(&w->ans_fd);
+    closeFd(&w->out_fd);
+}
+
+static void *stressWorker(void *arg) {
+    struct Stress *st = (struct Stress *) arg;
+    struct StressWorker w;
+    struct Runctx *ctx;
+    const char *err;
+    long k;
+
+    if ((err = initWorker(&w, st)) != NULL) {
+        pthread_mutex_lock(&st->lock);
+        if (st->err[0] == 0)
+            strncpy(st->err, err, RUN_ERR_MAX - 1);
+        pthread_mutex_unlock(&st->lock);
+    }
+
+    while (1) {
+        /* 发现失败后不再领取新的轮次，它们都比失败的轮次大 */
+        pthread_mutex_lock(&st->lock);
+        if (st->next >= st->iterations || st->failed != -1 || st->err[0]) {
+            pthread_mutex_unlock(&st->lock);
+            break;
+        }
+        k = st->next++;
+        pthread_mutex_unlock(&st->lock);
+
+        if (runIteration(&w, k, &ctx) == -1) {
+            pthread_mutex_lock(&st->lock);
+            if (st->err[0] == 0)
+                strncpy(st->err, ctx->err, RUN_ERR_MAX - 1);
+            pthread_mutex_unlock(&st->lock);
+            break;
+        }
+    }
+    freeWorker(&w);
+    return NULL;
+}
+
+/* 调用者填好gen/ref/cand、iterations和workers。
+ * 不调用Python API，可以释放GIL。系统错误时返回-1，错误信息在err中 */
+int runStress(struct Stress *st) {
+    pthread_t threads[WORKERS_MAX];
+    long n;
+    int i;
+
+    st->failed = -1;
+    st->in_fd = st->ans_fd = st->out_fd = -1;
+    st->err[0] = 0;
+    st->next = 0;
+    memset(&st->rst, 0, sizeof(struct Result));
+    n = st->workers;
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > st->iterations)
+        n = st->iterations;
+    if (n > WORKERS_MAX)
+        n = WORKERS_MAX;
+    if (n <= 0)
+        return 0;
+    if (pthread_mutex_init(&st->lock, NULL)) {
+        strcpy(st->err, "stress: init lock failure");
+        return -1;
+    }
+
+    /* 创建线程失败时由已有的线程(或当前线程)完成剩余的轮次 */
+    for (i = 0; i < n; i++)
+        if (pthread_create(&threads[i], NULL, stressWorker, st))
+            break;
+    if (i == 0)
+        stressWorker(st);
+    n = i;
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&st->lock);
+    return st->err[0] ? -1 : 0;
+}
+
+/* 释放失败轮次的memfd和re_file */
+void freeStress(struct Stress *st) {
+    if (st->rst.re_file)
+        free((char *) st->rst.re_file);
+    st->rst.re_file = NULL;
+    closeFd(&st->in_fd);
+    closeFd(&st->ans_fd);
+    closeFd(&st->out_fd);
+}
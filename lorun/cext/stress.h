@@ -0,0 +1,53 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_STRESS_HEADER
+#define __LO_STRESS_HEADER
+
+#include "core.h"
+#include <pthread.h>
+
+/* 失败发生在哪一步 */
+enum STRESS_STAGE {
+    STRESS_GENERATOR = 0,   //生成器没有正常结束
+    STRESS_REFERENCE,       //标准程序没有正常结束
+    STRESS_CANDIDATE,       //被测程序没有正常结束或输出与标准程序不同
+};
+
+/* 对拍：第k轮执行 gen ... k > in，ref < in > ans，cand < in > out，
+ * 再按checkDiff比较ans和out。多个线程并行，每轮的数据都在memfd中 */
+struct Stress {
+    struct Runobj *gen, *ref, *cand;    //只用到args和限制，fd由各轮设置
+    long iterations;
+    int workers;
+
+    /* 结果：失败轮次中最小的一轮，没有失败时failed为-1 */
+    long failed;
+    int stage;                  //STRESS_STAGE
+    struct Result rst;          //失败那一步的结果，re_file由freeStress释放
+    int in_fd, ans_fd, out_fd;  //失败轮次的输入和两份输出，没有时为-1
+    char err[RUN_ERR_MAX];      //系统错误，err[0]不为0时runStress返回-1
+
+    pthread_mutex_t lock;
+    long next;      //下一个待领取的轮次
+};
+
+int runStress(struct Stress *st);
+void freeStress(struct Stress *st);
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testset.h"
+
+/* Testset(path) */
+static int Testset_init(TestsetObject *self, PyObject *args, PyObject *kwds)
+{
+    struct Runctx ctx = {0};
+    const char *path;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return -1;
+    if (self->exports)
+        RAISE1("Testset is in use");
+    closePack(&self->pack);
+    Py_BEGIN_ALLOW_THREADS
+    ret = openPack(&self->pack, path, &ctx);
+    Py_END_ALLOW_THREADS
+    if (ret)
+        RAISE1(ctx.err);
+    return 0;
+}
+
+static void Testset_dealloc(TestsetObject *self)
+{
+    closePack(&self->pack);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static const struct PackCase *getCase(TestsetObject *self, PyObject *args)
+{
+    Py_ssize_t i;
+
+    if (!PyArg_ParseTuple(args, "n", &i))
+        return NULL;
+    if (i < 0)
+        i += self->pack.n;
+    if (i < 0 || i >= (Py_ssize_t) self->pack.n) {
+        PyErr_SetString(PyExc_IndexError, "case out of range");
+        return NULL;
+    }
+    return &self->pack.cases[i];
+}
+
+/* 返回映射中[data, data+len)的只读memoryview，不复制 */
+static PyObject *sliceView(TestsetObject *self, const char *data, size_t len)
+{
+    PyObject *view, *r;
+    Py_ssize_t off = data - self->pack.base;
+
+    if ((view = PyMemoryView_FromObject((PyObject *) self)) == NULL)
+        return NULL;
+    r = PySequence_GetSlice(view, off, off + len);
+    Py_DECREF(view);
+    return r;
+}
+
+static PyObject *Testset_input(TestsetObject *self, PyObject *args)
+{
+    const struct PackCase *c;
+
+    if ((c = getCase(self, args)) == NULL)
+        return NULL;
+    return sliceView(self, c->in, c->in_len);
+}
+
+static PyObject *Testset_answer(TestsetObject *self, PyObject *args)
+{
+    const struct PackCase *c;
+
+    if ((c = getCase(self, args)) == NULL)
+        return NULL;
+    return sliceView(self, c->ans, c->ans_len);
+}
+
+static PyObject *Testset_name(TestsetObject *self, PyObject *args)
+{
+    const struct PackCase *c;
+
+    if ((c = getCase(self, args)) == NULL)
+        return NULL;
+    return PyString_FromString(c->name);
+}
+
+static Py_ssize_t Testset_length(TestsetObject *self)
+{
+    return self->pack.n;
+}
+
+static int Testset_getbuffer(TestsetObject *self, Py_buffer *view, int flags)
+{
+    if (self->pack.base == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Testset is not opened");
+        view->obj = NULL;
+        return -1;
+    }
+    if (PyBuffer_FillInfo(view, (PyObject *) self, (void *) self->pack.base,
+            self->pack.size, 1, flags))
+        return -1;
+    self->exports++;
+    return 0;
+}
+
+static void Testset_releasebuffer(TestsetObject *self, Py_buffer *view)
+{
+    self->exports--;
+}
+
+static PyMethodDef Testset_methods[] = {
+    {"input", (PyCFunction) Testset_input, METH_VARARGS,
+        "input(i) memoryview of the input of case i"},
+    {"answer", (PyCFunction) Testset_answer, METH_VARARGS,
+        "answer(i) memoryview of the expected output of case i"},
+    {"name", (PyCFunction) Testset_name, METH_VARARGS,
+        "name(i) name of case i in the packed directory"},
+    {NULL}
+};
+
+static PySequenceMethods Testset_as_sequence = {
+    (lenfunc) Testset_length,           /* sq_length */
+};
+
+static PyBufferProcs Testset_as_buffer = {
+#ifndef IS_PY3
+    0, 0, 0, 0,
+#endif
+    (getbufferproc) Testset_getbuffer,
+    (releasebufferproc) Testset_releasebuffer,
+};
+
+#define Testset_doc "Testset(path)\n"\
+    "\tmap a testset packed by lorun.pack; input(i) and answer(i) are\n"\
+    "\tviews into the mapping and can be passed to run() and check()"
+
+PyTypeObject TestsetType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_lorun_ext.Testset",               /* tp_name */
+    sizeof(TestsetObject),              /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) Testset_dealloc,       /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_reserved */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    &Testset_as_sequence,               /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    &Testset_as_buffer,                 /* tp_as_buffer */
+#ifdef IS_PY3
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+#endif
+    Testset_doc,                        /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    Testset_methods,                    /* tp_methods */
+    0,                                  /* tp_members */
+    0,                                  /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    (initproc) Testset_init,            /* tp_init */
+    0,                                  /* tp_alloc */
+    PyType_GenericNew,                  /* tp_new */
+};
@@ -0,0 +1,34 @@
+/**
+ * Loco program runner core
+ * Copyright (C) 2011  Lodevil(Du Jiong)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LO_TESTSET_HEADER
+#define __LO_TESTSET_HEADER
+
+#include "lorun.h"
+#include "pack.h"
+
+/* 映射的测试数据包，通过缓冲区协议导出整个文件 */
+typedef struct {
+    PyObject_HEAD
+    struct Pack pack;
+    Py_ssize_t exports;     //导出中的缓冲区个数，不为0时不能重新打开
+} TestsetObject;
+
+extern PyTypeObject TestsetType;
+
+#endif
@@ -0,0 +1,94 @@
+# -*- coding: utf-8 -*-
+"""测试数据打包
+
+pack(directory, path) 把目录中的N.in/N.out(或N.ans)打包为一个文件，
+由lorun.Testset映射读取，格式见cext/pack.h：
+
+    头部     magic(8) ncases(u32) align(u32)
+    索引     每个测试点 in_off in_len ans_off ans_len(u64) name(32)
+    数据     各测试点的输入和答案，起始偏移按align对齐
+
+命令行：python -m lorun.pack DIR OUT
+"""
+
+import os
+import re
+import struct
+import sys
+
+MAGIC = b'LOPACK\0\1'
+ALIGN = 4096
+NAME_MAX = 32
+HEADER = struct.Struct('<8sII')
+ENTRY = struct.Struct('<QQQQ%ds' % NAME_MAX)
+ANSWER_EXTS = ('.out', '.ans')
+
+
+def _natural(name):
+    """按数字大小排序：2在10之前"""
+    return [int(s) if s.isdigit() else s for s in re.split(r'(\d+)', name)]
+
+
+def find_cases(directory):
+    """返回[(name, in_path, answer_path), ...]，缺少答案时抛出ValueError"""
+    names = [f[:-3] for f in os.listdir(directory) if f.endswith('.in')]
+    cases = []
+    for name in sorted(names, key=_natural):
+        for ext in ANSWER_EXTS:
+            answer = os.path.join(directory, name + ext)
+            if os.path.isfile(answer):
+                break
+        else:
+            raise ValueError('no answer for %s.in' % name)
+        cases.append((name, os.path.join(directory, name + '.in'), answer))
+    return cases
+
+
+def _aligned(off):
+    return (off + ALIGN - 1) // ALIGN * ALIGN
+
+
+def pack(directory, path):
+    """打包directory中的测试点，返回测试点个数"""
+    cases = find_cases(directory)
+    for name, _, _ in cases:
+        if len(name.encode('utf-8')) > NAME_MAX:
+            raise ValueError('case name too long: %s' % name)
+
+    # 先计算全部偏移，再顺序写出
+    off = _aligned(HEADER.size + ENTRY.size * len(cases))
+    index = []
+    for name, in_path, answer in cases:
+        in_len = os.path.getsize(in_path)
+        ans_off = _aligned(off + in_len)
+        ans_len = os.path.getsize(answer)
+        index.append((off, in_len, ans_off, ans_len, name.encode('utf-8')))
+        off = _aligned(ans_off + ans_len)
+
+    tmp = path + '.tmp'
+    with open(tmp, 'wb') as f:
+        f.write(HEADER.pack(MAGIC, len(cases), ALIGN))
+        for entry in index:
+            f.write(ENTRY.pack(*entry))
+        for (_, in_path, answer), entry in zip(cases, index):
+            for blob, blob_off in ((in_path, entry[0]), (answer, entry[2])):
+                f.seek(blob_off)
+                with open(blob, 'rb') as src:
+                    f.write(src.read())
+        # 最后一个数据块之后也补齐，文件大小是align的倍数
+        f.truncate(max(off, _aligned(f.tell())))
+    os.rename(tmp, path)
+    return len(cases)
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write('usage: python -m lorun.pack DIR OUT\n')
+        return 2
+    n = pack(argv[1], argv[2])
+    sys.stdout.write('%d cases packed into %s\n' % (n, argv[2]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
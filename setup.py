@@ -6,13 +6,18 @@ from distutils.core import setup, Extension
 
 sources = [
     'lorun/cext/lorun.c', 'lorun/cext/convert.c', 'lorun/cext/access.c',
-    'lorun/cext/limit.c', 'lorun/cext/run.c', 'lorun/cext/diff.c',
-    'lorun/cext/compile.c', 'lorun/cext/special.c',
+    'lorun/cext/limit.c', 'lorun/cext/counter.c', 'lorun/cext/run.c',
+    'lorun/cext/diff.c', 'lorun/cext/compile.c', 'lorun/cext/special.c',
+    'lorun/cext/policy.c', 'lorun/cext/config.c', 'lorun/cext/result.c',
+    'lorun/cext/process.c', 'lorun/cext/capture.c', 'lorun/cext/plan.c',
+    'lorun/cext/sample.c', 'lorun/cext/problem.c', 'lorun/cext/pack.c',
+    'lorun/cext/testset.c', 'lorun/cext/stress.c', 'lorun/cext/pipeline.c',
 ]
 
 setup(name='lorun',
     version='1.0.1',
     description='loco program runner core',
     ext_modules=[Extension('lorun/_lorun_ext', sources=sources)],
-    packages=['lorun']
+    packages=['lorun'],
+    package_data={'lorun': ['profiles/*.policy']}
 )